@@ -1,11 +1,13 @@
 #include "AudioPluginUtil.h"
 #include <stdarg.h>
 
+#if !PLATFORM_WIN
+#   include <sys/mman.h>
+#endif
+
 namespace AudioPluginUtil
 {
 
-#define ENABLE_TESTS ((PLATFORM_WIN || PLATFORM_OSX) && 1)
-
 char* strnew(const char* src)
 {
     size_t size = strlen(src) + (size_t)1;
@@ -26,8 +28,7 @@ char* tmpstr(int index, const char* fmtstr, ...)
 
 template<typename T> void UnitySwap(T& a, T& b) { T t = a; a = b; b = t; }
 
-template<typename T>
-static void FFTProcess(UnityComplexNumber* data, int numsamples, bool forward)
+static int FFTNumBits(int numsamples)
 {
     unsigned int count = 1, numbits = 0;
     while ((int)count < numsamples)
@@ -35,33 +36,15 @@ static void FFTProcess(UnityComplexNumber* data, int numsamples, bool forward)
         count += count;
         ++numbits;
     }
+    return numbits;
+}
 
-    static unsigned int* reversetable[32] = { NULL };
-    unsigned int* tbl = reversetable[numbits];
-    if (tbl == NULL)
-    {
-        tbl = new unsigned int[numsamples];
-        for (unsigned int n = 0; n < (unsigned)numsamples; n++)
-        {
-            unsigned int j = 1, k = 0, m = numsamples >> 1;
-            while (m > 0)
-            {
-                if (n & m)
-                    k |= j;
-                j += j;
-                m >>= 1;
-            }
-            tbl[n] = k;
-        }
-#if ENABLE_TESTS
-        for (unsigned int n = 0; n < (unsigned)numsamples; n++)
-        {
-            assert(tbl[tbl[n]] == n);
-        }
-#endif
-        reversetable[numbits] = tbl;
-    }
-
+// Reference transform in arbitrary precision. Only the bit-reversal table is taken from the plan.
+template<typename T>
+static void FFTProcess(UnityComplexNumber* data, const FFTPlan& plan, bool forward)
+{
+    const int numsamples = plan.GetSize();
+    const unsigned int* tbl = plan.GetReverseTable();
     for (unsigned int i = 0; i < (unsigned)numsamples; i++)
     {
         unsigned int j = tbl[i];
@@ -94,20 +77,325 @@ static void FFTProcess(UnityComplexNumber* data, int numsamples, bool forward)
     }
 }
 
-void FFT::Forward(UnityComplexNumber* data, int numsamples, bool highprecision)
+FFTPlan::FFTPlan()
+    : numsamples(0)
+    , numbits(0)
+    , reversetable(NULL)
+    , twiddles(NULL)
 {
-    if (highprecision)
-        FFTProcess<double>(data, numsamples, true);
-    else
-        FFTProcess<float>(data, numsamples, true);
 }
 
-void FFT::Backward(UnityComplexNumber* data, int numsamples, bool highprecision)
+FFTPlan::~FFTPlan()
+{
+    delete[] reversetable;
+    delete[] twiddles;
+}
+
+void FFTPlan::Init(int _numsamples)
+{
+    delete[] reversetable;
+    delete[] twiddles;
+
+    numsamples = 1;
+    numbits = 0;
+    while (numsamples < _numsamples)
+    {
+        numsamples += numsamples;
+        ++numbits;
+    }
+
+    reversetable = new unsigned int[numsamples];
+    for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+    {
+        unsigned int k = 0;
+        for (int b = 0; b < numbits; b++)
+            if (n & (1u << b))
+                k |= 1u << (numbits - 1 - b);
+        reversetable[n] = k;
+    }
+#ifndef NDEBUG
+    for (unsigned int n = 0; n < (unsigned)numsamples; n++)
+    {
+        assert(reversetable[reversetable[n]] == n);
+    }
+#endif
+
+    // Each twiddle is evaluated directly in double precision, so there's no error build-up from a complex multiply recurrence
+    twiddles = new UnityComplexNumber[2 * numsamples - 1];
+    for (int L = 1; L <= numsamples; L += L)
+    {
+        UnityComplexNumber* w = twiddles + L - 1;
+        for (int k = 0; k < L; k++)
+            w[k].Set((float)cos(kPI_double * k / L), (float)-sin(kPI_double * k / L));
+    }
+}
+
+// Two radix-2 DIT stages fused into one pass: spans L and 2L, blocks of 4L.
+// w1 holds the twiddles for span L and w2 those for span 2L. s is 1 for forward and -1 for backward transforms.
+static inline void FFTRadix4Scalar(UnityComplexNumber* data, int numsamples, int L, const UnityComplexNumber* w1, const UnityComplexNumber* w2, float s)
+{
+    for (int base = 0; base < numsamples; base += 4 * L)
+    {
+        UnityComplexNumber* x0 = data + base;
+        UnityComplexNumber* x1 = x0 + L;
+        UnityComplexNumber* x2 = x1 + L;
+        UnityComplexNumber* x3 = x2 + L;
+        for (int k = 0; k < L; k++)
+        {
+            UnityComplexNumber tw1, tw2, t, a, b, c, d;
+            tw1.Set(w1[k].re, w1[k].im * s);
+            tw2.Set(w2[k].re, w2[k].im * s);
+            UnityComplexNumber::Mul(tw1, x1[k], t);
+            UnityComplexNumber::Add(x0[k], t, a);
+            UnityComplexNumber::Sub(x0[k], t, b);
+            UnityComplexNumber::Mul(tw1, x3[k], t);
+            UnityComplexNumber::Add(x2[k], t, c);
+            UnityComplexNumber::Sub(x2[k], t, d);
+            UnityComplexNumber::Mul(tw2, c, t);
+            UnityComplexNumber::Add(a, t, x0[k]);
+            UnityComplexNumber::Sub(a, t, x2[k]);
+            UnityComplexNumber::Mul(tw2, d, t);
+            t.Set(s * t.im, -s * t.re); // Twiddle for the odd half of span 2L is w2 * -i (forward) or w2 * i (backward)
+            UnityComplexNumber::Add(b, t, x1[k]);
+            UnityComplexNumber::Sub(b, t, x3[k]);
+        }
+    }
+}
+
+#if PLUGINUTIL_USE_SSE
+// Complex multiply of two interleaved (re, im, re, im) pairs
+static inline __m128 FFTComplexMulSSE(__m128 a, __m128 w, __m128 negre)
+{
+    __m128 wr = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 wi = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 1, 1));
+    __m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_add_ps(_mm_mul_ps(a, wr), _mm_xor_ps(_mm_mul_ps(as, wi), negre));
+}
+
+// Same as FFTRadix4Scalar, two butterflies at a time. Requires L >= 2.
+static void FFTRadix4SSE(UnityComplexNumber* data, int numsamples, int L, const UnityComplexNumber* w1, const UnityComplexNumber* w2, bool forward)
+{
+    const __m128 negre = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+    const __m128 negim = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+    const __m128 conj = forward ? _mm_setzero_ps() : negim;
+    const __m128 rot = forward ? negim : negre;
+    for (int base = 0; base < numsamples; base += 4 * L)
+    {
+        float* x0 = &data[base].re;
+        float* x1 = x0 + 2 * L;
+        float* x2 = x1 + 2 * L;
+        float* x3 = x2 + 2 * L;
+        for (int k = 0; k < 2 * L; k += 4)
+        {
+            __m128 tw1 = _mm_xor_ps(_mm_loadu_ps(&w1[0].re + k), conj);
+            __m128 tw2 = _mm_xor_ps(_mm_loadu_ps(&w2[0].re + k), conj);
+            __m128 v0 = _mm_loadu_ps(x0 + k);
+            __m128 v2 = _mm_loadu_ps(x2 + k);
+            __m128 t = FFTComplexMulSSE(_mm_loadu_ps(x1 + k), tw1, negre);
+            __m128 a = _mm_add_ps(v0, t);
+            __m128 b = _mm_sub_ps(v0, t);
+            t = FFTComplexMulSSE(_mm_loadu_ps(x3 + k), tw1, negre);
+            __m128 c = _mm_add_ps(v2, t);
+            __m128 d = _mm_sub_ps(v2, t);
+            t = FFTComplexMulSSE(c, tw2, negre);
+            _mm_storeu_ps(x0 + k, _mm_add_ps(a, t));
+            _mm_storeu_ps(x2 + k, _mm_sub_ps(a, t));
+            t = FFTComplexMulSSE(d, tw2, negre);
+            t = _mm_xor_ps(_mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 3, 0, 1)), rot);
+            _mm_storeu_ps(x1 + k, _mm_add_ps(b, t));
+            _mm_storeu_ps(x3 + k, _mm_sub_ps(b, t));
+        }
+    }
+}
+#endif
+
+void FFTPlan::Process(UnityComplexNumber* data, bool forward) const
+{
+    for (unsigned int i = 0; i < (unsigned)numsamples; i++)
+    {
+        unsigned int j = reversetable[i];
+        if (i < j)
+        {
+            UnitySwap(data[i].re, data[j].re);
+            UnitySwap(data[i].im, data[j].im);
+        }
+    }
+
+    int L = 1;
+    if (numbits & 1)
+    {
+        for (int i = 0; i < numsamples; i += 2)
+        {
+            UnityComplexNumber t;
+            t.Set(data[i + 1]);
+            UnityComplexNumber::Sub(data[i], t, data[i + 1]);
+            UnityComplexNumber::Add(data[i], t, data[i]);
+        }
+        L = 2;
+    }
+
+    const float s = forward ? 1.0f : -1.0f;
+    for (; L < numsamples; L *= 4)
+    {
+        const UnityComplexNumber* w1 = twiddles + L - 1;
+        const UnityComplexNumber* w2 = twiddles + 2 * L - 1;
+#if PLUGINUTIL_USE_SSE
+        if (L >= 2)
+        {
+            FFTRadix4SSE(data, numsamples, L, w1, w2, forward);
+            continue;
+        }
+#endif
+        FFTRadix4Scalar(data, numsamples, L, w1, w2, s);
+    }
+}
+
+void FFTPlan::Forward(UnityComplexNumber* data) const
+{
+    Process(data, true);
+}
+
+void FFTPlan::Backward(UnityComplexNumber* data) const
 {
+    Process(data, false);
+
+    const float scale = 1.0f / (float)numsamples;
+    for (int n = 0; n < numsamples; n++)
+    {
+        data[n].re *= scale;
+        data[n].im *= scale;
+    }
+}
+
+void FFTPlan::ForwardReal(const float* input, UnityComplexNumber* output) const
+{
+    // Pack even/odd samples as re/im. Reading pair n before writing entry n keeps this safe when input aliases output.
+    for (int n = 0; n < numsamples; n++)
+    {
+        float re = input[2 * n], im = input[2 * n + 1];
+        output[n].Set(re, im);
+    }
+
+    Forward(output);
+
+    // Split into the spectra of even and odd samples and combine: X[k] = E[k] + W^k * O[k] and X[M - k] = conj(E[k] - W^k * O[k])
+    const int M = numsamples;
+    const UnityComplexNumber* w = twiddles + M - 1;
+    UnityComplexNumber z0 = output[0];
+    output[0].Set(z0.re + z0.im, 0.0f);
+    output[M].Set(z0.re - z0.im, 0.0f);
+    for (int k = 1, j = M - 1; k < j; k++, j--)
+    {
+        UnityComplexNumber zk = output[k], zj = output[j], e, o, t;
+        e.Set(0.5f * (zk.re + zj.re), 0.5f * (zk.im - zj.im));
+        o.Set(0.5f * (zk.im + zj.im), -0.5f * (zk.re - zj.re));
+        UnityComplexNumber::Mul(w[k], o, t);
+        output[k].Set(e.re + t.re, e.im + t.im);
+        output[j].Set(e.re - t.re, t.im - e.im);
+    }
+    if (M >= 2)
+        output[M / 2].im = -output[M / 2].im;
+}
+
+void FFTPlan::BackwardReal(UnityComplexNumber* spectrum, float* output) const
+{
+    // Inverse of the ForwardReal post-processing: Z[k] = E[k] + i * O[k] with E[k] = (X[k] + conj(X[M - k])) / 2 and O[k] = (X[k] - conj(X[M - k])) * conj(W^k) / 2
+    const int M = numsamples;
+    const UnityComplexNumber* w = twiddles + M - 1;
+    float x0 = spectrum[0].re, xm = spectrum[M].re;
+    spectrum[0].Set(0.5f * (x0 + xm), 0.5f * (x0 - xm));
+    for (int k = 1, j = M - 1; k < j; k++, j--)
+    {
+        UnityComplexNumber xk = spectrum[k], xj = spectrum[j], e, d, wc, o;
+        e.Set(0.5f * (xk.re + xj.re), 0.5f * (xk.im - xj.im));
+        d.Set(0.5f * (xk.re - xj.re), 0.5f * (xk.im + xj.im));
+        wc.Set(w[k].re, -w[k].im);
+        UnityComplexNumber::Mul(d, wc, o);
+        spectrum[k].Set(e.re - o.im, e.im + o.re);
+        spectrum[j].Set(e.re + o.im, o.re - e.im);
+    }
+    if (M >= 2)
+        spectrum[M / 2].im = -spectrum[M / 2].im;
+
+    Backward(spectrum);
+
+    const float* src = &spectrum[0].re;
+    if (output != src)
+        memmove(output, src, sizeof(float) * 2 * M);
+}
+
+static std::atomic<FFTPlan*> fftplans[32];
+static Mutex fftplanmutex;
+
+static struct FFTPlanCacheCleanup
+{
+    ~FFTPlanCacheCleanup()
+    {
+        for (int n = 0; n < 32; n++)
+            delete fftplans[n].exchange(NULL);
+    }
+} fftplancachecleanup;
+
+const FFTPlan* FFTPlanCache::Acquire(int numsamples)
+{
+    int numbits = FFTNumBits(numsamples);
+    FFTPlan* plan = fftplans[numbits].load(std::memory_order_acquire);
+    if (plan != NULL)
+        return plan;
+
+    MutexScopeLock lock(fftplanmutex);
+    plan = fftplans[numbits].load(std::memory_order_relaxed);
+    if (plan == NULL)
+    {
+        plan = new FFTPlan();
+        plan->Init(numsamples);
+        fftplans[numbits].store(plan, std::memory_order_release);
+    }
+    return plan;
+}
+
+const FFTPlan* FFTPlanCache::Find(int numsamples)
+{
+    return fftplans[FFTNumBits(numsamples)].load(std::memory_order_acquire);
+}
+
+// Never creates a plan: that would lock and allocate on whatever thread is calling, which is usually the audio thread
+static inline const FFTPlan* GetFFTPlan(int numsamples)
+{
+    const FFTPlan* plan = FFTPlanCache::Find(numsamples);
+    assert(plan != NULL && "FFT size wasn't prepared");
+    return plan;
+}
+
+void FFT::Prepare(int numsamples)
+{
+    FFTPlanCache::Acquire(numsamples);
+}
+
+bool FFT::Forward(UnityComplexNumber* data, int numsamples, bool highprecision)
+{
+    const FFTPlan* plan = GetFFTPlan(numsamples);
+    if (plan == NULL)
+        return false;
     if (highprecision)
-        FFTProcess<double>(data, numsamples, false);
+        FFTProcess<double>(data, *plan, true);
     else
-        FFTProcess<float>(data, numsamples, false);
+        plan->Forward(data);
+    return true;
+}
+
+bool FFT::Backward(UnityComplexNumber* data, int numsamples, bool highprecision)
+{
+    const FFTPlan* plan = GetFFTPlan(numsamples);
+    if (plan == NULL)
+        return false;
+    if (!highprecision)
+    {
+        plan->Backward(data);
+        return true;
+    }
+
+    FFTProcess<double>(data, *plan, false);
 
     const float scale = 1.0f / (float)numsamples;
     for (int n = 0; n < numsamples; n++)
@@ -115,6 +403,84 @@ void FFT::Backward(UnityComplexNumber* data, int numsamples, bool highprecision)
         data[n].re *= scale;
         data[n].im *= scale;
     }
+    return true;
+}
+
+void FFT::PrepareReal(int numsamples)
+{
+    FFTPlanCache::Acquire(numsamples / 2);
+}
+
+bool FFT::ForwardReal(const float* input, UnityComplexNumber* output, int numsamples)
+{
+    const FFTPlan* plan = GetFFTPlan(numsamples / 2);
+    if (plan == NULL)
+        return false;
+    plan->ForwardReal(input, output);
+    return true;
+}
+
+bool FFT::BackwardReal(UnityComplexNumber* spectrum, float* output, int numsamples)
+{
+    const FFTPlan* plan = GetFFTPlan(numsamples / 2);
+    if (plan == NULL)
+        return false;
+    plan->BackwardReal(spectrum, output);
+    return true;
+}
+
+SnapshotBuffer::SnapshotBuffer()
+    : framesize(0)
+    , data(NULL)
+    , framecount(0)
+{
+    for (int n = 0; n < NUMSLOTS; n++)
+        sequence[n] = 0;
+}
+
+SnapshotBuffer::~SnapshotBuffer()
+{
+    Cleanup();
+}
+
+void SnapshotBuffer::Init(int _framesize)
+{
+    Cleanup();
+    framesize = _framesize;
+    data = new float[NUMSLOTS * framesize];
+    memset(data, 0, sizeof(float) * NUMSLOTS * framesize);
+    for (int n = 0; n < NUMSLOTS; n++)
+        sequence[n] = 0;
+    framecount = 0;
+}
+
+void SnapshotBuffer::Cleanup()
+{
+    delete[] data;
+    data = NULL;
+}
+
+float* SnapshotBuffer::BeginWrite()
+{
+    int slot = (framecount.load(std::memory_order_relaxed) + 1) % NUMSLOTS;
+    sequence[slot].store(sequence[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return data + slot * framesize;
+}
+
+void SnapshotBuffer::EndWrite()
+{
+    UInt32 frame = framecount.load(std::memory_order_relaxed) + 1;
+    int slot = frame % NUMSLOTS;
+    sequence[slot].store(sequence[slot].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    framecount.store(frame, std::memory_order_release);
+}
+
+void FFTAnalyzer::Init(int _spectrumSize)
+{
+    spectrumSize = _spectrumSize;
+    PrepareReal(spectrumSize);
+    CheckInitialized();
 }
 
 void FFTAnalyzer::Cleanup()
@@ -127,49 +493,113 @@ void FFTAnalyzer::Cleanup()
     delete[] ospec1;
     delete[] ospec2;
     delete[] cspec;
+    spectra.Cleanup();
 }
 
-void FFTAnalyzer::AnalyzeInput(float* data, int numchannels, int numsamples, float decaySpeed)
+static void FFTAnalyzerDownmix(const float* data, int numchannels, int numsamples, int channelMode, float* dst)
 {
-    CheckInitialized();
+    if (numchannels == 1 || channelMode == FFTAnalyzer::ChannelMode_First)
+    {
+        for (int n = 0; n < numsamples; n++)
+            dst[n] = data[n * numchannels];
+    }
+    else if (channelMode == FFTAnalyzer::ChannelMode_Mid)
+    {
+        for (int n = 0; n < numsamples; n++)
+            dst[n] = (data[n * numchannels] + data[n * numchannels + 1]) * 0.5f;
+    }
+    else if (channelMode == FFTAnalyzer::ChannelMode_Side)
+    {
+        for (int n = 0; n < numsamples; n++)
+            dst[n] = (data[n * numchannels] - data[n * numchannels + 1]) * 0.5f;
+    }
+    else
+    {
+        const float scale = 1.0f / (float)numchannels;
+        for (int n = 0; n < numsamples; n++)
+        {
+            const float* src = data + n * numchannels;
+            float sum = 0.0f;
+            for (int c = 0; c < numchannels; c++)
+                sum += src[c];
+            dst[n] = sum * scale;
+        }
+    }
+}
 
-    for (int n = 0; n < spectrumSize - numsamples; n++)
-        ibuffer[n] = ibuffer[n + numsamples];
-    for (int n = 0; n < numsamples; n++)
-        ibuffer[n + spectrumSize - numsamples] = data[n * numchannels];
-    for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(ibuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize, true);
-    for (int n = 0; n < spectrumSize / 2; n++)
+void FFTAnalyzer::Analyze(float* data, int numchannels, int numsamples, float decaySpeed, float* ring, int& writepos, int& hopcount, float* spec, const float* prevspec, bool& pending)
+{
+    const int hop = (hopSize > 0) ? hopSize : ((spectrumSize >= 4) ? spectrumSize / 4 : 1);
+    int n = 0;
+    while (n < numsamples)
     {
-        float a = cspec[n].Magnitude();
-        ispec1[n] = (a > ispec2[n]) ? a : ispec2[n] * decaySpeed;
+        // Copy up to the next hop or the end of the ring, whichever comes first
+        int num = numsamples - n;
+        if (num > hop - hopcount)
+            num = hop - hopcount;
+        if (num > spectrumSize - writepos)
+            num = spectrumSize - writepos;
+        FFTAnalyzerDownmix(data + n * numchannels, numchannels, num, channelMode, ring + writepos);
+        n += num;
+        writepos += num;
+        if (writepos == spectrumSize)
+            writepos = 0;
+        hopcount += num;
+        if (hopcount < hop)
+            continue;
+        hopcount = 0;
+
+        // Oldest sample is at writepos
+        float* windowed = &cspec[0].re; // Real input is packed into the first half of cspec
+        int tail = spectrumSize - writepos;
+        for (int i = 0; i < tail; i++)
+            windowed[i] = ring[writepos + i] * window[i];
+        for (int i = tail; i < spectrumSize; i++)
+            windowed[i] = ring[i - tail] * window[i];
+        ForwardReal(windowed, cspec, spectrumSize);
+
+        // Successive transforms within a block build on each other rather than on the last published spectrum
+        const float* prev = pending ? spec : prevspec;
+        for (int i = 0; i < spectrumSize / 2; i++)
+        {
+            float a = cspec[i].Magnitude();
+            spec[i] = (a > prev[i]) ? a : prev[i] * decaySpeed;
+        }
+        pending = true;
     }
 }
 
+void FFTAnalyzer::AnalyzeInput(float* data, int numchannels, int numsamples, float decaySpeed)
+{
+    CheckInitialized();
+    Analyze(data, numchannels, numsamples, decaySpeed, ibuffer, iwritepos, ihopcount, ispec1, ispec2, ipending);
+}
+
 void FFTAnalyzer::AnalyzeOutput(float* data, int numchannels, int numsamples, float decaySpeed)
 {
     CheckInitialized();
+    Analyze(data, numchannels, numsamples, decaySpeed, obuffer, owritepos, ohopcount, ospec1, ospec2, opending);
 
-    for (int n = 0; n < spectrumSize - numsamples; n++)
-        obuffer[n] = obuffer[n + numsamples];
-    for (int n = 0; n < numsamples; n++)
-        obuffer[n + spectrumSize - numsamples] = data[n * numchannels];
-    for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(obuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize, true);
-    for (int n = 0; n < spectrumSize / 2; n++)
-    {
-        float a = cspec[n].Magnitude();
-        ospec1[n] = (a > ospec2[n]) ? a : ospec2[n] * decaySpeed;
-    }
+    if (!ipending && !opending)
+        return;
 
     float* tmp;
-    tmp = ispec1; ispec1 = ispec2; ispec2 = tmp;
-    tmp = ospec1; ospec1 = ospec2; ospec2 = tmp;
+    if (ipending)
+    {
+        tmp = ispec1; ispec1 = ispec2; ispec2 = tmp;
+        ipending = false;
+    }
+    if (opending)
+    {
+        tmp = ospec1; ospec1 = ospec2; ospec2 = tmp;
+        opending = false;
+    }
 
-    if (numSpectraReady < 2)
-        numSpectraReady++;
+    const int numbins = spectrumSize / 2;
+    float* frame = spectra.BeginWrite();
+    memcpy(frame, ispec2, sizeof(float) * numbins);
+    memcpy(frame + numbins, ospec2, sizeof(float) * numbins);
+    spectra.EndWrite();
 }
 
 void FFTAnalyzer::CheckInitialized()
@@ -193,43 +623,341 @@ void FFTAnalyzer::CheckInitialized()
         memset(ospec1, 0, sizeof(float) * (spectrumSize / 2));
         memset(ospec2, 0, sizeof(float) * (spectrumSize / 2));
         memset(cspec, 0, sizeof(UnityComplexNumber) * spectrumSize);
+        spectra.Init(spectrumSize);
     }
 }
 
 bool FFTAnalyzer::CanBeRead() const
 {
-    return numSpectraReady >= 2;
+    return spectra.GetFrameCount() >= 2;
 }
 
-void FFTAnalyzer::ReadBuffer(float* buffer, int numsamples, bool readInputBuffer)
+void FFTAnalyzer::ReadBuffer(float* buffer, int numsamples, bool readInputBuffer, UInt32* frame)
 {
     if (!CanBeRead())
     {
         memset(buffer, 0, sizeof(float) * numsamples);
+        if (frame != NULL)
+            *frame = 0;
         return;
     }
     if (numsamples > spectrumSize)
         numsamples = spectrumSize;
-    float* buf = (readInputBuffer) ? ispec2 : ospec2;
-    float scale = (float)((spectrumSize / 2) - 2) / (float)(numsamples - 1);
+    const int offset = (readInputBuffer) ? 0 : spectrumSize / 2;
+    const float scale = (float)((spectrumSize / 2) - 2) / (float)(numsamples - 1);
+    UInt32 published = spectra.Read([=](const float* data)
+    {
+        const float* buf = data + offset;
+        for (int n = 0; n < numsamples; n++)
+        {
+            float f = n * scale;
+            int i = FastFloor(f);
+            buffer[n] = buf[i] + (buf[i + 1] - buf[i]) * (f - i);
+        }
+    });
+    if (frame != NULL)
+        *frame = published;
+}
+
+UniformConvolver::UniformConvolver()
+    : blocksize(0)
+    , numbins(0)
+    , numpartitions(0)
+    , fdlpos(0)
+    , irspectra(NULL)
+    , fdl(NULL)
+    , accum(NULL)
+    , inputbuffer(NULL)
+{
+}
+
+UniformConvolver::~UniformConvolver()
+{
+    Cleanup();
+}
+
+void UniformConvolver::Cleanup()
+{
+    delete[] irspectra;
+    delete[] fdl;
+    delete[] accum;
+    delete[] inputbuffer;
+    irspectra = NULL;
+    fdl = NULL;
+    accum = NULL;
+    inputbuffer = NULL;
+}
+
+void UniformConvolver::Init(const float* ir, int irlength, int _blocksize)
+{
+    Cleanup();
+
+    blocksize = _blocksize;
+    numbins = blocksize + 1;
+    numpartitions = (irlength + blocksize - 1) / blocksize;
+    if (numpartitions < 1)
+        numpartitions = 1;
+    fdlpos = 0;
+
+    irspectra = new UnityComplexNumber[numpartitions * numbins];
+    fdl = new UnityComplexNumber[numpartitions * numbins];
+    accum = new UnityComplexNumber[numbins];
+    inputbuffer = new float[2 * blocksize];
+
+    FFT::PrepareReal(2 * blocksize);
+
+    for (int k = 0; k < numpartitions; k++)
+    {
+        memset(inputbuffer, 0, sizeof(float) * 2 * blocksize);
+        int num = irlength - k * blocksize;
+        if (num > blocksize)
+            num = blocksize;
+        if (num > 0)
+            memcpy(inputbuffer, ir + k * blocksize, sizeof(float) * num);
+        FFT::ForwardReal(inputbuffer, irspectra + k * numbins, 2 * blocksize);
+    }
+
+    Reset();
+}
+
+void UniformConvolver::Reset()
+{
+    fdlpos = 0;
+    memset(fdl, 0, sizeof(UnityComplexNumber) * numpartitions * numbins);
+    memset(inputbuffer, 0, sizeof(float) * 2 * blocksize);
+}
+
+void UniformConvolver::ProcessBlock(const float* input, float* output)
+{
+    memcpy(inputbuffer, inputbuffer + blocksize, sizeof(float) * blocksize);
+    memcpy(inputbuffer + blocksize, input, sizeof(float) * blocksize);
+    FFT::ForwardReal(inputbuffer, fdl + fdlpos * numbins, 2 * blocksize);
+
+    memset(accum, 0, sizeof(UnityComplexNumber) * numbins);
+    int slot = fdlpos;
+    for (int k = 0; k < numpartitions; k++)
+    {
+        const UnityComplexNumber* x = fdl + slot * numbins;
+        const UnityComplexNumber* h = irspectra + k * numbins;
+        for (int n = 0; n < numbins; n++)
+        {
+            accum[n].re += x[n].re * h[n].re - x[n].im * h[n].im;
+            accum[n].im += x[n].re * h[n].im + x[n].im * h[n].re;
+        }
+        if (--slot < 0)
+            slot = numpartitions - 1;
+    }
+    if (++fdlpos == numpartitions)
+        fdlpos = 0;
+
+    // The first half of the circular convolution is wrapped around, the second half is the valid output
+    float* result = &accum[0].re;
+    FFT::BackwardReal(accum, result, 2 * blocksize);
+    memcpy(output, result + blocksize, sizeof(float) * blocksize);
+}
+
+void BiquadBank::Init(int _numfilters)
+{
+    numfilters = (_numfilters < MAXFILTERS) ? _numfilters : MAXFILTERS;
+    numlanes = (numfilters + 3) & ~3;
+    for (int n = 0; n < MAXFILTERS; n++)
+        SetCoeffs(n, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    Reset();
+}
+
+void BiquadBank::Reset()
+{
+    memset(s1, 0, sizeof(s1));
+    memset(s2, 0, sizeof(s2));
+}
+
+void BiquadBank::SetCoeffs(int index, float _b0, float _b1, float _b2, float _a1, float _a2)
+{
+    b0[index] = _b0;
+    b1[index] = _b1;
+    b2[index] = _b2;
+    a1[index] = _a1;
+    a2[index] = _a2;
+}
+
+void BiquadBank::SetFilter(int index, const BiquadFilter& filter)
+{
+    BiquadFilter copy = filter;
+    float coeffs[5], *p = coeffs;
+    copy.StoreCoeffs(p);
+    SetCoeffs(index, coeffs[2], coeffs[1], coeffs[0], coeffs[4], coeffs[3]);
+}
+
+void BiquadBank::ProcessParallel(const float* input, float* output, int numsamples, int numchannels)
+{
+    float frame[MAXFILTERS];
+    memset(frame, 0, sizeof(frame));
+#if PLUGINUTIL_USE_SSE
+    for (int g = 0; g < numlanes; g += 4)
+    {
+        __m128 B0 = _mm_loadu_ps(b0 + g), B1 = _mm_loadu_ps(b1 + g), B2 = _mm_loadu_ps(b2 + g);
+        __m128 A1 = _mm_loadu_ps(a1 + g), A2 = _mm_loadu_ps(a2 + g);
+        __m128 S1 = _mm_loadu_ps(s1 + g), S2 = _mm_loadu_ps(s2 + g);
+        int numgroupchannels = numchannels - g;
+        if (numgroupchannels > 4)
+            numgroupchannels = 4;
+        if (numgroupchannels <= 0)
+            break;
+        for (int n = 0; n < numsamples; n++)
+        {
+            const float* src = input + n * numchannels + g;
+            float* dst = output + n * numchannels + g;
+            __m128 x;
+            if (numgroupchannels == 4)
+                x = _mm_loadu_ps(src);
+            else
+            {
+                for (int c = 0; c < numgroupchannels; c++)
+                    frame[c] = src[c];
+                x = _mm_loadu_ps(frame);
+            }
+            __m128 y = _mm_add_ps(_mm_mul_ps(B0, x), S1);
+            S1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(B1, x), _mm_mul_ps(A1, y)), S2);
+            S2 = _mm_sub_ps(_mm_mul_ps(B2, x), _mm_mul_ps(A2, y));
+            if (numgroupchannels == 4)
+                _mm_storeu_ps(dst, y);
+            else
+            {
+                _mm_storeu_ps(frame, y);
+                for (int c = 0; c < numgroupchannels; c++)
+                    dst[c] = frame[c];
+            }
+        }
+        _mm_storeu_ps(s1 + g, S1);
+        _mm_storeu_ps(s2 + g, S2);
+    }
+#else
     for (int n = 0; n < numsamples; n++)
+        for (int c = 0; c < numchannels; c++)
+            output[n * numchannels + c] = Tick(c, input[n * numchannels + c]);
+#endif
+}
+
+void BiquadBank::ProcessSplit(const float* input, float* output, int numsamples)
+{
+#if PLUGINUTIL_USE_SSE
+    float frame[4];
+    for (int g = 0; g < numlanes; g += 4)
     {
-        float f = n * scale;
-        int i = FastFloor(f);
-        buffer[n] = buf[i] + (buf[i + 1] - buf[i]) * (f - i);
+        __m128 B0 = _mm_loadu_ps(b0 + g), B1 = _mm_loadu_ps(b1 + g), B2 = _mm_loadu_ps(b2 + g);
+        __m128 A1 = _mm_loadu_ps(a1 + g), A2 = _mm_loadu_ps(a2 + g);
+        __m128 S1 = _mm_loadu_ps(s1 + g), S2 = _mm_loadu_ps(s2 + g);
+        int numgroupfilters = (numfilters - g < 4) ? (numfilters - g) : 4;
+        for (int n = 0; n < numsamples; n++)
+        {
+            __m128 x = _mm_set1_ps(input[n]);
+            __m128 y = _mm_add_ps(_mm_mul_ps(B0, x), S1);
+            S1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(B1, x), _mm_mul_ps(A1, y)), S2);
+            S2 = _mm_sub_ps(_mm_mul_ps(B2, x), _mm_mul_ps(A2, y));
+            float* dst = output + n * numfilters + g;
+            if (numgroupfilters == 4)
+                _mm_storeu_ps(dst, y);
+            else
+            {
+                _mm_storeu_ps(frame, y);
+                for (int c = 0; c < numgroupfilters; c++)
+                    dst[c] = frame[c];
+            }
+        }
+        _mm_storeu_ps(s1 + g, S1);
+        _mm_storeu_ps(s2 + g, S2);
     }
+#else
+    for (int n = 0; n < numsamples; n++)
+        for (int k = 0; k < numfilters; k++)
+            output[n * numfilters + k] = Tick(k, input[n]);
+#endif
+}
+
+// Runs sections base..base+3 in series. With SSE the sections form a skewed pipeline in which lane k works on the sample
+// k steps behind lane 0, so all four advance with each instruction. The triangles at either end of the block, where
+// the pipeline isn't full, are done one section at a time so that nothing is left in flight between calls.
+void BiquadBank::CascadeGroup(int base, const float* input, float* output, int numsamples)
+{
+#if PLUGINUTIL_USE_SSE
+    if (numsamples >= 4)
+    {
+        float y00 = Tick(base, input[0]), y01 = Tick(base, input[1]), y02 = Tick(base, input[2]);
+        float y10 = Tick(base + 1, y00), y11 = Tick(base + 1, y01);
+        float y20 = Tick(base + 2, y10);
+
+        __m128 B0 = _mm_loadu_ps(b0 + base), B1 = _mm_loadu_ps(b1 + base), B2 = _mm_loadu_ps(b2 + base);
+        __m128 A1 = _mm_loadu_ps(a1 + base), A2 = _mm_loadu_ps(a2 + base);
+        __m128 S1 = _mm_loadu_ps(s1 + base), S2 = _mm_loadu_ps(s2 + base);
+        __m128 x = _mm_setr_ps(input[3], y02, y11, y20);
+        __m128 y = x;
+        for (int t = 3; t < numsamples; t++)
+        {
+            y = _mm_add_ps(_mm_mul_ps(B0, x), S1);
+            S1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(B1, x), _mm_mul_ps(A1, y)), S2);
+            S2 = _mm_sub_ps(_mm_mul_ps(B2, x), _mm_mul_ps(A2, y));
+            output[t - 3] = _mm_cvtss_f32(_mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3)));
+            x = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(y), 4)); // Each section feeds the next one
+            if (t + 1 < numsamples)
+                x = _mm_move_ss(x, _mm_set_ss(input[t + 1]));
+        }
+        _mm_storeu_ps(s1 + base, S1);
+        _mm_storeu_ps(s2 + base, S2);
+
+        // y holds the last outputs of sections 0..2 for samples n-1, n-2 and n-3
+        float last[4];
+        _mm_storeu_ps(last, y);
+        float y1 = Tick(base + 1, last[0]);
+        float y2a = Tick(base + 2, last[1]);
+        float y2b = Tick(base + 2, y1);
+        output[numsamples - 3] = Tick(base + 3, last[2]);
+        output[numsamples - 2] = Tick(base + 3, y2a);
+        output[numsamples - 1] = Tick(base + 3, y2b);
+        return;
+    }
+#endif
+    for (int k = base; k < base + 4; k++)
+    {
+        const float* src = (k == base) ? input : output;
+        float B0 = b0[k], B1 = b1[k], B2 = b2[k], A1 = a1[k], A2 = a2[k], S1 = s1[k], S2 = s2[k];
+        for (int n = 0; n < numsamples; n++)
+        {
+            float x = src[n];
+            float y = B0 * x + S1;
+            S1 = B1 * x - A1 * y + S2;
+            S2 = B2 * x - A2 * y;
+            output[n] = y;
+        }
+        s1[k] = S1;
+        s2[k] = S2;
+    }
+}
+
+void BiquadBank::ProcessCascade(const float* input, float* output, int numsamples)
+{
+    for (int g = 0; g < numlanes; g += 4)
+        CascadeGroup(g, (g == 0) ? input : output, output, numsamples);
 }
 
 HistoryBuffer::HistoryBuffer()
     : length(0)
     , writeindex(0)
+    , writecount(0)
     , data(NULL)
+    , numlevels(0)
 {
+    memset(levels, 0, sizeof(levels));
 }
 
 HistoryBuffer::~HistoryBuffer()
 {
     delete[] data;
+    for (int n = 0; n < numlevels; n++)
+    {
+        delete[] levels[n].minval;
+        delete[] levels[n].maxval;
+        delete[] levels[n].meansquare;
+    }
 }
 
 void HistoryBuffer::Init(int _length)
@@ -237,13 +965,156 @@ void HistoryBuffer::Init(int _length)
     length = _length;
     data = new float[length];
     memset(data, 0, sizeof(float) * length);
+
+    // Only keep levels that can hold a useful number of entries. Levels are rounded up to a power of two with a couple
+    // of entries to spare, so they always reach at least as far back as the raw samples.
+    int shift = PYRAMIDSHIFT;
+    while (numlevels < MAXPYRAMIDLEVELS && (length >> shift) >= 2)
+    {
+        PyramidLevel& level = levels[numlevels++];
+        level.length = 1;
+        while (level.length < (length >> shift) + 2)
+            level.length *= 2;
+        level.mask = level.length - 1;
+        level.shift = shift;
+        level.minval = new float[level.length];
+        level.maxval = new float[level.length];
+        level.meansquare = new float[level.length];
+        memset(level.minval, 0, sizeof(float) * level.length);
+        memset(level.maxval, 0, sizeof(float) * level.length);
+        memset(level.meansquare, 0, sizeof(float) * level.length);
+        shift += PYRAMIDSHIFT;
+    }
+}
+
+void HistoryBuffer::EmitPyramidEntry(int index)
+{
+    PyramidLevel& level = levels[index];
+    float minval = level.accmin, maxval = level.accmax, meansquare = level.accsquare * (1.0f / PYRAMIDRATIO);
+    int i = (int)level.numentries & level.mask;
+    level.minval[i] = minval;
+    level.maxval[i] = maxval;
+    level.meansquare[i] = meansquare;
+    level.numentries++;
+    level.accsquare = 0.0f;
+    level.acccount = 0;
+
+    if (index + 1 >= numlevels)
+        return;
+
+    PyramidLevel& parent = levels[index + 1];
+    if (parent.acccount == 0)
+    {
+        parent.accmin = minval;
+        parent.accmax = maxval;
+    }
+    else
+    {
+        if (minval < parent.accmin)
+            parent.accmin = minval;
+        if (maxval > parent.accmax)
+            parent.accmax = maxval;
+    }
+    parent.accsquare += meansquare;
+    if (++parent.acccount == PYRAMIDRATIO)
+        EmitPyramidEntry(index + 1);
+}
+
+int HistoryBuffer::ReadEnvelope(float* minbuffer, float* maxbuffer, float* rmsbuffer, int numpoints, int numsamplesSource, int offset)
+{
+    if (numpoints <= 0 || offset < 0)
+        return 0;
+
+    UInt64 count = writecount.load(std::memory_order_acquire);
+    double span = (double)numsamplesSource / (double)numpoints;
+
+    // Coarsest level whose entries still fit inside one point, so a point never needs PYRAMIDRATIO or more of them
+    int index = -1;
+    while (index + 1 < numlevels && (double)(1 << levels[index + 1].shift) <= span)
+        index++;
+    int decimation = (index < 0) ? 1 : (1 << levels[index].shift);
+
+    // How far back we can look without touching entries the DSP thread may overwrite next
+    UInt64 limit = (length > 2 * decimation) ? (UInt64)(length - 2 * decimation) : 0;
+    if (limit > count)
+        limit = count;
+
+    int n;
+    if (index < 0)
+    {
+        // Less than PYRAMIDRATIO raw samples per point. Sample count - 1 - d was written at index (count - d) % length, see Feed.
+        int newest = (int)(count % (UInt64)length);
+        for (n = 0; n < numpoints; n++)
+        {
+            UInt64 d0 = offset + (UInt64)(n * span);
+            UInt64 d1 = offset + (UInt64)((n + 1) * span);
+            if (d1 <= d0)
+                d1 = d0 + 1;
+            if (d1 > limit)
+                break;
+            int i = newest - (int)d1 + 1;
+            if (i < 0)
+                i += length;
+            float minval = data[i], maxval = minval;
+            float sumsquare = 0.0f;
+            for (int d = (int)(d1 - d0); d > 0; d--)
+            {
+                float x = data[i];
+                minval = (x < minval) ? x : minval;
+                maxval = (x > maxval) ? x : maxval;
+                sumsquare += x * x;
+                if (++i == length)
+                    i = 0;
+            }
+            int p = numpoints - 1 - n;
+            minbuffer[p] = minval;
+            maxbuffer[p] = maxval;
+            rmsbuffer[p] = sqrtf(sumsquare / (float)(d1 - d0));
+        }
+    }
+    else
+    {
+        // Snap both ends of each point to the level's entries, rounding down so the newest point only uses complete ones
+        const PyramidLevel& level = levels[index];
+        const int shift = level.shift, mask = level.mask;
+        for (n = 0; n < numpoints; n++)
+        {
+            UInt64 d0 = offset + (UInt64)(n * span);
+            UInt64 d1 = offset + (UInt64)((n + 1) * span);
+            if (d1 > limit)
+                break;
+            UInt64 first = (count - d1) >> shift, last = (count - d0) >> shift; // span >= decimation, so last > first
+            int i = (int)first & mask;
+            float minval = level.minval[i], maxval = level.maxval[i];
+            float sumsquare = 0.0f;
+            for (int m = (int)(last - first); m > 0; m--)
+            {
+                minval = (level.minval[i] < minval) ? level.minval[i] : minval;
+                maxval = (level.maxval[i] > maxval) ? level.maxval[i] : maxval;
+                sumsquare += level.meansquare[i];
+                i = (i + 1) & mask;
+            }
+            int p = numpoints - 1 - n;
+            minbuffer[p] = minval;
+            maxbuffer[p] = maxval;
+            rmsbuffer[p] = sqrtf(sumsquare / (float)(last - first));
+        }
+    }
+
+    // Drop the oldest points if the DSP thread overwrote any of their data while we were reading
+    std::atomic_thread_fence(std::memory_order_acquire);
+    UInt64 overwritten = writecount.load(std::memory_order_relaxed) - count;
+    while (n > 0 && offset + (UInt64)(n * span) + overwritten > limit)
+        n--;
+    return n;
 }
 
 void HistoryBuffer::ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset)
 {
     numsamplesTarget--; // reserve last sample for count of how much we were able to read
     float speed = (float)numsamplesSource / (float)numsamplesTarget;
-    int n, w = writeindex; // since ReadBuffer is called from the GUI thread, writeindex may be modified by the DSP thread simultaneously
+    UInt64 count = writecount.load(std::memory_order_acquire);
+    int n, w = writeindex.load(std::memory_order_acquire);
     float p = offset;
     for (n = 0; n < numsamplesTarget; n++)
     {
@@ -258,9 +1129,97 @@ void HistoryBuffer::ReadBuffer(float* buffer, int numsamplesTarget, int numsampl
         if (p >= length)
             break;
     }
+
+    // Anything the DSP thread overwrote while we were reading is not reported as valid
+    std::atomic_thread_fence(std::memory_order_acquire);
+    float overwritten = (float)(writecount.load(std::memory_order_relaxed) - count);
+    float safe = length - 2 - overwritten - offset;
+    if (safe < 0.0f)
+        n = 0;
+    else if (n > (int)(safe / speed) + 1)
+        n = (int)(safe / speed) + 1;
     buffer[numsamplesTarget] = (float)n; // how many samples were written
 }
 
+Arena* Arena::Create(size_t size)
+{
+    const size_t pagesize = 4096, hugepagesize = 2 * 1024 * 1024;
+    size_t headersize = Footprint(sizeof(Arena));
+    size_t mappedsize = (headersize + size + pagesize - 1) & ~(pagesize - 1);
+    bool hugepages = false;
+    void* mem = NULL;
+
+#if PLATFORM_WIN
+    // Large pages need the "Lock pages in memory" privilege, which games don't have, so stick to regular pages
+    mem = VirtualAlloc(NULL, mappedsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (mem == NULL)
+        return NULL;
+    for (size_t offset = 0; offset < mappedsize; offset += pagesize)
+        ((volatile char*)mem)[offset] = 0;
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if PLATFORM_LINUX
+    flags |= MAP_POPULATE; // Fault all pages in now rather than on the audio thread
+    if (headersize + size >= hugepagesize)
+    {
+        size_t hugesize = (headersize + size + hugepagesize - 1) & ~(hugepagesize - 1);
+        mem = mmap(NULL, hugesize, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED)
+        {
+            mappedsize = hugesize;
+            hugepages = true;
+        }
+        else
+            mem = NULL;
+    }
+#endif
+    if (mem == NULL)
+    {
+        mem = mmap(NULL, mappedsize, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (mem == MAP_FAILED)
+            return NULL;
+#if PLATFORM_LINUX
+        // Without reserved huge pages, transparent huge pages may still back the block
+        if (mappedsize >= hugepagesize)
+            madvise(mem, mappedsize, MADV_HUGEPAGE);
+#else
+        for (size_t offset = 0; offset < mappedsize; offset += pagesize)
+            ((volatile char*)mem)[offset] = 0;
+#endif
+    }
+#endif
+
+    // Fresh pages from the OS are zero-filled, so allocations need no clearing
+    Arena* arena = new(mem) Arena;
+    arena->base = (char*)mem + headersize;
+    arena->size = mappedsize - headersize;
+    arena->used = 0;
+    arena->mappedsize = mappedsize;
+    arena->hugepages = hugepages;
+    return arena;
+}
+
+void Arena::Destroy(Arena* arena)
+{
+    if (arena == NULL)
+        return;
+#if PLATFORM_WIN
+    VirtualFree(arena, 0, MEM_RELEASE);
+#else
+    munmap(arena, arena->mappedsize);
+#endif
+}
+
+void* Arena::Allocate(size_t numbytes)
+{
+    size_t footprint = Footprint(numbytes);
+    if (footprint > size - used)
+        return NULL;
+    void* p = base + used;
+    used += footprint;
+    return p;
+}
+
 Mutex::Mutex()
 {
 #if PLATFORM_WIN
@@ -429,80 +1388,3 @@ extern "C" UNITY_AUDIODSP_EXPORT_API int AUDIO_CALLING_CONVENTION UnityGetAudioE
     return numeffects;
 }
 
-// Simplistic unit-test framework
-#if ENABLE_TESTS
-    #define NAP_TESTSUITE(name) \
-        namespace testsuite_##name { inline const char* GetSuiteName() { return #name; } }\
-        namespace testsuite_##name
-    #define NAP_UNITTEST(name) \
-        struct NAP_Test_##name { NAP_Test_##name(const char* testname); };\
-        static NAP_Test_##name test_##name(#name);\
-        NAP_Test_##name::NAP_Test_##name(const char* testname)
-    #define NAP_CHECK(...) \
-        do\
-        {\
-            if(!(__VA_ARGS__))\
-            {\
-                printf("%s(%d): Unit test '%s' failed for expression '%s'.\n", __FILE__, __LINE__, testname, #__VA_ARGS__);\
-                assert(false && "Unit test in native audio plugin framework failed!");\
-            }\
-        } while(false)
-#else
-    #define NAP_TESTSUITE(name) namespace testsuite_##name
-    #define NAP_UNITTEST(name) static void test_##name()
-    #define NAP_CHECK(...) do {} while(false)
-#endif
-
-NAP_TESTSUITE(FFT)
-{
-    NAP_UNITTEST(Accuracy)
-    {
-        for (int test = 0; test < 2; test++)
-        {
-            bool highprecision = (test == 1);
-
-            AudioPluginUtil::Random r;
-            for (int b = 4; b <= 20; b++)
-            {
-                int num = 1 << b;
-
-                AudioPluginUtil::UnityComplexNumber* test1 = new AudioPluginUtil::UnityComplexNumber[num];
-                AudioPluginUtil::UnityComplexNumber* test2 = new AudioPluginUtil::UnityComplexNumber[num];
-
-                for (int n = 0; n < num; n++)
-                {
-                    test1[n].re = r.GetFloat(-1.0f, 1.0f);
-                    test1[n].im = r.GetFloat(-1.0f, 1.0f);
-                    test2[n].re = test1[n].re;
-                    test2[n].im = test1[n].im;
-                }
-
-                AudioPluginUtil::FFT::Forward(test2, num, highprecision);
-                AudioPluginUtil::FFT::Backward(test2, num, highprecision);
-
-                double errtol = (highprecision) ? 1.0e-6 : 1.5e-3;
-                double maxerr = 0.0f, errsum = 0.0, rms = 0.0;
-                for (int n = 0; n < num; n++)
-                {
-                    float err, diff;
-                    diff = test1[n].re - test2[n].re; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
-                        maxerr = err;
-                    rms += diff * diff;
-                    diff = test1[n].im - test2[n].im; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
-                        maxerr = err;
-                    rms += diff * diff;
-                }
-
-                double avgerr = errsum / (double)num;
-                rms = sqrt(rms / (double)num);
-
-                delete[] test1;
-                delete[] test2;
-
-                printf("%2d bits: MaxErr=%15.8g ErrSum=%15.8g AvgErr=%15.8g ErrRMS=%15.8g [%s precision]\n", b, maxerr, errsum, avgerr, rms, highprecision ? "high" : "low");
-                NAP_CHECK(avgerr < errtol);
-                NAP_CHECK(rms < errtol);
-            }
-        }
-    }
-}
@@ -8,6 +8,17 @@
 #include <string.h>
 #include <assert.h>
 
+#include <atomic>
+#include <new>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define PLUGINUTIL_USE_SSE 1
+#else
+#   define PLUGINUTIL_USE_SSE 0
+#endif
+
 #if PLATFORM_WIN
 #   include <windows.h>
 #else
@@ -16,6 +27,15 @@
 #   define vsprintf_s vsprintf
 #endif
 
+// Hooks of the real-time safety checker in RTCheck.cpp. They stay unresolved unless the checker is linked in or preloaded.
+#if defined(__ELF__)
+#   define PLUGINUTIL_USE_RTCHECK 1
+extern "C" void RTCheckEnter() __attribute__((weak));
+extern "C" void RTCheckLeave() __attribute__((weak));
+#else
+#   define PLUGINUTIL_USE_RTCHECK 0
+#endif
+
 namespace AudioPluginUtil
 {
 
@@ -30,6 +50,81 @@ inline float FastMin(float a, float b) { return (a + b - fabsf(a - b)) * 0.5f; }
 inline float FastMax(float a, float b) { return (a + b + fabsf(a - b)) * 0.5f; }
 inline int FastFloor(float x) { return (int)floorf(x); } // TODO: Optimize
 
+// Enables flush-to-zero and denormals-are-zero for the current thread while in scope and restores the previous mode
+// afterwards. Every ProcessCallback starts with one, so decaying filter and envelope tails become exact zeros instead of
+// denormals, which cost many times more per operation on most CPUs.
+class DenormalGuard
+{
+public:
+    inline DenormalGuard()
+    {
+#if PLUGINUTIL_USE_SSE
+        saved = _mm_getcsr();
+        _mm_setcsr((unsigned int)saved | 0x8040); // FTZ | DAZ
+#elif defined(__aarch64__)
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(saved));
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(saved | (1 << 24))); // FZ
+#endif
+    }
+
+    inline ~DenormalGuard()
+    {
+#if PLUGINUTIL_USE_SSE
+        _mm_setcsr((unsigned int)saved);
+#elif defined(__aarch64__)
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(saved));
+#endif
+    }
+
+private:
+    DenormalGuard(const DenormalGuard&);
+    DenormalGuard& operator=(const DenormalGuard&);
+
+    UInt64 saved;
+};
+
+// Marks the current thread as running a process callback, so the real-time safety checker reports any allocation,
+// lock, sleep or file access made while it's alive. Without the checker this is a test of a null pointer.
+class RealtimeScope
+{
+public:
+    inline RealtimeScope()
+    {
+#if PLUGINUTIL_USE_RTCHECK
+        if (RTCheckEnter)
+            RTCheckEnter();
+#endif
+    }
+
+    inline ~RealtimeScope()
+    {
+#if PLUGINUTIL_USE_RTCHECK
+        if (RTCheckLeave)
+            RTCheckLeave();
+#endif
+    }
+
+private:
+    RealtimeScope(const RealtimeScope&);
+    RealtimeScope& operator=(const RealtimeScope&);
+};
+
+// Sine and cosine of x in [-pi, pi] from odd Taylor polynomials on [-pi/2, pi/2], accurate to about 1e-7
+inline float FastSinHalfPi(float x)
+{
+    float x2 = x * x;
+    return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f + x2 * (-1.0f / 39916800.0f))))));
+}
+
+inline void FastSinCos(float x, float& s, float& c)
+{
+    const float halfpi = 0.5f * kPI;
+    float ax = fabsf(x);
+    float fold = kPI - ax;
+    s = copysignf(FastSinHalfPi((fold < ax) ? fold : ax), x); // Branch free so loops around it can be vectorized
+    c = FastSinHalfPi(halfpi - ax);
+}
+
 char* strnew(const char* src);
 char* tmpstr(int index, const char* fmtstr, ...);
 
@@ -106,22 +201,164 @@ public:
 
 typedef UnityComplexNumberT<float> UnityComplexNumber;
 
+// Precomputed bit-reversal and twiddle tables for one power-of-two transform size.
+// The transform itself runs fused radix-4 butterflies (two radix-2 stages per pass) with an SSE path.
+class FFTPlan
+{
+public:
+    FFTPlan();
+    ~FFTPlan();
+
+public:
+    void Init(int numsamples);
+    void Forward(UnityComplexNumber* data) const;
+    void Backward(UnityComplexNumber* data) const; // Includes the 1/N scaling
+
+    // Real transforms of 2 * GetSize() samples, computed as a half-size complex transform plus a post-twiddle pass.
+    // The spectrum holds bins 0..GetSize() (inclusive). input may alias output.
+    void ForwardReal(const float* input, UnityComplexNumber* output) const;
+    // Overwrites spectrum. output may alias spectrum. Includes the 1/N scaling.
+    void BackwardReal(UnityComplexNumber* spectrum, float* output) const;
+
+    inline int GetSize() const { return numsamples; }
+    inline const unsigned int* GetReverseTable() const { return reversetable; }
+
+protected:
+    void Process(UnityComplexNumber* data, bool forward) const;
+
+protected:
+    int numsamples;
+    int numbits;
+    unsigned int* reversetable;
+    UnityComplexNumber* twiddles; // Forward twiddles exp(-i*pi*k/L) for k < L of the stage with butterfly span L start at twiddles[L - 1].
+                                  // The span L = numsamples entries are the post-twiddles for the real transforms.
+};
+
+// Plans shared by all plugin instances. Sizes must be acquired outside the audio thread (e.g. in CreateCallback);
+// after that, lookups are lock-free and never allocate. Plans live until the library is unloaded.
+class FFTPlanCache
+{
+public:
+    static const FFTPlan* Acquire(int numsamples); // Takes a lock and may allocate
+    static const FFTPlan* Find(int numsamples);    // Returns NULL if the size hasn't been acquired yet
+};
+
 class FFT
 {
 public:
-    static void Forward(UnityComplexNumber* data, int numsamples, bool highprecision);
-    static void Backward(UnityComplexNumber* data, int numsamples, bool highprecision);
+    // Every size has to be prepared outside the audio thread before it's transformed. The transforms never create a plan;
+    // for a size that wasn't prepared they assert in debug builds and leave the data untouched and return false otherwise.
+    static void Prepare(int numsamples);
+    static bool Forward(UnityComplexNumber* data, int numsamples, bool highprecision);
+    static bool Backward(UnityComplexNumber* data, int numsamples, bool highprecision);
+
+    // Real-input transforms of numsamples samples to/from numsamples / 2 + 1 bins. See FFTPlan::ForwardReal/BackwardReal.
+    static void PrepareReal(int numsamples);
+    static bool ForwardReal(const float* input, UnityComplexNumber* output, int numsamples);
+    static bool BackwardReal(UnityComplexNumber* spectrum, float* output, int numsamples);
+};
+
+// Uniformly partitioned overlap-save convolution with a fixed impulse response.
+// Each ProcessBlock call consumes blocksize input samples and produces the corresponding blocksize output samples,
+// so the output lags the input by one block.
+class UniformConvolver
+{
+public:
+    UniformConvolver();
+    ~UniformConvolver();
+
+public:
+    void Init(const float* ir, int irlength, int blocksize); // Allocates, so call outside the audio thread. blocksize must be a power of two.
+    void Reset();
+    void ProcessBlock(const float* input, float* output);
+    inline int GetBlockSize() const { return blocksize; }
+
+protected:
+    void Cleanup();
+
+protected:
+    int blocksize;
+    int numbins;
+    int numpartitions;
+    int fdlpos;
+    UnityComplexNumber* irspectra; // Spectrum of each zero-padded IR partition, numbins each
+    UnityComplexNumber* fdl;       // Frequency-domain delay line of input spectra, numbins each
+    UnityComplexNumber* accum;
+    float* inputbuffer;            // Previous block followed by the current one
+};
+
+// Publishes fixed-size float frames from one writer (the audio thread) to any number of reader threads.
+// The writer never waits: it fills one of three slots and then marks it as the latest frame. Readers look at the
+// latest frame in place and retry only if the writer lapped them and reused that slot while they were reading.
+// The frame counter starts at 0 and increases with every published frame, so pollers can tell whether anything changed.
+class SnapshotBuffer
+{
+public:
+    SnapshotBuffer();
+    ~SnapshotBuffer();
+
+public:
+    void Init(int framesize); // Allocates, so call outside the audio thread
+    void Cleanup();
+    float* BeginWrite();
+    void EndWrite();
+    inline int GetFrameSize() const { return framesize; }
+    inline UInt32 GetFrameCount() const { return framecount.load(std::memory_order_acquire); }
+
+    // Calls reader(const float* frame) on the latest frame until it saw a consistent one and returns that frame's
+    // number, or 0 if nothing was published yet. The reader may see torn data on attempts that get discarded.
+    template<typename Reader> UInt32 Read(Reader reader) const
+    {
+        for (;;)
+        {
+            UInt32 frame = framecount.load(std::memory_order_acquire);
+            if (frame == 0)
+                return 0;
+            int slot = frame % NUMSLOTS;
+            UInt32 seq1 = sequence[slot].load(std::memory_order_acquire);
+            if (seq1 & 1)
+                continue;
+            reader((const float*)(data + slot * framesize));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence[slot].load(std::memory_order_relaxed) == seq1)
+                return frame;
+        }
+    }
+
+protected:
+    enum { NUMSLOTS = 3 };
+    int framesize;
+    float* data;
+    std::atomic<UInt32> sequence[NUMSLOTS]; // Odd while the slot is being written
+    std::atomic<UInt32> framecount;
 };
 
+// History is kept in circular buffers and a transform runs every hopSize samples, regardless of the host block size.
+// The decay passed to AnalyzeInput/AnalyzeOutput is applied once per transform. Spectra computed during a block are
+// published by AnalyzeOutput.
 class FFTAnalyzer : public FFT
 {
 public:
+    enum ChannelMode
+    {
+        ChannelMode_Mix,    // Average of all channels
+        ChannelMode_Mid,    // (L + R) / 2
+        ChannelMode_Side,   // (L - R) / 2
+        ChannelMode_First   // First channel only
+    };
+
+public:
+    void Init(int spectrumSize); // Allocates all buffers up front; call from CreateCallback
     void Cleanup(); // Assumes zero-initialization
     void AnalyzeInput(float* data, int numchannels, int numsamples, float specAlpha);
     void AnalyzeOutput(float* data, int numchannels, int numsamples, float specAlpha);
     void CheckInitialized();
     bool CanBeRead() const;
-    void ReadBuffer(float* buffer, int numsamples, bool readInputBuffer);
+    void ReadBuffer(float* buffer, int numsamples, bool readInputBuffer, UInt32* frame = NULL); // Safe to call from any thread
+    inline UInt32 GetFrameCount() const { return spectra.GetFrameCount(); }
+
+protected:
+    void Analyze(float* data, int numchannels, int numsamples, float decaySpeed, float* ring, int& writepos, int& hopcount, float* spec, const float* prevspec, bool& pending);
 
 public:
     float* window;
@@ -132,48 +369,117 @@ public:
     float* ispec2;
     float* ospec1;
     float* ospec2;
+    SnapshotBuffer spectra; // Published copies of ispec2 followed by ospec2
     int spectrumSize;
-    int numSpectraReady;
+    int hopSize;        // Samples between transforms, 0 means spectrumSize / 4
+    int channelMode;    // ChannelMode
+    int iwritepos, owritepos;
+    int ihopcount, ohopcount;
+    bool ipending, opending; // ispec1/ospec1 hold a spectrum that hasn't been published yet
 };
 
+// Besides the raw samples, the history keeps a min/max/mean-square pyramid at 16x, 256x and 4096x decimation that is
+// updated as samples are fed, so zoomed-out views only need to visit a few precomputed values per output point.
 class HistoryBuffer
 {
+public:
+    enum
+    {
+        PYRAMIDRATIO = 16,
+        PYRAMIDSHIFT = 4,
+        MAXPYRAMIDLEVELS = 3
+    };
+
+    struct PyramidLevel
+    {
+        int length;         // Number of entries kept, a power of two so entries can be located with mask
+        int mask;
+        int shift;          // log2 of the decimation, i.e. how many samples each entry covers
+        float* minval;
+        float* maxval;
+        float* meansquare;
+        UInt64 numentries;  // Entry m covers samples [m, m + 1) << shift and is stored at m & mask
+        float accmin;       // Accumulator for the entry being built from samples or entries of the level below
+        float accmax;
+        float accsquare;
+        int acccount;
+    };
+
 public:
     HistoryBuffer();
     ~HistoryBuffer();
 
 public:
     void Init(int _length);
-    void ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset);
+    void ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset); // Safe to call from any thread
+
+    // Fills numpoints min/max/RMS values (oldest first, like ReadBuffer) each covering numsamplesSource / numpoints samples,
+    // ending offset samples before the newest one. Returns how many of the newest points are valid. Safe to call from any thread.
+    // Point boundaries are snapped to the entries of the coarsest pyramid level that fits inside a point, so each point reads
+    // fewer than PYRAMIDRATIO entries and may end up to one entry earlier than asked for.
+    int ReadEnvelope(float* minbuffer, float* maxbuffer, float* rmsbuffer, int numpoints, int numsamplesSource, int offset);
+
+    inline UInt64 GetWriteCount() const { return writecount.load(std::memory_order_acquire); }
 
 public:
     inline void Feed(float sample)
     {
-        // Don't try to optimize this with ++
-        // The writeindex veriable may be read at the same time, so we don't want intermediate values indexing out of the array.
-        int w = writeindex + 1;
+        int w = writeindex.load(std::memory_order_relaxed) + 1;
         if (w == length)
             w = 0;
         data[w] = sample;
-        writeindex = w;
+        if (numlevels > 0)
+            AccumulatePyramid(sample);
+        writeindex.store(w, std::memory_order_release);
+        writecount.store(writecount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
 
     inline void Feed(float* buf, int numsamples, int stride)
     {
-        int w = writeindex;
+        int w = writeindex.load(std::memory_order_relaxed);
         for (int n = 0; n < numsamples; n++)
         {
             if (++w == length)
                 w = 0;
-            data[w] = buf[n * stride];
+            float sample = buf[n * stride];
+            data[w] = sample;
+            if (numlevels > 0)
+                AccumulatePyramid(sample);
         }
-        writeindex = w;
+        writeindex.store(w, std::memory_order_release);
+        writecount.store(writecount.load(std::memory_order_relaxed) + numsamples, std::memory_order_release);
     }
 
+protected:
+    inline void AccumulatePyramid(float sample)
+    {
+        PyramidLevel& level = levels[0];
+        if (level.acccount == 0)
+        {
+            level.accmin = sample;
+            level.accmax = sample;
+        }
+        else
+        {
+            if (sample < level.accmin)
+                level.accmin = sample;
+            if (sample > level.accmax)
+                level.accmax = sample;
+        }
+        level.accsquare += sample * sample;
+        if (++level.acccount == PYRAMIDRATIO)
+            EmitPyramidEntry(0);
+    }
+
+    void EmitPyramidEntry(int index);
+
 public:
     int length;
-    int writeindex;
+    std::atomic<int> writeindex;
+    std::atomic<UInt64> writecount; // Total number of samples fed, lets readers detect samples overwritten while reading
     float* data;
+    int numlevels;
+    PyramidLevel levels[MAXPYRAMIDLEVELS];
 };
 
 template<const int _LENGTH, typename T = float>
@@ -241,6 +547,8 @@ public:
     inline void SetupHighShelf(float cutoff, float samplerate, float gain, float Q);
     inline void SetupLowpass(float cutoff, float samplerate, float Q);
     inline void SetupHighpass(float cutoff, float samplerate, float Q);
+    inline void SetupKWeightingShelf(float samplerate);
+    inline void SetupKWeightingHighpass(float samplerate);
 
 public:
     inline float Process(float input)
@@ -252,6 +560,46 @@ public:
         return fir;
     }
 
+    // Processes every stride'th sample of a block, keeping the state in locals throughout. Input and output may alias.
+    inline void ProcessBlock(const float* input, float* output, int numsamples, int stride = 1)
+    {
+        const float _a1 = a1, _a2 = a2, _b0 = b0, _b1 = b1, _b2 = b2;
+        float _z1 = z1, _z2 = z2;
+        for (int n = 0; n < numsamples; n++)
+        {
+            float iir =     input[n * stride] - _a1 * _z1 - _a2 * _z2;
+            output[n * stride] = _b0 * iir + _b1 * _z1 + _b2 * _z2;
+            _z2 = _z1;
+            _z1 = iir;
+        }
+        z1 = _z1;
+        z2 = _z2;
+    }
+
+    inline void ProcessBlock(float* data, int numsamples, int stride = 1)
+    {
+        ProcessBlock(data, data, numsamples, stride);
+    }
+
+    // Runs a left and a right filter over an interleaved stereo block in a single pass. Input and output may alias.
+    static inline void ProcessBlockStereo(BiquadFilter& left, BiquadFilter& right, const float* input, float* output, int numframes)
+    {
+        const float la1 = left.a1, la2 = left.a2, lb0 = left.b0, lb1 = left.b1, lb2 = left.b2;
+        const float ra1 = right.a1, ra2 = right.a2, rb0 = right.b0, rb1 = right.b1, rb2 = right.b2;
+        float lz1 = left.z1, lz2 = left.z2, rz1 = right.z1, rz2 = right.z2;
+        for (int n = 0; n < numframes; n++)
+        {
+            float liir = input[2 * n]     - la1 * lz1 - la2 * lz2;
+            float riir = input[2 * n + 1] - ra1 * rz1 - ra2 * rz2;
+            output[2 * n]     = lb0 * liir + lb1 * lz1 + lb2 * lz2;
+            output[2 * n + 1] = rb0 * riir + rb1 * rz1 + rb2 * rz2;
+            lz2 = lz1; lz1 = liir;
+            rz2 = rz1; rz1 = riir;
+        }
+        left.z1 = lz1; left.z2 = lz2;
+        right.z1 = rz1; right.z2 = rz2;
+    }
+
     inline void StoreCoeffs(float*& data)
     {
         *data++ = b2;
@@ -271,64 +619,132 @@ protected:
 
 void BiquadFilter::SetupPeaking(float cutoff, float samplerate, float gain, float Q)
 {
-    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), alpha = sinf(w0) / (2.0f * Q), a0;
+    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), cosw0 = cosf(w0), alpha = sinf(w0) / (2.0f * Q), a0;
     b0 = 1.0f + alpha * A;
-    b1 = -2.0f * cosf(w0);
+    b1 = -2.0f * cosw0;
     b2 = 1.0f - alpha * A;
     a0 = 1.0f + alpha / A;
-    a1 = -2.0f * cosf(w0);
+    a1 = -2.0f * cosw0;
     a2 = 1.0f - alpha / A;
     float inv_a0 = 1.0f / a0; a1 *= inv_a0; a2 *= inv_a0; b0 *= inv_a0; b1 *= inv_a0; b2 *= inv_a0;
 }
 
 void BiquadFilter::SetupLowShelf(float cutoff, float samplerate, float gain, float Q)
 {
-    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), alpha = sinf(w0) / (2.0f * Q), a0;
-    b0 =          A * ((A + 1.0f) - (A - 1.0f) * cosf(w0) + 2.0f * sqrtf(A) * alpha);
-    b1 =   2.0f * A * ((A - 1.0f) - (A + 1.0f) * cosf(w0));
-    b2 =          A * ((A + 1.0f) - (A - 1.0f) * cosf(w0) - 2.0f * sqrtf(A) * alpha);
-    a0 =               (A + 1.0f) + (A - 1.0f) * cosf(w0) + 2.0f * sqrtf(A) * alpha;
-    a1 =  -2.0f     * ((A - 1.0f) + (A + 1.0f) * cosf(w0));
-    a2 =               (A + 1.0f) + (A - 1.0f) * cosf(w0) - 2.0f * sqrtf(A) * alpha;
+    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), cosw0 = cosf(w0), alpha = sinf(w0) / (2.0f * Q), sqrtA = sqrtf(A), a0;
+    b0 =          A * ((A + 1.0f) - (A - 1.0f) * cosw0 + 2.0f * sqrtA * alpha);
+    b1 =   2.0f * A * ((A - 1.0f) - (A + 1.0f) * cosw0);
+    b2 =          A * ((A + 1.0f) - (A - 1.0f) * cosw0 - 2.0f * sqrtA * alpha);
+    a0 =               (A + 1.0f) + (A - 1.0f) * cosw0 + 2.0f * sqrtA * alpha;
+    a1 =  -2.0f     * ((A - 1.0f) + (A + 1.0f) * cosw0);
+    a2 =               (A + 1.0f) + (A - 1.0f) * cosw0 - 2.0f * sqrtA * alpha;
     float inv_a0 = 1.0f / a0; a1 *= inv_a0; a2 *= inv_a0; b0 *= inv_a0; b1 *= inv_a0; b2 *= inv_a0;
 }
 
 void BiquadFilter::SetupHighShelf(float cutoff, float samplerate, float gain, float Q)
 {
-    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), alpha = sinf(w0) / (2.0f * Q), a0;
-    b0 =          A * ((A + 1.0f) + (A - 1.0f) * cosf(w0) + 2.0f * sqrtf(A) * alpha);
-    b1 =  -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cosf(w0));
-    b2 =          A * ((A + 1.0f) + (A - 1.0f) * cosf(w0) - 2.0f * sqrtf(A) * alpha);
-    a0 =               (A + 1.0f) - (A - 1.0f) * cosf(w0) + 2.0f * sqrtf(A) * alpha;
-    a1 =   2.0f     * ((A - 1.0f) - (A + 1.0f) * cosf(w0));
-    a2 =               (A + 1.0f) - (A - 1.0f) * cosf(w0) - 2.0f * sqrtf(A) * alpha;
+    float w0 = 2.0f * kPI * cutoff / samplerate, A = powf(10.0f, gain * 0.025f), cosw0 = cosf(w0), alpha = sinf(w0) / (2.0f * Q), sqrtA = sqrtf(A), a0;
+    b0 =          A * ((A + 1.0f) + (A - 1.0f) * cosw0 + 2.0f * sqrtA * alpha);
+    b1 =  -2.0f * A * ((A - 1.0f) + (A + 1.0f) * cosw0);
+    b2 =          A * ((A + 1.0f) + (A - 1.0f) * cosw0 - 2.0f * sqrtA * alpha);
+    a0 =               (A + 1.0f) - (A - 1.0f) * cosw0 + 2.0f * sqrtA * alpha;
+    a1 =   2.0f     * ((A - 1.0f) - (A + 1.0f) * cosw0);
+    a2 =               (A + 1.0f) - (A - 1.0f) * cosw0 - 2.0f * sqrtA * alpha;
     float inv_a0 = 1.0f / a0; a1 *= inv_a0; a2 *= inv_a0; b0 *= inv_a0; b1 *= inv_a0; b2 *= inv_a0;
 }
 
 void BiquadFilter::SetupLowpass(float cutoff, float samplerate, float Q)
 {
-    float w0 = 2.0f * kPI * cutoff / samplerate, alpha = sinf(w0) / (2.0f * Q), a0;
-    b0 =  (1.0f - cosf(w0)) * 0.5f;
-    b1 =   1.0f - cosf(w0);
-    b2 =  (1.0f - cosf(w0)) * 0.5f;
+    float w0 = 2.0f * kPI * cutoff / samplerate, cosw0 = cosf(w0), alpha = sinf(w0) / (2.0f * Q), a0;
+    b0 =  (1.0f - cosw0) * 0.5f;
+    b1 =   1.0f - cosw0;
+    b2 =  (1.0f - cosw0) * 0.5f;
     a0 =   1.0f + alpha;
-    a1 =  -2.0f * cosf(w0);
+    a1 =  -2.0f * cosw0;
     a2 =   1.0f - alpha;
     float inv_a0 = 1.0f / a0; a1 *= inv_a0; a2 *= inv_a0; b0 *= inv_a0; b1 *= inv_a0; b2 *= inv_a0;
 }
 
 void BiquadFilter::SetupHighpass(float cutoff, float samplerate, float Q)
 {
-    float w0 = 2.0f * kPI * cutoff / samplerate, alpha = sinf(w0) / (2.0f * Q), a0;
-    b0 =  (1.0f + cosf(w0)) * 0.5f;
-    b1 = -(1.0f + cosf(w0));
-    b2 =  (1.0f + cosf(w0)) * 0.5f;
+    float w0 = 2.0f * kPI * cutoff / samplerate, cosw0 = cosf(w0), alpha = sinf(w0) / (2.0f * Q), a0;
+    b0 =  (1.0f + cosw0) * 0.5f;
+    b1 = -(1.0f + cosw0);
+    b2 =  (1.0f + cosw0) * 0.5f;
     a0 =   1.0f + alpha;
-    a1 =  -2.0f * cosf(w0);
+    a1 =  -2.0f * cosw0;
     a2 =   1.0f - alpha;
     float inv_a0 = 1.0f / a0; a1 *= inv_a0; a2 *= inv_a0; b0 *= inv_a0; b1 *= inv_a0; b2 *= inv_a0;
 }
 
+// The two stages of the ITU-R BS.1770 K-weighting filter. The shelf isn't an RBJ shelf, so these use the prewarped designs
+// that reproduce the coefficients tabulated in the standard at 48 kHz and carry over to other sample rates.
+
+void BiquadFilter::SetupKWeightingShelf(float samplerate)
+{
+    const double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+    double K = tan(kPI_double * f0 / samplerate), Vh = pow(10.0, G / 20.0), Vb = pow(Vh, 0.4996667741545416);
+    double inv_a0 = 1.0 / (1.0 + K / Q + K * K);
+    b0 = (float)((Vh + Vb * K / Q + K * K) * inv_a0);
+    b1 = (float)(2.0 * (K * K - Vh) * inv_a0);
+    b2 = (float)((Vh - Vb * K / Q + K * K) * inv_a0);
+    a1 = (float)(2.0 * (K * K - 1.0) * inv_a0);
+    a2 = (float)((1.0 - K / Q + K * K) * inv_a0);
+}
+
+void BiquadFilter::SetupKWeightingHighpass(float samplerate)
+{
+    const double f0 = 38.13547087602444, Q = 0.5003270373238773;
+    double K = tan(kPI_double * f0 / samplerate);
+    double inv_a0 = 1.0 / (1.0 + K / Q + K * K);
+    b0 = 1.0f;
+    b1 = -2.0f;
+    b2 = 1.0f;
+    a1 = (float)(2.0 * (K * K - 1.0) * inv_a0);
+    a2 = (float)((1.0 - K / Q + K * K) * inv_a0);
+}
+
+// Up to 16 biquads in transposed direct form II. Coefficients and state are stored lane by lane, so one SIMD instruction
+// advances four filters. Unused lanes up to the next multiple of four are pass-through.
+class BiquadBank
+{
+public:
+    enum { MAXFILTERS = 16 };
+
+public:
+    void Init(int numfilters); // All filters start out as pass-through with cleared state
+    void Reset();
+    void SetCoeffs(int index, float b0, float b1, float b2, float a1, float a2);
+    void SetFilter(int index, const BiquadFilter& filter);
+    inline int GetNumFilters() const { return numfilters; }
+
+    // Filter n processes channel n of an interleaved buffer, numchannels <= number of filters
+    void ProcessParallel(const float* input, float* output, int numsamples, int numchannels);
+
+    // Every filter processes the same mono input, output is interleaved with one channel per filter
+    void ProcessSplit(const float* input, float* output, int numsamples);
+
+    // Mono input runs through all filters in series. Works in place.
+    void ProcessCascade(const float* input, float* output, int numsamples);
+
+protected:
+    inline float Tick(int k, float x)
+    {
+        float y = b0[k] * x + s1[k];
+        s1[k] = b1[k] * x - a1[k] * y + s2[k];
+        s2[k] = b2[k] * x - a2[k] * y;
+        return y;
+    }
+
+    void CascadeGroup(int base, const float* input, float* output, int numsamples);
+
+protected:
+    int numfilters;
+    int numlanes;
+    float b0[MAXFILTERS], b1[MAXFILTERS], b2[MAXFILTERS], a1[MAXFILTERS], a2[MAXFILTERS];
+    float s1[MAXFILTERS], s2[MAXFILTERS];
+};
+
 class StateVariableFilter
 {
 public:
@@ -338,8 +754,6 @@ public:
 public:
     inline float ProcessHPF(float input)
     {
-        input += 1.0e-11f; // Kill denormals
-
         lpf += cutoff * bpf;
         float hpf = (input - bpf) * bandwidth - lpf;
         bpf += cutoff * hpf;
@@ -363,10 +777,208 @@ public:
         return lpf;
     }
 
+    // One update giving all three responses, for when more than one of them is needed
+    inline void Process(float input, float& lpout, float& bpout, float& hpout)
+    {
+        hpout = ProcessHPF(input);
+        bpout = bpf;
+        lpout = lpf;
+    }
+
+    // Block versions of the above with the state kept in locals. Any of the outputs may be NULL, and any of them may
+    // alias the input. All buffers are read and written with the same stride.
+    inline void ProcessBlock(const float* input, float* lpout, float* bpout, float* hpout, int numsamples, int stride = 1)
+    {
+        const float c = cutoff, bw = bandwidth;
+        float l = lpf, b = bpf;
+        for (int n = 0; n < numsamples; n++)
+        {
+            float x = input[n * stride];
+
+            l += c * b;
+            float h = (x - b) * bw - l;
+            b += c * h;
+
+            l += c * b;
+            h = (x - b) * bw - l;
+            b += c * h;
+
+            if (lpout != NULL)
+                lpout[n * stride] = l;
+            if (bpout != NULL)
+                bpout[n * stride] = b;
+            if (hpout != NULL)
+                hpout[n * stride] = h;
+        }
+        lpf = l;
+        bpf = b;
+    }
+
+    inline void ProcessBlockLPF(const float* input, float* output, int numsamples, int stride = 1) { ProcessBlock(input, output, NULL, NULL, numsamples, stride); }
+    inline void ProcessBlockBPF(const float* input, float* output, int numsamples, int stride = 1) { ProcessBlock(input, NULL, output, NULL, numsamples, stride); }
+    inline void ProcessBlockHPF(const float* input, float* output, int numsamples, int stride = 1) { ProcessBlock(input, NULL, NULL, output, numsamples, stride); }
+
 public:
     float lpf, bpf;
 };
 
+// State variable filter in the trapezoidal (zero-delay feedback) form, which stays well behaved when the cutoff and Q
+// change every sample. SetTargetScaled costs a polynomial sine/cosine and one division, plus another one when Q changes;
+// for audio-rate modulation ProcessBlockModulated is over twice as fast (around 10 ns/sample), as it computes the coefficients
+// for a chunk of samples in a vectorizable loop. ProcessBlock instead moves the cutoff and damping linearly from their
+// current values to the target across the block.
+// At fixed settings the lowpass and highpass responses are identical to BiquadFilter::SetupLowpass/SetupHighpass.
+class TrapezoidalSVF
+{
+public:
+    enum Mode
+    {
+        Mode_Lowpass,
+        Mode_Bandpass,  // Unity gain at the cutoff
+        Mode_Highpass,
+        Mode_Notch
+    };
+
+public:
+    inline void Init(Mode mode, float cutoff, float samplerate, float Q)
+    {
+        SetMode(mode);
+        ic1 = ic2 = 0.0f;
+        targetQ = -1.0f;
+        SetTarget(cutoff, samplerate, Q);
+        a1 = targeta1; a2 = targeta2; a3 = targeta3; k = targetk;
+    }
+
+    inline void Reset()
+    {
+        ic1 = ic2 = 0.0f;
+    }
+
+    // The output is mixed from the input and the band and low outputs: y = mx * x + mb * k * band + ml * low
+    inline void SetMode(Mode mode)
+    {
+        static const float mix[4][3] = { { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, 0.0f } };
+        mx = mix[mode][0];
+        mb = mix[mode][1];
+        ml = mix[mode][2];
+    }
+
+    inline void SetTarget(float cutoff, float samplerate, float Q)
+    {
+        SetTargetScaled(cutoff, GetCutoffScale(samplerate), Q);
+    }
+
+    static inline float GetCutoffScale(float samplerate) { return kPI / samplerate; }
+
+    // Per-sample version of SetTarget taking scale = GetCutoffScale(samplerate).
+    // With g = tan(w0 / 2) = s / c, a1 = 1 / (1 + g (g + k)) simplifies to c^2 / (1 + k s c)
+    inline void SetTargetScaled(float cutoff, float scale, float Q)
+    {
+        float s, c;
+        FastSinCos(FastClip(cutoff * scale, 1.0e-5f * kPI, 0.49f * kPI), s, c);
+        if (Q != targetQ)
+        {
+            targetQ = Q;
+            targetk = 1.0f / Q;
+        }
+        float d = 1.0f / (1.0f + targetk * s * c);
+        targeta1 = c * c * d;
+        targeta2 = s * c * d;
+        targeta3 = s * s * d;
+    }
+
+    // Jumps straight to the last target, for when SetTarget is called every sample
+    inline float Process(float input)
+    {
+        a1 = targeta1; a2 = targeta2; a3 = targeta3; k = targetk;
+        return Tick(input);
+    }
+
+    // Input and output may alias
+    inline void ProcessBlock(const float* input, float* output, int numsamples, int stride = 1)
+    {
+        if (numsamples <= 0)
+            return;
+        const float invn = 1.0f / numsamples;
+        float g = a2 / a1;
+        const float dg = (targeta2 / targeta1 - g) * invn, dk = (targetk - k) * invn;
+        for (int n = 0; n < numsamples; n++)
+        {
+            g += dg;
+            k += dk;
+            a1 = 1.0f / (1.0f + g * (g + k));
+            a2 = g * a1;
+            a3 = g * a2;
+            output[n * stride] = Tick(input[n * stride]);
+        }
+        a1 = targeta1; a2 = targeta2; a3 = targeta3; k = targetk;
+    }
+
+    // Audio-rate modulation with one cutoff per sample. The coefficients are computed for a chunk of samples at a time
+    // in a loop the compiler can vectorize, ahead of the filter loop itself. Input and output may alias.
+    inline void ProcessBlockModulated(const float* input, const float* cutoff, float* output, int numsamples, float samplerate, float Q)
+    {
+        ProcessModulated<0>(input, cutoff, &Q, output, numsamples, samplerate);
+    }
+
+    // Same with one Q per sample as well
+    inline void ProcessBlockModulated(const float* input, const float* cutoff, const float* Q, float* output, int numsamples, float samplerate)
+    {
+        ProcessModulated<1>(input, cutoff, Q, output, numsamples, samplerate);
+    }
+
+protected:
+    template<int QSTRIDE>
+    inline void ProcessModulated(const float* input, const float* cutoff, const float* Q, float* output, int numsamples, float samplerate)
+    {
+        enum { CHUNKSIZE = 64 };
+        float coeffs1[CHUNKSIZE], coeffs2[CHUNKSIZE], coeffs3[CHUNKSIZE], damping[CHUNKSIZE];
+        const float scale = GetCutoffScale(samplerate);
+        for (int start = 0; start < numsamples; start += CHUNKSIZE)
+        {
+            const int num = (numsamples - start < CHUNKSIZE) ? (numsamples - start) : CHUNKSIZE;
+            for (int n = 0; n < num; n++)
+            {
+                float s, c;
+                FastSinCos(FastClip(cutoff[start + n] * scale, 1.0e-5f * kPI, 0.49f * kPI), s, c);
+                damping[n] = 1.0f / Q[(start + n) * QSTRIDE];
+                float d = 1.0f / (1.0f + damping[n] * s * c);
+                coeffs1[n] = c * c * d;
+                coeffs2[n] = s * c * d;
+                coeffs3[n] = s * s * d;
+            }
+            for (int n = 0; n < num; n++)
+            {
+                a1 = coeffs1[n];
+                a2 = coeffs2[n];
+                a3 = coeffs3[n];
+                k = damping[n];
+                output[start + n] = Tick(input[start + n]);
+            }
+        }
+        targeta1 = a1; targeta2 = a2; targeta3 = a3; targetk = k;
+        if (numsamples > 0)
+            targetQ = Q[(numsamples - 1) * QSTRIDE];
+    }
+
+    inline float Tick(float x)
+    {
+        float v3 = x - ic2;
+        float v1 = a1 * ic1 + a2 * v3;
+        float v2 = ic2 + a2 * ic1 + a3 * v3;
+        ic1 = 2.0f * v1 - ic1;
+        ic2 = 2.0f * v2 - ic2;
+        return mx * x + mb * k * v1 + ml * v2;
+    }
+
+protected:
+    float mx, mb, ml;
+    float a1, a2, a3, k;    // k is the damping 1/Q
+    float targeta1, targeta2, targeta3, targetk;
+    float targetQ;          // Q that targetk was computed from, so SetTargetScaled can skip the division when it doesn't change
+    float ic1, ic2;         // Integrator states
+};
+
 class Random
 {
 public:
@@ -442,6 +1054,164 @@ public:
     int samplesleft;
 };
 
+// Four xoshiro128+ generators side by side, stored lane by lane. Every step applies the same operations to all lanes,
+// which the compiler turns into SIMD instructions, and yields four outputs.
+class VectorRandom
+{
+public:
+    enum { NUMLANES = 4 };
+
+public:
+    inline void Seed(UInt32 seed)
+    {
+        // Lanes get consecutive splitmix32 outputs, which never leaves a lane with an all-zero state
+        UInt32 z = seed;
+        UInt32* state[4] = { s0, s1, s2, s3 };
+        for (int l = 0; l < NUMLANES; l++)
+        {
+            for (int w = 0; w < 4; w++)
+            {
+                z += 0x9E3779B9;
+                UInt32 x = z;
+                x = (x ^ (x >> 16)) * 0x85EBCA6B;
+                x = (x ^ (x >> 13)) * 0xC2B2AE35;
+                state[w][l] = x ^ (x >> 16);
+            }
+        }
+    }
+
+    // Uniformly distributed in [-1, 1). Lanes left over from a length that isn't a multiple of four are dropped.
+    inline void FillFloats(float* output, int numsamples)
+    {
+        int n = 0;
+        for (; n + NUMLANES <= numsamples; n += NUMLANES)
+            Step(output + n);
+        if (n < numsamples)
+        {
+            float rest[NUMLANES];
+            Step(rest);
+            for (int l = 0; l < numsamples - n; l++)
+                output[n + l] = rest[l];
+        }
+    }
+
+protected:
+    inline void Step(float* output)
+    {
+        for (int l = 0; l < NUMLANES; l++)
+        {
+            UInt32 result = s0[l] + s3[l], t = s1[l] << 9;
+            s2[l] ^= s0[l];
+            s3[l] ^= s1[l];
+            s1[l] ^= s2[l];
+            s0[l] ^= s3[l];
+            s2[l] ^= t;
+            s3[l] = (s3[l] << 11) | (s3[l] >> 21);
+
+            // Top 23 bits as the mantissa of a float in [1, 2)
+            union { UInt32 i; float f; } u;
+            u.i = (result >> 9) | 0x3F800000;
+            output[l] = u.f * 2.0f - 3.0f;
+        }
+    }
+
+protected:
+    UInt32 s0[NUMLANES], s1[NUMLANES], s2[NUMLANES], s3[NUMLANES];
+};
+
+// White, pink or brown noise a block at a time. Pink noise uses Paul Kellet's refined filter (within 0.05 dB of
+// -3 dB/octave above 9 Hz at 44.1 kHz), brown noise a leaky integrator. All three have roughly the same loudness.
+class NoiseSource
+{
+public:
+    enum Color
+    {
+        Color_White,
+        Color_Pink,
+        Color_Brown
+    };
+
+public:
+    inline void Init(UInt32 seed)
+    {
+        random.Seed(seed);
+        memset(pink, 0, sizeof(pink));
+        brown = 0.0f;
+    }
+
+    inline void Process(float* output, int numsamples, Color color)
+    {
+        random.FillFloats(output, numsamples);
+        if (color == Color_Pink)
+        {
+            float b0 = pink[0], b1 = pink[1], b2 = pink[2], b3 = pink[3], b4 = pink[4], b5 = pink[5], b6 = pink[6];
+            for (int n = 0; n < numsamples; n++)
+            {
+                float w = output[n];
+                b0 = 0.99886f * b0 + w * 0.0555179f;
+                b1 = 0.99332f * b1 + w * 0.0750759f;
+                b2 = 0.96900f * b2 + w * 0.1538520f;
+                b3 = 0.86650f * b3 + w * 0.3104856f;
+                b4 = 0.55000f * b4 + w * 0.5329522f;
+                b5 = -0.7616f * b5 - w * 0.0168980f;
+                output[n] = (b0 + b1 + b2 + b3 + b4 + b5 + b6 + w * 0.5362f) * 0.11f;
+                b6 = w * 0.115926f;
+            }
+            pink[0] = b0; pink[1] = b1; pink[2] = b2; pink[3] = b3; pink[4] = b4; pink[5] = b5; pink[6] = b6;
+        }
+        else if (color == Color_Brown)
+        {
+            float b = brown;
+            for (int n = 0; n < numsamples; n++)
+            {
+                b = (b + 0.02f * output[n]) * (1.0f / 1.02f);
+                output[n] = b * 3.5f;
+            }
+            brown = b;
+        }
+    }
+
+protected:
+    VectorRandom random;
+    float pink[7];
+    float brown;
+};
+
+// Cache-line aligned bump allocator over a single block of memory, so that all state of a plugin instance is allocated
+// at once in CreateCallback, lies close together and is freed at once in ReleaseCallback. The block comes straight from
+// the OS with its pages committed up front, on huge pages when it's large enough and the system has them to spare.
+class Arena
+{
+public:
+    enum { ALIGNMENT = 64 };
+
+    // Space an allocation of the given size takes up, for adding up the size an arena needs
+    static inline size_t Footprint(size_t size) { return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1); }
+
+    static Arena* Create(size_t size); // NULL if the memory isn't available
+    static void Destroy(Arena* arena); // Doesn't run destructors of the objects in it
+
+public:
+    void* Allocate(size_t size); // Zero-filled, NULL once the arena is exhausted
+
+    template<typename T> inline T* New()
+    {
+        void* p = Allocate(sizeof(T));
+        return (p != NULL) ? new(p) T() : NULL;
+    }
+
+    inline size_t GetSize() const { return size; }
+    inline size_t GetUsed() const { return used; }
+    inline bool UsesHugePages() const { return hugepages; }
+
+protected:
+    char* base;
+    size_t size;
+    size_t used;
+    size_t mappedsize;
+    bool hugepages;
+};
+
 class Mutex
 {
 public:
@@ -468,6 +1238,218 @@ protected:
     Mutex* mutex;
 };
 
+// Real-time safe building blocks for sharing state with the audio thread. None of the calls meant for the audio thread
+// block, allocate or make system calls.
+
+// A float parameter that one thread sets and others read, without tearing and without a lock
+class AtomicFloat
+{
+public:
+    AtomicFloat(float initialvalue = 0.0f) : value(initialvalue) {}
+
+    inline float Load() const { return value.load(std::memory_order_relaxed); }
+    inline void Store(float newvalue) { value.store(newvalue, std::memory_order_relaxed); }
+
+protected:
+    static_assert(std::atomic<float>::is_always_lock_free, "AtomicFloat needs lock-free atomic floats");
+    std::atomic<float> value;
+};
+
+// Hands values from one writer to one reader through three slots. The writer always has a slot of its own to fill and
+// the reader always has a consistent latest value to look at, so neither ever waits or retries. Unlike SnapshotBuffer
+// this works for any copyable type and lets the reader hold on to the value for as long as it likes.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : back(0), front(2), middle(1) {}
+
+    // Writer: fill in the returned slot, then publish it. The slot doesn't contain the last published value.
+    inline T& BeginWrite() { return slots[back]; }
+    inline void EndWrite() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEXMASK; }
+
+    inline void Write(const T& value)
+    {
+        BeginWrite() = value;
+        EndWrite();
+    }
+
+    // Reader: returns true and updates value if something was published since the last call
+    inline bool Read(const T*& value)
+    {
+        bool fresh = (middle.load(std::memory_order_relaxed) & FRESH) != 0;
+        if (fresh)
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEXMASK;
+        value = &slots[front];
+        return fresh;
+    }
+
+protected:
+    enum { INDEXMASK = 3, FRESH = 4 };
+    T slots[3];
+    int back;                   // Owned by the writer
+    int front;                  // Owned by the reader
+    std::atomic<int> middle;    // Index of the latest published slot, plus FRESH until the reader has taken it
+};
+
+// A lock the audio thread can try to take without ever blocking. Other threads may wait for it with Lock().
+class SpinLock
+{
+public:
+    SpinLock() { flag.clear(); }
+
+    inline bool TryLock() { return !flag.test_and_set(std::memory_order_acquire); }
+    inline void Unlock() { flag.clear(std::memory_order_release); }
+
+    // Not for the audio thread
+    inline void Lock()
+    {
+        while (!TryLock())
+            std::this_thread::yield();
+    }
+
+protected:
+    std::atomic_flag flag;
+};
+
+// Works with SpinLock and Mutex. The audio thread checks IsLocked() and skips the shared work if another thread has it.
+template<typename LockType>
+class TryScopeLock
+{
+public:
+    TryScopeLock(LockType& _lock) : lock(_lock.TryLock() ? &_lock : NULL) {}
+    ~TryScopeLock() { if (lock != NULL) lock->Unlock(); }
+
+    inline bool IsLocked() const { return lock != NULL; }
+
+protected:
+    LockType* lock;
+};
+
+// Objects the audio thread is done with are retired here and deleted later by a background thread calling Collect().
+// One thread may retire and one may collect at a time.
+template<int _CAPACITY>
+class DeferredFreeQueue
+{
+public:
+    enum { CAPACITY = _CAPACITY };
+
+    DeferredFreeQueue() : readpos(0), writepos(0) {}
+    ~DeferredFreeQueue() { Collect(); }
+
+    inline bool IsFull() const
+    {
+        return Next(writepos.load(std::memory_order_relaxed)) == readpos.load(std::memory_order_acquire);
+    }
+
+    // Returns false if the queue is full, in which case the caller still owns the object
+    template<typename T> inline bool Retire(T* object)
+    {
+        if (object == NULL)
+            return true;
+        int w = writepos.load(std::memory_order_relaxed);
+        if (Next(w) == readpos.load(std::memory_order_acquire))
+            return false;
+        entries[w].object = object;
+        entries[w].deleter = &DeleteObject<T>;
+        writepos.store(Next(w), std::memory_order_release);
+        return true;
+    }
+
+    // Deletes everything retired so far and returns how many objects that was
+    inline int Collect()
+    {
+        int r = readpos.load(std::memory_order_relaxed), w = writepos.load(std::memory_order_acquire), count = 0;
+        while (r != w)
+        {
+            entries[r].deleter(entries[r].object);
+            r = Next(r);
+            count++;
+        }
+        readpos.store(r, std::memory_order_release);
+        return count;
+    }
+
+protected:
+    template<typename T> static void DeleteObject(void* object) { delete (T*)object; }
+    static inline int Next(int pos) { return (pos == CAPACITY) ? 0 : (pos + 1); }
+
+    struct Entry
+    {
+        void* object;
+        void (*deleter)(void* object);
+    };
+
+    Entry entries[CAPACITY + 1];
+    std::atomic<int> readpos;
+    std::atomic<int> writepos;
+};
+
+// Streams samples from the audio thread to a background thread, e.g. for recording. The producer writes whole blocks or
+// nothing, so a full ring drops blocks rather than tearing them; the consumer reads in place. The storage is owned by the
+// caller and the capacity must be a power of two. One thread may write and one may read at a time.
+class StreamRing
+{
+public:
+    inline void Init(float* _storage, int _capacity)
+    {
+        assert((_capacity & (_capacity - 1)) == 0);
+        storage = _storage;
+        capacity = _capacity;
+        writecount.store(0, std::memory_order_relaxed);
+        readcount.store(0, std::memory_order_relaxed);
+        highwater.store(0, std::memory_order_relaxed);
+        numdropped.store(0, std::memory_order_relaxed);
+    }
+
+    // Returns false and counts a dropped block if there isn't room for all of it
+    inline bool Write(const float* data, int num)
+    {
+        UInt64 w = writecount.load(std::memory_order_relaxed);
+        UInt64 used = w - readcount.load(std::memory_order_acquire);
+        if (used + num > (UInt64)capacity)
+        {
+            numdropped.store(numdropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        int pos = (int)(w & (capacity - 1));
+        int first = (num < capacity - pos) ? num : (capacity - pos);
+        memcpy(storage + pos, data, sizeof(float) * first);
+        memcpy(storage, data + first, sizeof(float) * (num - first));
+        writecount.store(w + num, std::memory_order_release);
+        if (used + num > highwater.load(std::memory_order_relaxed))
+            highwater.store(used + num, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Longest run of unread samples that is contiguous in memory; the rest follows from the start of the storage
+    inline int GetReadable(const float*& data) const
+    {
+        UInt64 r = readcount.load(std::memory_order_relaxed);
+        UInt64 available = writecount.load(std::memory_order_acquire) - r;
+        int pos = (int)(r & (capacity - 1));
+        data = storage + pos;
+        return (available < (UInt64)(capacity - pos)) ? (int)available : (capacity - pos);
+    }
+
+    inline void Consume(int num)
+    {
+        readcount.store(readcount.load(std::memory_order_relaxed) + num, std::memory_order_release);
+    }
+
+    inline int GetCapacity() const { return capacity; }
+    inline int GetHighWater() const { return (int)highwater.load(std::memory_order_relaxed); }
+    inline int GetNumDropped() const { return (int)numdropped.load(std::memory_order_relaxed); }
+
+protected:
+    float* storage;
+    int capacity;
+    alignas(64) std::atomic<UInt64> writecount;    // Producer side
+    std::atomic<UInt64> highwater;
+    std::atomic<UInt64> numdropped;
+    alignas(64) std::atomic<UInt64> readcount;     // Consumer side
+};
+
 void RegisterParameter(
     UnityAudioEffectDefinition& desc,
     const char* name,
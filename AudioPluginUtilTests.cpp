@@ -0,0 +1,2149 @@
+// Test and benchmark runner for AudioPluginUtil. Built separately from the plugin (see build.sh -t) so none of this
+// ends up in the plugin's load path.
+//
+//   tests.out          Runs all unit tests
+//   tests.out -b       Also runs the benchmarks
+//   tests.out <filter> Only runs tests and benchmarks whose suite or name contains <filter>
+
+#include "AudioPluginUtil.h"
+#include "synth_common.h"
+#include "midi_file.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+extern "C" bool NoteOn(int midiNum, int ticksUntilEvent);
+extern "C" bool NoteOff(int midiNum, int ticksUntilEvent);
+extern "C" int GetSynthTicks();
+extern "C" void UnitySynth_AddMessage(UInt64 sample, int msg);
+
+// UnitySynth isn't in PluginList.h on every platform, so its callbacks are declared here
+namespace UnitySynth
+{
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples);
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition);
+}
+
+extern "C" bool ConvolutionReverb_LoadImpulseResponse(const char* path);
+extern "C" bool LoadModMatrix(int const* sources, int const* ccs, int const* dests, float const* depths, int numRoutes);
+
+namespace
+{
+    typedef void (*TestFunc)(const char* testname);
+
+    struct TestCase
+    {
+        const char* suite;
+        const char* name;
+        TestFunc func;
+    };
+
+    std::vector<TestCase>& GetTests()
+    {
+        static std::vector<TestCase> tests;
+        return tests;
+    }
+
+    std::vector<TestCase>& GetBenchmarks()
+    {
+        static std::vector<TestCase> benchmarks;
+        return benchmarks;
+    }
+
+    struct TestRegistration
+    {
+        TestRegistration(std::vector<TestCase>& list, const char* suite, const char* name, TestFunc func)
+        {
+            TestCase t = { suite, name, func };
+            list.push_back(t);
+        }
+    };
+
+    int gNumFailures = 0;
+
+    // Calls func repeatedly for at least 20 ms and returns the average time per call in seconds
+    template<typename Func> double TimePerCall(Func func)
+    {
+        typedef std::chrono::steady_clock Clock;
+        func(); // Warm up caches and plans
+        int numcalls = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed = 0.0;
+        do
+        {
+            for (int n = 0; n < 8; n++)
+                func();
+            numcalls += 8;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        while (elapsed < 0.02);
+        return elapsed / (double)numcalls;
+    }
+
+    // Keeps benchmark results alive so the optimizer can't drop the work
+    volatile float gSink;
+
+    UnityAudioEffectDefinition* FindEffect(const char* name)
+    {
+        UnityAudioEffectDefinition** definitions;
+        int numeffects = UnityGetAudioEffectDefinitions(&definitions);
+        for (int n = 0; n < numeffects; n++)
+            if (strcmp(definitions[n]->name, name) == 0)
+                return definitions[n];
+        return NULL;
+    }
+
+    // Hosts one instance of an effect the way Unity does, for tests that go through the plugin callbacks
+    class TestEffect
+    {
+    public:
+        TestEffect(UnityAudioEffectDefinition* _definition, int samplerate, int _blocksize)
+            : definition(_definition)
+            , blocksize(_blocksize)
+            , dsptick(0)
+        {
+            memset(&state, 0, sizeof(state));
+            state.structsize = sizeof(state);
+            state.samplerate = samplerate;
+            state.flags = UnityAudioEffectStateFlags_IsPlaying;
+            state.dspbuffersize = blocksize;
+            state.hostapiversion = UNITY_AUDIO_PLUGIN_API_VERSION;
+            state.internal = &state;
+            valid = definition != NULL && definition->create(&state) == UNITY_AUDIODSP_OK;
+        }
+
+        ~TestEffect()
+        {
+            if (valid)
+                definition->release(&state);
+        }
+
+        inline bool IsValid() const { return valid; }
+        inline void SetParameter(int index, float value) { definition->setfloatparameter(&state, index, value); }
+        inline void GetBuffer(const char* name, float* buffer, int numsamples) { definition->getfloatbuffer(&state, name, buffer, numsamples); }
+
+        // Feeds interleaved input through the effect one host buffer at a time, advancing the DSP clock like Unity does
+        void Process(const float* input, float* output, int numframes, int numchannels)
+        {
+            for (int n = 0; n < numframes; n += blocksize)
+            {
+                int length = (numframes - n < blocksize) ? (numframes - n) : blocksize;
+                state.currdsptick = dsptick;
+                definition->process(&state, (float*)input + n * numchannels, output + n * numchannels, length, numchannels, numchannels);
+                state.prevdsptick = state.currdsptick;
+                dsptick += length;
+            }
+        }
+
+        UnityAudioEffectState state;
+
+    protected:
+        UnityAudioEffectDefinition* definition;
+        int blocksize;
+        UInt64 dsptick;
+        bool valid;
+    };
+}
+
+#define NAP_TESTSUITE(name) \
+    namespace testsuite_##name { inline const char* GetSuiteName() { return #name; } }\
+    namespace testsuite_##name
+#define NAP_UNITTEST(name) \
+    static void test_##name(const char* testname);\
+    static TestRegistration registration_##name(GetTests(), GetSuiteName(), #name, test_##name);\
+    static void test_##name(const char* testname)
+#define NAP_BENCHMARK(name) \
+    static void bench_##name(const char* testname);\
+    static TestRegistration benchregistration_##name(GetBenchmarks(), GetSuiteName(), #name, bench_##name);\
+    static void bench_##name(const char* testname)
+#define NAP_CHECK(...) \
+    do\
+    {\
+        if(!(__VA_ARGS__))\
+        {\
+            printf("%s(%d): Unit test '%s' failed for expression '%s'.\n", __FILE__, __LINE__, testname, #__VA_ARGS__);\
+            gNumFailures++;\
+        }\
+    } while(false)
+
+NAP_TESTSUITE(FFT)
+{
+    NAP_UNITTEST(Accuracy)
+    {
+        for (int test = 0; test < 2; test++)
+        {
+            bool highprecision = (test == 1);
+
+            AudioPluginUtil::Random r;
+
+            r.Seed(1);
+            for (int b = 4; b <= 20; b++)
+            {
+                int num = 1 << b;
+
+                AudioPluginUtil::UnityComplexNumber* test1 = new AudioPluginUtil::UnityComplexNumber[num];
+                AudioPluginUtil::UnityComplexNumber* test2 = new AudioPluginUtil::UnityComplexNumber[num];
+
+                for (int n = 0; n < num; n++)
+                {
+                    test1[n].re = r.GetFloat(-1.0f, 1.0f);
+                    test1[n].im = r.GetFloat(-1.0f, 1.0f);
+                    test2[n].re = test1[n].re;
+                    test2[n].im = test1[n].im;
+                }
+
+                AudioPluginUtil::FFT::Prepare(num);
+                NAP_CHECK(AudioPluginUtil::FFT::Forward(test2, num, highprecision));
+                NAP_CHECK(AudioPluginUtil::FFT::Backward(test2, num, highprecision));
+
+                double errtol = 1.0e-6; // The float path uses exact twiddles and is held to the same bound as the double path
+                double maxerr = 0.0f, errsum = 0.0, rms = 0.0;
+                for (int n = 0; n < num; n++)
+                {
+                    float err, diff;
+                    diff = test1[n].re - test2[n].re; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
+                        maxerr = err;
+                    rms += diff * diff;
+                    diff = test1[n].im - test2[n].im; err = fabsf(diff); NAP_CHECK(err < errtol); errsum += err; if (err > maxerr)
+                        maxerr = err;
+                    rms += diff * diff;
+                }
+
+                double avgerr = errsum / (double)num;
+                rms = sqrt(rms / (double)num);
+
+                delete[] test1;
+                delete[] test2;
+
+                printf("%2d bits: MaxErr=%15.8g ErrSum=%15.8g AvgErr=%15.8g ErrRMS=%15.8g [%s precision]\n", b, maxerr, errsum, avgerr, rms, highprecision ? "high" : "low");
+                NAP_CHECK(avgerr < errtol);
+                NAP_CHECK(rms < errtol);
+            }
+        }
+    }
+
+    NAP_UNITTEST(RealAccuracy)
+    {
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int b = 1; b <= 16; b++)
+        {
+            int num = 1 << b;
+
+            float* input = new float[num];
+            float* output = new float[num];
+            AudioPluginUtil::UnityComplexNumber* reference = new AudioPluginUtil::UnityComplexNumber[num];
+            AudioPluginUtil::UnityComplexNumber* spectrum = new AudioPluginUtil::UnityComplexNumber[num / 2 + 1];
+
+            for (int n = 0; n < num; n++)
+            {
+                input[n] = r.GetFloat(-1.0f, 1.0f);
+                reference[n].Set(input[n], 0.0f);
+            }
+
+            AudioPluginUtil::FFT::Prepare(num);
+            AudioPluginUtil::FFT::PrepareReal(num);
+            AudioPluginUtil::FFT::Forward(reference, num, true);
+            AudioPluginUtil::FFT::ForwardReal(input, spectrum, num);
+
+            // Bin magnitudes grow with sqrt(num), so compare relative to that
+            double spectol = 1.0e-6 * sqrt((double)num);
+            for (int n = 0; n <= num / 2; n++)
+            {
+                NAP_CHECK(fabsf(reference[n].re - spectrum[n].re) < spectol);
+                NAP_CHECK(fabsf(reference[n].im - spectrum[n].im) < spectol);
+            }
+
+            AudioPluginUtil::FFT::BackwardReal(spectrum, output, num);
+
+            double maxerr = 0.0;
+            for (int n = 0; n < num; n++)
+            {
+                float err = fabsf(input[n] - output[n]);
+                NAP_CHECK(err < 1.0e-6);
+                if (err > maxerr)
+                    maxerr = err;
+            }
+
+            delete[] input;
+            delete[] output;
+            delete[] reference;
+            delete[] spectrum;
+
+            printf("%2d bits: MaxErr=%15.8g [real]\n", b, maxerr);
+        }
+    }
+
+    NAP_BENCHMARK(Complex)
+    {
+        for (int precision = 0; precision < 2; precision++)
+        {
+            for (int b = 6; b <= 16; b += 2)
+            {
+                int num = 1 << b;
+                AudioPluginUtil::UnityComplexNumber* data = new AudioPluginUtil::UnityComplexNumber[num];
+                memset(data, 0, sizeof(AudioPluginUtil::UnityComplexNumber) * num);
+                AudioPluginUtil::FFT::Prepare(num);
+                double t = TimePerCall([&]() { AudioPluginUtil::FFT::Forward(data, num, precision == 1); });
+                printf("  %6d points %s: %10.2f us  %6.3f ns/(N log2 N)\n", num, precision ? "double" : "float ", t * 1.0e6, t * 1.0e9 / ((double)num * b));
+                delete[] data;
+            }
+        }
+    }
+
+    NAP_BENCHMARK(Real)
+    {
+        for (int b = 6; b <= 16; b += 2)
+        {
+            int num = 1 << b;
+            float* input = new float[num];
+            AudioPluginUtil::UnityComplexNumber* spectrum = new AudioPluginUtil::UnityComplexNumber[num / 2 + 1];
+            memset(input, 0, sizeof(float) * num);
+            AudioPluginUtil::FFT::PrepareReal(num);
+            double t = TimePerCall([&]() { AudioPluginUtil::FFT::ForwardReal(input, spectrum, num); });
+            printf("  %6d points: %10.2f us  %6.3f ns/(N log2 N)\n", num, t * 1.0e6, t * 1.0e9 / ((double)num * b));
+            delete[] input;
+            delete[] spectrum;
+        }
+    }
+}
+
+NAP_TESTSUITE(SnapshotBuffer)
+{
+    NAP_UNITTEST(LatestFrame)
+    {
+        AudioPluginUtil::SnapshotBuffer snapshot;
+        snapshot.Init(16);
+        NAP_CHECK(snapshot.GetFrameCount() == 0);
+        NAP_CHECK(snapshot.Read([](const float*) {}) == 0);
+
+        for (int frame = 1; frame <= 10; frame++)
+        {
+            float* data = snapshot.BeginWrite();
+            for (int n = 0; n < 16; n++)
+                data[n] = (float)(frame * 100 + n);
+            snapshot.EndWrite();
+
+            float copy[16];
+            UInt32 read = snapshot.Read([&](const float* src) { memcpy(copy, src, sizeof(copy)); });
+            NAP_CHECK(read == (UInt32)frame);
+            for (int n = 0; n < 16; n++)
+                NAP_CHECK(copy[n] == (float)(frame * 100 + n));
+        }
+    }
+}
+
+NAP_TESTSUITE(RealTimeSafe)
+{
+    struct Patch
+    {
+        int version;
+        float values[32];
+    };
+
+    NAP_UNITTEST(TripleBufferConcurrent)
+    {
+        // The reader must only ever see whole patches, and versions must never go backwards
+        AudioPluginUtil::TripleBuffer<Patch> buffer;
+        const int numversions = 200000;
+        std::thread writer([&]() {
+            for (int v = 1; v <= numversions; v++)
+            {
+                Patch& patch = buffer.BeginWrite();
+                patch.version = v;
+                for (int n = 0; n < 32; n++)
+                    patch.values[n] = (float)(v + n);
+                buffer.EndWrite();
+            }
+        });
+        int last = 0, torn = 0, backwards = 0;
+        while (last < numversions)
+        {
+            const Patch* patch;
+            if (!buffer.Read(patch))
+                continue;
+            if (patch->version < last)
+                backwards++;
+            for (int n = 0; n < 32; n++)
+                if (patch->values[n] != (float)(patch->version + n))
+                    torn++;
+            last = patch->version;
+        }
+        writer.join();
+        NAP_CHECK(torn == 0);
+        NAP_CHECK(backwards == 0);
+    }
+
+    struct Counted
+    {
+        Counted(int& _counter) : counter(_counter) {}
+        ~Counted() { counter++; }
+        int& counter;
+    };
+
+    NAP_UNITTEST(DeferredFree)
+    {
+        int deleted = 0;
+        {
+            AudioPluginUtil::DeferredFreeQueue<2> queue;
+            Counted* a = new Counted(deleted);
+            Counted* b = new Counted(deleted);
+            Counted* c = new Counted(deleted);
+            NAP_CHECK(queue.Retire(a) && queue.Retire(b));
+            NAP_CHECK(queue.IsFull() && !queue.Retire(c));
+            NAP_CHECK(deleted == 0);
+            NAP_CHECK(queue.Collect() == 2 && deleted == 2);
+            NAP_CHECK(queue.Retire(c));
+        }
+        NAP_CHECK(deleted == 3);
+    }
+
+    NAP_UNITTEST(Arena)
+    {
+        AudioPluginUtil::Arena* arena = AudioPluginUtil::Arena::Create(1000);
+        NAP_CHECK(arena != NULL);
+        NAP_CHECK(arena->GetSize() >= 1000);
+        char* a = (char*)arena->Allocate(1);
+        Patch* patch = arena->New<Patch>();
+        NAP_CHECK(a != NULL && patch != NULL);
+        NAP_CHECK(((size_t)a % AudioPluginUtil::Arena::ALIGNMENT) == 0 && ((size_t)patch % AudioPluginUtil::Arena::ALIGNMENT) == 0);
+        NAP_CHECK((char*)patch - a == AudioPluginUtil::Arena::ALIGNMENT);
+        NAP_CHECK(patch->version == 0 && patch->values[31] == 0.0f);
+        NAP_CHECK(arena->GetUsed() == AudioPluginUtil::Arena::ALIGNMENT + AudioPluginUtil::Arena::Footprint(sizeof(Patch)));
+        NAP_CHECK(arena->Allocate(arena->GetSize()) == NULL);
+        char* rest = (char*)arena->Allocate(arena->GetSize() - arena->GetUsed());
+        NAP_CHECK(rest != NULL);
+        rest[0] = 1;
+        AudioPluginUtil::Arena::Destroy(arena);
+    }
+
+    NAP_UNITTEST(TryLock)
+    {
+        AudioPluginUtil::SpinLock spinlock;
+        AudioPluginUtil::Mutex mutex;
+        {
+            AudioPluginUtil::TryScopeLock<AudioPluginUtil::SpinLock> first(spinlock);
+            AudioPluginUtil::TryScopeLock<AudioPluginUtil::SpinLock> second(spinlock);
+            NAP_CHECK(first.IsLocked() && !second.IsLocked());
+        }
+        NAP_CHECK(spinlock.TryLock());
+        spinlock.Unlock();
+
+        mutex.Lock();
+        bool locked = true;
+        std::thread other([&]() { AudioPluginUtil::TryScopeLock<AudioPluginUtil::Mutex> lock(mutex); locked = lock.IsLocked(); });
+        other.join();
+        mutex.Unlock();
+        NAP_CHECK(!locked);
+
+        AudioPluginUtil::AtomicFloat value(0.5f);
+        NAP_CHECK(value.Load() == 0.5f);
+        value.Store(-2.0f);
+        NAP_CHECK(value.Load() == -2.0f);
+    }
+
+    NAP_UNITTEST(StreamRing)
+    {
+        // Blocks of 96 samples wrap around a 1024 sample ring; the reader must see every sample written, in order
+        const int capacity = 1024, blocksize = 96, numblocks = 20000;
+        float* storage = new float[capacity];
+        AudioPluginUtil::StreamRing ring;
+        ring.Init(storage, capacity);
+        std::thread writer([&]() {
+            float block[blocksize];
+            for (int b = 0; b < numblocks; b++)
+            {
+                for (int n = 0; n < blocksize; n++)
+                    block[n] = (float)((b * blocksize + n) & 0xFFFFF);
+                while (!ring.Write(block, blocksize))
+                    std::this_thread::yield();
+            }
+        });
+        int next = 0, wrong = 0;
+        while (next < numblocks * blocksize)
+        {
+            const float* data;
+            int num = ring.GetReadable(data);
+            for (int n = 0; n < num; n++)
+                if (data[n] != (float)((next + n) & 0xFFFFF))
+                    wrong++;
+            ring.Consume(num);
+            next += num;
+        }
+        writer.join();
+        NAP_CHECK(wrong == 0);
+        NAP_CHECK(ring.GetHighWater() <= capacity && ring.GetHighWater() >= blocksize);
+
+        // A full ring drops whole blocks and counts them
+        AudioPluginUtil::StreamRing small;
+        small.Init(storage, 256);
+        float block[blocksize] = {};
+        NAP_CHECK(small.Write(block, blocksize) && small.Write(block, blocksize));
+        NAP_CHECK(!small.Write(block, blocksize));
+        NAP_CHECK(small.GetNumDropped() == 1 && small.GetHighWater() == 2 * blocksize);
+        const float* data;
+        NAP_CHECK(small.GetReadable(data) == 2 * blocksize && data == storage);
+        delete[] storage;
+    }
+}
+
+NAP_TESTSUITE(HistoryBuffer)
+{
+    NAP_UNITTEST(Envelope)
+    {
+        const int length = 100000;
+        AudioPluginUtil::HistoryBuffer history;
+        history.Init(length);
+        NAP_CHECK(history.numlevels == 3);
+
+        AudioPluginUtil::Random r;
+
+        r.Seed(1);
+        float* samples = new float[3 * length];
+        for (int n = 0; n < 3 * length; n++)
+            samples[n] = r.GetFloat(-1.0f, 1.0f);
+        history.Feed(samples, 12345, 1);
+        for (int n = 12345; n < 3 * length; n++)
+            history.Feed(samples[n]);
+
+        const int numpoints = 50;
+        float minbuffer[numpoints], maxbuffer[numpoints], rmsbuffer[numpoints];
+        const int sources[] = { 30, 1000, 20000, 90000 };
+        for (int t = 0; t < 4; t++)
+        {
+            int offset = 37 * t;
+            int valid = history.ReadEnvelope(minbuffer, maxbuffer, rmsbuffer, numpoints, sources[t], offset);
+            NAP_CHECK(valid > 0);
+            double span = (double)sources[t] / (double)numpoints;
+            int decimation = 1;
+            while (decimation < 4096 && decimation * 16 <= span)
+                decimation *= 16;
+            for (int n = 0; n < valid; n++)
+            {
+                // Points read whole entries of the chosen pyramid level, so their ends are snapped down to its grid
+                int d0 = offset + (int)(n * span), d1 = offset + (int)((n + 1) * span);
+                if (d1 <= d0)
+                    d1 = d0 + 1;
+                int s0 = (3 * length - d1) / decimation * decimation, s1 = (3 * length - d0) / decimation * decimation;
+                NAP_CHECK(s1 > s0);
+                float minval = samples[s0], maxval = minval;
+                double sumsquare = 0.0;
+                for (int s = s0; s < s1; s++)
+                {
+                    float x = samples[s];
+                    minval = (x < minval) ? x : minval;
+                    maxval = (x > maxval) ? x : maxval;
+                    sumsquare += x * x;
+                }
+                int i = numpoints - 1 - n;
+                NAP_CHECK(minbuffer[i] == minval);
+                NAP_CHECK(maxbuffer[i] == maxval);
+                NAP_CHECK(fabs(rmsbuffer[i] - sqrt(sumsquare / (s1 - s0))) < 1.0e-4);
+            }
+        }
+
+        delete[] samples;
+    }
+
+    NAP_BENCHMARK(FeedAndRead)
+    {
+        const int length = 48000 * 60, num = 1024;
+        AudioPluginUtil::HistoryBuffer history;
+        history.Init(length);
+        float* data = new float[num];
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int n = 0; n < num; n++)
+            data[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int n = 0; n < length; n += num)
+            history.Feed(data, num, 1);
+
+        double t = TimePerCall([&]() { history.Feed(data, num, 1); });
+        printf("  Feed: %6.2f ns/sample\n", t * 1.0e9 / num);
+
+        const int numpoints = 512;
+        float minbuffer[numpoints], maxbuffer[numpoints], rmsbuffer[numpoints + 1];
+        for (int seconds = 1; seconds <= 50; seconds *= 7)
+        {
+            t = TimePerCall([&]() { history.ReadEnvelope(minbuffer, maxbuffer, rmsbuffer, numpoints, 48000 * seconds, 0); });
+            double t2 = TimePerCall([&]() { history.ReadBuffer(rmsbuffer, numpoints + 1, 48000 * seconds, 0.0f); });
+            printf("  %2d s view, %d points: ReadEnvelope %8.2f us, ReadBuffer %8.2f us\n", seconds, numpoints, t * 1.0e6, t2 * 1.0e6);
+            NAP_CHECK(t < 5.0 * t2); // Each point reads fewer than 16 pyramid entries, so this shouldn't grow with the view
+        }
+        delete[] data;
+    }
+}
+
+NAP_TESTSUITE(UniformConvolver)
+{
+    NAP_UNITTEST(MatchesDirectConvolution)
+    {
+        const int irlength = 1000, blocksize = 64, numblocks = 40;
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        float* ir = new float[irlength];
+        float* input = new float[blocksize * numblocks];
+        float* output = new float[blocksize * numblocks];
+        for (int n = 0; n < irlength; n++)
+            ir[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int n = 0; n < blocksize * numblocks; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+
+        AudioPluginUtil::UniformConvolver conv;
+        conv.Init(ir, irlength, blocksize);
+        for (int b = 0; b < numblocks; b++)
+            conv.ProcessBlock(input + b * blocksize, output + b * blocksize);
+
+        for (int t = 0; t < blocksize * numblocks; t++)
+        {
+            double ref = 0.0;
+            for (int k = 0; k < irlength && k <= t; k++)
+                ref += (double)ir[k] * (double)input[t - k];
+            NAP_CHECK(fabs(ref - output[t]) < 1.0e-4);
+        }
+
+        delete[] ir;
+        delete[] input;
+        delete[] output;
+    }
+
+    NAP_BENCHMARK(Process)
+    {
+        const int irlength = 48000;
+        float* ir = new float[irlength];
+        for (int n = 0; n < irlength; n++)
+            ir[n] = expf(-n * 0.0001f);
+        for (int blocksize = 64; blocksize <= 4096; blocksize *= 4)
+        {
+            AudioPluginUtil::UniformConvolver conv;
+            conv.Init(ir, irlength, blocksize);
+            float* input = new float[blocksize];
+            float* output = new float[blocksize];
+            memset(input, 0, sizeof(float) * blocksize);
+            double t = TimePerCall([&]() { conv.ProcessBlock(input, output); });
+            printf("  block %4d, IR %d: %10.2f us/block  %6.2f ns/sample\n", blocksize, irlength, t * 1.0e6, t * 1.0e9 / blocksize);
+            delete[] input;
+            delete[] output;
+        }
+        delete[] ir;
+    }
+}
+
+NAP_TESTSUITE(ConvolutionReverb)
+{
+    static bool WriteFloatWav(const char* path, const float* data, int numchannels, int numsamples, int samplerate)
+    {
+        FILE* f = fopen(path, "wb");
+        if (f == NULL)
+            return false;
+        unsigned char header[44];
+        int datasize = numsamples * numchannels * 4;
+        const int fields[][3] = {
+            { 4, 4, 36 + datasize }, { 16, 4, 16 }, { 20, 2, 3 }, { 22, 2, numchannels }, { 24, 4, samplerate },
+            { 28, 4, samplerate * numchannels * 4 }, { 32, 2, numchannels * 4 }, { 34, 2, 32 }, { 40, 4, datasize }
+        };
+        memcpy(header, "RIFF....WAVEfmt ", 16);
+        memcpy(header + 36, "data", 4);
+        for (int i = 0; i < 9; i++)
+            for (int n = 0; n < fields[i][1]; n++)
+                header[fields[i][0] + n] = (unsigned char)(fields[i][2] >> (8 * n));
+        bool ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+        ok = ok && fwrite(data, sizeof(float), numsamples * numchannels, f) == (size_t)(numsamples * numchannels);
+        fclose(f);
+        return ok;
+    }
+
+    NAP_UNITTEST(MatchesDirectConvolution)
+    {
+        // 40000 taps reach the third partition stage (16384 sample blocks from tap 32768), so the head, the audio thread
+        // stage and both worker stages all contribute. Blocks are paced so the worker runs as it would behind a device.
+        const int samplerate = 44100, blocksize = 256, irlength = 40000, burstlength = 4096;
+        const int numframes = (burstlength + irlength + blocksize - 1) / blocksize * blocksize;
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        float* ir = new float[irlength];
+        for (int n = 0; n < irlength; n++)
+            ir[n] = r.GetFloat(-0.01f, 0.01f) * expf(-n * 0.0001f);
+        const char* path = "tests_impulseresponse.wav";
+        bool written = WriteFloatWav(path, ir, 1, irlength, samplerate);
+        NAP_CHECK(written);
+
+        // Load once before and once after creating the instance so it also swaps an engine on the audio thread
+        NAP_CHECK(written && ConvolutionReverb_LoadImpulseResponse(path));
+        TestEffect reverb(FindEffect("Demo ConvolutionReverb"), samplerate, blocksize);
+        NAP_CHECK(reverb.IsValid());
+        NAP_CHECK(written && ConvolutionReverb_LoadImpulseResponse(path));
+        remove(path);
+        if (!written || !reverb.IsValid())
+        {
+            delete[] ir;
+            return;
+        }
+        reverb.SetParameter(0, 100.0f); // Wet
+        reverb.SetParameter(1, 0.0f);   // Dry
+
+        float* input = new float[numframes * 2];
+        float* output = new float[numframes * 2];
+        memset(input, 0, sizeof(float) * numframes * 2);
+        for (int n = 0; n < burstlength * 2; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+        for (int n = 0; n < numframes; n += blocksize)
+        {
+            reverb.Process(input + n * 2, output + n * 2, blocksize, 2);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+
+        double maxerror = 0.0;
+        for (int c = 0; c < 2; c++)
+        {
+            for (int t = 0; t < numframes; t++)
+            {
+                double ref = 0.0;
+                for (int k = (t < irlength) ? 0 : t - irlength + 1; k <= t && k < burstlength; k++)
+                    ref += (double)ir[t - k] * (double)input[k * 2 + c];
+                maxerror = fmax(maxerror, fabs(ref - output[t * 2 + c]));
+            }
+        }
+        NAP_CHECK(maxerror < 1.0e-5);
+
+        float lateblocks = -1.0f;
+        reverb.GetBuffer("LateBlocks", &lateblocks, 1);
+        NAP_CHECK(lateblocks == 0.0f);
+
+        delete[] ir;
+        delete[] input;
+        delete[] output;
+    }
+
+    NAP_UNITTEST(Overload)
+    {
+        // Two instances share the worker and are run as fast as possible, so it falls behind. Jobs it can't take are
+        // dropped and reported as late blocks instead of having their input overwritten while being convolved.
+        const int samplerate = 44100, blocksize = 256, irlength = 40000, numframes = 4 * samplerate;
+        float* ir = new float[irlength];
+        for (int n = 0; n < irlength; n++)
+            ir[n] = (n == 0) ? 0.5f : 0.0f;
+        const char* path = "tests_impulseresponse.wav";
+        bool loaded = WriteFloatWav(path, ir, 1, irlength, samplerate) && ConvolutionReverb_LoadImpulseResponse(path);
+        remove(path);
+        NAP_CHECK(loaded);
+        delete[] ir;
+        if (!loaded)
+            return;
+
+        float* buffer = new float[blocksize * 2];
+        for (int i = 0; i < 2; i++)
+        {
+            TestEffect reverb1(FindEffect("Demo ConvolutionReverb"), samplerate, blocksize);
+            TestEffect reverb2(FindEffect("Demo ConvolutionReverb"), samplerate, blocksize);
+            bool bounded = true;
+            for (int n = 0; n < numframes; n += blocksize)
+            {
+                for (int k = 0; k < blocksize * 2; k++)
+                    buffer[k] = (k & 2) ? 1.0f : -1.0f;
+                reverb1.Process(buffer, buffer, blocksize, 2);
+                reverb2.Process(buffer, buffer, blocksize, 2);
+                for (int k = 0; k < blocksize * 2; k++)
+                    bounded = bounded && fabsf(buffer[k]) < 10.0f;
+            }
+            NAP_CHECK(bounded);
+            float lateblocks1 = 0.0f, lateblocks2 = 0.0f;
+            reverb1.GetBuffer("LateBlocks", &lateblocks1, 1);
+            reverb2.GetBuffer("LateBlocks", &lateblocks2, 1);
+            NAP_CHECK(lateblocks1 + lateblocks2 > 0.0f);
+        }
+        delete[] buffer;
+    }
+}
+
+NAP_TESTSUITE(PitchDetector)
+{
+    // Runs a second of a sine through a fresh instance and returns the last published frequency and confidence
+    static void DetectSine(float freq, float minfreq, float maxfreq, int samplerate, float& f0, float& confidence)
+    {
+        const int numframes = samplerate;
+        TestEffect detector(FindEffect("Demo PitchDetector"), samplerate, 256);
+        detector.SetParameter(1, minfreq);
+        detector.SetParameter(2, maxfreq);
+        float* buffer = new float[numframes * 2];
+        for (int n = 0; n < numframes; n++)
+            buffer[n * 2] = buffer[n * 2 + 1] = 0.5f * sinf(2.0f * (float)M_PI * freq * n / samplerate);
+        detector.Process(buffer, buffer, numframes, 2);
+        float result[3] = { -1.0f, -1.0f, 0.0f };
+        detector.GetBuffer("Pitch", result, 3);
+        f0 = result[0];
+        confidence = result[1];
+        delete[] buffer;
+    }
+
+    NAP_UNITTEST(Sines)
+    {
+        const float freqs[] = { 82.41f, 220.0f, 440.0f, 987.77f };
+        for (int i = 0; i < 4; i++)
+        {
+            float f0, confidence;
+            DetectSine(freqs[i], 60.0f, 1500.0f, 44100, f0, confidence);
+            NAP_CHECK(fabsf(f0 - freqs[i]) < 0.002f * freqs[i]);
+            NAP_CHECK(confidence > 0.95f);
+        }
+    }
+
+    NAP_UNITTEST(FrequencyRange)
+    {
+        // Min Freq above Max Freq is the same range the other way round
+        float f0, confidence;
+        DetectSine(440.0f, 800.0f, 300.0f, 44100, f0, confidence);
+        NAP_CHECK(fabsf(f0 - 440.0f) < 1.0f && confidence > 0.95f);
+
+        // At 192 kHz a 100 Hz period is longer than the longest lag, so nothing can be detected
+        DetectSine(50.0f, 50.0f, 100.0f, 192000, f0, confidence);
+        NAP_CHECK(f0 == 0.0f && confidence == 0.0f);
+
+        DetectSine(0.0f, 60.0f, 1500.0f, 44100, f0, confidence);
+        NAP_CHECK(f0 == 0.0f && confidence == 0.0f);
+    }
+}
+
+NAP_TESTSUITE(LoudnessMeter)
+{
+    enum { R_MOMENTARY, R_SHORTTERM, R_INTEGRATED, R_TRUEPEAK, R_NUM };
+    const float SILENCE = -120.0f;
+
+    // Feeds seconds of a sine with the given amplitude, frequency and phase into the left channel of a stereo meter
+    static void FeedSine(TestEffect& meter, float amplitude, float freq, float phase, float seconds, int samplerate)
+    {
+        const int numframes = (int)(seconds * samplerate);
+        float* buffer = new float[numframes * 2];
+        for (int n = 0; n < numframes; n++)
+        {
+            buffer[n * 2] = amplitude * sinf(2.0f * (float)M_PI * freq * n / samplerate + phase);
+            buffer[n * 2 + 1] = 0.0f;
+        }
+        meter.Process(buffer, buffer, numframes, 2);
+        delete[] buffer;
+    }
+
+    NAP_UNITTEST(FullScaleSine)
+    {
+        // BS.1770: a 0 dBFS 997 Hz sine in one channel reads -3.01 LUFS
+        TestEffect meter(FindEffect("Demo LoudnessMeter"), 48000, 512);
+        FeedSine(meter, 1.0f, 997.0f, 0.0f, 5.0f, 48000);
+        float result[R_NUM];
+        meter.GetBuffer("Loudness", result, R_NUM);
+        NAP_CHECK(fabsf(result[R_MOMENTARY] + 3.01f) < 0.05f);
+        NAP_CHECK(fabsf(result[R_SHORTTERM] + 3.01f) < 0.05f);
+        NAP_CHECK(fabsf(result[R_INTEGRATED] + 3.01f) < 0.05f);
+        NAP_CHECK(fabsf(result[R_TRUEPEAK]) < 0.05f);
+    }
+
+    NAP_UNITTEST(AbsoluteGate)
+    {
+        // -80 dBFS stays below the -70 LUFS absolute gate, so no gating block counts towards integrated loudness
+        TestEffect meter(FindEffect("Demo LoudnessMeter"), 48000, 512);
+        FeedSine(meter, 1.0e-4f, 997.0f, 0.0f, 3.0f, 48000);
+        float result[R_NUM];
+        meter.GetBuffer("Loudness", result, R_NUM);
+        NAP_CHECK(fabsf(result[R_MOMENTARY] + 83.01f) < 0.05f);
+        NAP_CHECK(result[R_INTEGRATED] == SILENCE);
+    }
+
+    NAP_UNITTEST(TruePeak)
+    {
+        // A quarter sample rate sine shifted by 45 degrees is sampled at +-0.707 of its amplitude and peaks in between
+        TestEffect meter(FindEffect("Demo LoudnessMeter"), 48000, 512);
+        FeedSine(meter, 1.0f, 12000.0f, 0.25f * (float)M_PI, 1.0f, 48000);
+        float result[R_NUM];
+        meter.GetBuffer("Loudness", result, R_NUM);
+        NAP_CHECK(result[R_TRUEPEAK] > -3.01f + 2.5f);
+        NAP_CHECK(result[R_TRUEPEAK] < 0.2f);
+    }
+
+    NAP_UNITTEST(Reset)
+    {
+        // After a reset only the quieter second sine contributes to integrated loudness and true peak
+        TestEffect meter(FindEffect("Demo LoudnessMeter"), 48000, 512);
+        FeedSine(meter, 1.0f, 997.0f, 0.0f, 3.0f, 48000);
+        meter.SetParameter(0, 1.0f);
+        FeedSine(meter, 0.0316228f, 997.0f, 0.0f, 2.0f, 48000);
+        float result[R_NUM];
+        meter.GetBuffer("Loudness", result, R_NUM);
+        NAP_CHECK(fabsf(result[R_INTEGRATED] + 33.01f) < 0.05f);
+        NAP_CHECK(fabsf(result[R_TRUEPEAK] + 30.0f) < 0.05f);
+
+        // Without a reset the loud part dominates
+        meter.SetParameter(0, 0.0f);
+        FeedSine(meter, 1.0f, 997.0f, 0.0f, 3.0f, 48000);
+        meter.GetBuffer("Loudness", result, R_NUM);
+        NAP_CHECK(result[R_INTEGRATED] > -4.0f);
+    }
+}
+
+NAP_TESTSUITE(BiquadFilter)
+{
+    NAP_UNITTEST(MatchesReference)
+    {
+        // Compare against a double precision direct form I filter built from the same coefficients
+        AudioPluginUtil::BiquadFilter filters[5];
+        memset(filters, 0, sizeof(filters));
+        filters[0].SetupLowpass(1000.0f, 48000.0f, 0.7f);
+        filters[1].SetupHighpass(200.0f, 48000.0f, 2.0f);
+        filters[2].SetupPeaking(3000.0f, 48000.0f, 6.0f, 1.0f);
+        filters[3].SetupLowShelf(100.0f, 48000.0f, -12.0f, 0.7f);
+        filters[4].SetupHighShelf(8000.0f, 48000.0f, 3.0f, 0.7f);
+
+        AudioPluginUtil::Random r;
+
+        r.Seed(1);
+        for (int f = 0; f < 5; f++)
+        {
+            float coeffs[5], *p = coeffs;
+            filters[f].StoreCoeffs(p);
+            double b2 = coeffs[0], b1 = coeffs[1], b0 = coeffs[2], a2 = coeffs[3], a1 = coeffs[4];
+            double x1 = 0.0, x2 = 0.0, y1 = 0.0, y2 = 0.0;
+            for (int n = 0; n < 4096; n++)
+            {
+                float x = r.GetFloat(-1.0f, 1.0f);
+                double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+                x2 = x1; x1 = x; y2 = y1; y1 = y;
+                NAP_CHECK(fabs(filters[f].Process(x) - y) < 1.0e-3);
+            }
+        }
+    }
+
+    NAP_UNITTEST(BlockMatchesPerSample)
+    {
+        const int num = 1000;
+        float input[2 * num], output[2 * num], inplace[2 * num];
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int n = 0; n < 2 * num; n++)
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+
+        AudioPluginUtil::BiquadFilter filters[6];
+        memset(filters, 0, sizeof(filters));
+        for (int f = 0; f < 6; f += 2)
+        {
+            filters[f].SetupLowpass(1000.0f, 48000.0f, 0.7f);
+            filters[f + 1].SetupPeaking(3000.0f, 48000.0f, 6.0f, 1.0f);
+        }
+
+        // Strided, in place and stereo, checked against per-sample processing of the same channels
+        memcpy(inplace, input, sizeof(inplace));
+        filters[2].ProcessBlock(input, output, num, 2);
+        filters[3].ProcessBlock(input + 1, output + 1, num, 2);
+        AudioPluginUtil::BiquadFilter::ProcessBlockStereo(filters[4], filters[5], inplace, inplace, num);
+        for (int n = 0; n < num; n++)
+        {
+            float l = filters[0].Process(input[2 * n]), r = filters[1].Process(input[2 * n + 1]);
+            NAP_CHECK(output[2 * n] == l && output[2 * n + 1] == r);
+            NAP_CHECK(inplace[2 * n] == l && inplace[2 * n + 1] == r);
+        }
+
+        AudioPluginUtil::StateVariableFilter svf[2];
+        memset(svf, 0, sizeof(svf));
+        svf[0].cutoff = svf[1].cutoff = 0.1f;
+        svf[0].bandwidth = svf[1].bandwidth = 0.5f;
+        float* lp = output;
+        float* bp = output + num;
+        svf[1].ProcessBlock(input, lp, bp, inplace, num);
+        for (int n = 0; n < num; n++)
+        {
+            float l, b, h;
+            svf[0].Process(input[n], l, b, h);
+            NAP_CHECK(lp[n] == l && bp[n] == b && inplace[n] == h);
+        }
+    }
+
+    NAP_BENCHMARK(Process)
+    {
+        const int num = 4096;
+        float* data = new float[num];
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int n = 0; n < num; n++)
+            data[n] = r.GetFloat(-1.0f, 1.0f);
+        AudioPluginUtil::BiquadFilter filter;
+        memset(&filter, 0, sizeof(filter));
+        filter.SetupLowpass(1000.0f, 48000.0f, 0.7f);
+        double t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) sum += filter.Process(data[n]); gSink = sum; });
+        printf("  lowpass: %6.2f ns/sample\n", t * 1.0e9 / num);
+
+        AudioPluginUtil::StateVariableFilter svf;
+        memset(&svf, 0, sizeof(svf));
+        svf.cutoff = 0.1f;
+        svf.bandwidth = 0.5f;
+        t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) sum += svf.ProcessLPF(data[n]); gSink = sum; });
+        printf("  state variable lowpass: %6.2f ns/sample\n", t * 1.0e9 / num);
+
+        float* out = new float[num];
+        t = TimePerCall([&]() { filter.ProcessBlock(data, out, num); gSink = out[num - 1]; });
+        printf("  lowpass block: %6.2f ns/sample\n", t * 1.0e9 / num);
+        t = TimePerCall([&]() { svf.ProcessBlockLPF(data, out, num); gSink = out[num - 1]; });
+        printf("  state variable lowpass block: %6.2f ns/sample\n", t * 1.0e9 / num);
+        delete[] out;
+        delete[] data;
+    }
+}
+
+NAP_TESTSUITE(BiquadBank)
+{
+    static void SetupFilters(AudioPluginUtil::BiquadFilter* filters, int numfilters)
+    {
+        memset(filters, 0, sizeof(AudioPluginUtil::BiquadFilter) * numfilters);
+        for (int f = 0; f < numfilters; f++)
+            filters[f].SetupPeaking(100.0f * (f + 1) * (f + 1), 48000.0f, (f & 1) ? 6.0f : -6.0f, 1.0f);
+    }
+
+    NAP_UNITTEST(MatchesBiquadFilter)
+    {
+        // Odd block sizes exercise both the pipelined and the scalar paths, six filters leave two pass-through lanes.
+        // The tolerance covers the rounding of the direct form II reference at low cutoffs.
+        const int numfilters = 6, num = 2048;
+        static const int blocksizes[] = { 1, 2, 3, 4, 5, 17, 64, 255 };
+        AudioPluginUtil::BiquadFilter filters[3][numfilters];
+        AudioPluginUtil::BiquadBank cascade, split, parallel;
+        for (int m = 0; m < 3; m++)
+            SetupFilters(filters[m], numfilters);
+        cascade.Init(numfilters);
+        split.Init(numfilters);
+        parallel.Init(numfilters);
+        for (int f = 0; f < numfilters; f++)
+        {
+            cascade.SetFilter(f, filters[0][f]);
+            split.SetFilter(f, filters[1][f]);
+            parallel.SetFilter(f, filters[2][f]);
+        }
+
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        float mono[256], splitout[256 * numfilters], interleaved[256 * 3];
+        int n = 0, b = 0;
+        while (n < num)
+        {
+            int blocksize = blocksizes[b++ % 8];
+            for (int i = 0; i < blocksize; i++)
+                mono[i] = r.GetFloat(-1.0f, 1.0f);
+            for (int i = 0; i < blocksize * 3; i++)
+                interleaved[i] = r.GetFloat(-1.0f, 1.0f);
+            float cascadeout[256];
+            cascade.ProcessCascade(mono, cascadeout, blocksize);
+            split.ProcessSplit(mono, splitout, blocksize);
+            float parallelout[256 * 3];
+            parallel.ProcessParallel(interleaved, parallelout, blocksize, 3);
+            for (int i = 0; i < blocksize; i++)
+            {
+                float y = mono[i];
+                for (int f = 0; f < numfilters; f++)
+                {
+                    y = filters[0][f].Process(y);
+                    NAP_CHECK(fabsf(splitout[i * numfilters + f] - filters[1][f].Process(mono[i])) < 1.0e-3f);
+                }
+                NAP_CHECK(fabsf(cascadeout[i] - y) < 1.0e-3f);
+                for (int c = 0; c < 3; c++)
+                    NAP_CHECK(fabsf(parallelout[i * 3 + c] - filters[2][c].Process(interleaved[i * 3 + c])) < 1.0e-3f);
+            }
+            n += blocksize;
+        }
+    }
+
+    NAP_BENCHMARK(Process)
+    {
+        const int numfilters = 8, num = 4096;
+        float* data = new float[num];
+        float* out = new float[num * numfilters];
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int n = 0; n < num; n++)
+            data[n] = r.GetFloat(-1.0f, 1.0f);
+        AudioPluginUtil::BiquadFilter filters[numfilters];
+        SetupFilters(filters, numfilters);
+        AudioPluginUtil::BiquadBank bank;
+        bank.Init(numfilters);
+        for (int f = 0; f < numfilters; f++)
+            bank.SetFilter(f, filters[f]);
+
+        double t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) { float y = data[n]; for (int f = 0; f < numfilters; f++) y = filters[f].Process(y); sum += y; } gSink = sum; });
+        printf("  %d sections in series, scalar: %6.2f ns/sample\n", numfilters, t * 1.0e9 / num);
+        t = TimePerCall([&]() { bank.ProcessCascade(data, out, num); gSink = out[num - 1]; });
+        printf("  %d sections in series, bank: %6.2f ns/sample\n", numfilters, t * 1.0e9 / num);
+        t = TimePerCall([&]() { bank.ProcessSplit(data, out, num); gSink = out[num - 1]; });
+        printf("  %d sections in parallel, bank: %6.2f ns/sample\n", numfilters, t * 1.0e9 / num);
+        delete[] data;
+        delete[] out;
+    }
+}
+
+NAP_TESTSUITE(TrapezoidalSVF)
+{
+    NAP_UNITTEST(FastSinCos)
+    {
+        float maxerr = 0.0f;
+        for (int n = -10000; n <= 10000; n++)
+        {
+            float x = n * AudioPluginUtil::kPI / 10000.0f, s, c;
+            AudioPluginUtil::FastSinCos(x, s, c);
+            maxerr = AudioPluginUtil::FastMax(maxerr, AudioPluginUtil::FastMax(fabsf(s - sinf(x)), fabsf(c - cosf(x))));
+        }
+        NAP_CHECK(maxerr < 1.0e-6f);
+    }
+
+    NAP_UNITTEST(MatchesBiquadFilter)
+    {
+        // Both are the bilinear transform of the same analog prototype
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        AudioPluginUtil::BiquadFilter lowpass, highpass;
+        memset(&lowpass, 0, sizeof(lowpass));
+        memset(&highpass, 0, sizeof(highpass));
+        lowpass.SetupLowpass(1000.0f, 48000.0f, 2.0f);
+        highpass.SetupHighpass(5000.0f, 48000.0f, 0.7f);
+        AudioPluginUtil::TrapezoidalSVF svflowpass, svfhighpass;
+        svflowpass.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 2.0f);
+        svfhighpass.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Highpass, 5000.0f, 48000.0f, 0.7f);
+        for (int n = 0; n < 4096; n++)
+        {
+            float x = r.GetFloat(-1.0f, 1.0f);
+            NAP_CHECK(fabsf(svflowpass.Process(x) - lowpass.Process(x)) < 1.0e-3f);
+            NAP_CHECK(fabsf(svfhighpass.Process(x) - highpass.Process(x)) < 1.0e-3f);
+        }
+    }
+
+    NAP_UNITTEST(FastSweep)
+    {
+        // A resonant filter swept across the whole range every 256 samples must stay bounded
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        AudioPluginUtil::TrapezoidalSVF perblock, persample;
+        perblock.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 20.0f, 48000.0f, 20.0f);
+        persample.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Bandpass, 20.0f, 48000.0f, 20.0f);
+        const float scale = AudioPluginUtil::TrapezoidalSVF::GetCutoffScale(48000.0f);
+        float block[16], maxval = 0.0f;
+        for (int n = 0; n < 48000; n += 16)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                float cutoff = 20.0f * powf(1000.0f, 0.5f + 0.5f * sinf((n + i) * 2.0f * AudioPluginUtil::kPI / 256.0f));
+                persample.SetTargetScaled(cutoff, scale, 20.0f);
+                block[i] = r.GetFloat(-1.0f, 1.0f);
+                maxval = AudioPluginUtil::FastMax(maxval, fabsf(persample.Process(block[i])));
+            }
+            perblock.SetTarget(20.0f * powf(1000.0f, 0.5f + 0.5f * sinf((n + 16) * 2.0f * AudioPluginUtil::kPI / 256.0f)), 48000.0f, 20.0f);
+            perblock.ProcessBlock(block, block, 16);
+            for (int i = 0; i < 16; i++)
+                maxval = AudioPluginUtil::FastMax(maxval, fabsf(block[i]));
+        }
+        NAP_CHECK(maxval < 100.0f);
+
+        // The cutoff buffer path does the same per-sample updates as SetTargetScaled and Process
+        float input[1000], cutoff[1000], output[1000];
+        persample.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 5.0f);
+        perblock.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 5.0f);
+        for (int n = 0; n < 1000; n++)
+        {
+            input[n] = r.GetFloat(-1.0f, 1.0f);
+            cutoff[n] = r.GetFloat(100.0f, 10000.0f);
+        }
+        perblock.ProcessBlockModulated(input, cutoff, output, 1000, 48000.0f, 5.0f);
+        for (int n = 0; n < 1000; n++)
+        {
+            persample.SetTargetScaled(cutoff[n], scale, 5.0f);
+            NAP_CHECK(fabsf(persample.Process(input[n]) - output[n]) < 1.0e-4f);
+        }
+
+        // And with a Q per sample too
+        float q[1000];
+        persample.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 5.0f);
+        perblock.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 5.0f);
+        for (int n = 0; n < 1000; n++)
+            q[n] = r.GetFloat(0.5f, 10.0f);
+        perblock.ProcessBlockModulated(input, cutoff, q, output, 1000, 48000.0f);
+        for (int n = 0; n < 1000; n++)
+        {
+            persample.SetTargetScaled(cutoff[n], scale, q[n]);
+            NAP_CHECK(fabsf(persample.Process(input[n]) - output[n]) < 1.0e-4f);
+        }
+    }
+
+    NAP_BENCHMARK(Modulated)
+    {
+        const int num = 4096;
+        float* data = new float[num];
+        float* cutoff = new float[num];
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        for (int n = 0; n < num; n++)
+        {
+            data[n] = r.GetFloat(-1.0f, 1.0f);
+            cutoff[n] = 200.0f + 5000.0f * (n & 255) / 256.0f;
+        }
+        AudioPluginUtil::BiquadFilter biquad;
+        memset(&biquad, 0, sizeof(biquad));
+        double t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) { biquad.SetupLowpass(cutoff[n], 48000.0f, 2.0f); sum += biquad.Process(data[n]); } gSink = sum; });
+        printf("  biquad setup every sample: %6.2f ns/sample\n", t * 1.0e9 / num);
+        AudioPluginUtil::TrapezoidalSVF svf;
+        svf.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, 1000.0f, 48000.0f, 2.0f);
+        const float scale = AudioPluginUtil::TrapezoidalSVF::GetCutoffScale(48000.0f);
+        t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) { svf.SetTargetScaled(cutoff[n], scale, 2.0f); sum += svf.Process(data[n]); } gSink = sum; });
+        printf("  trapezoidal SVF target every sample: %6.2f ns/sample\n", t * 1.0e9 / num);
+        t = TimePerCall([&]() { for (int n = 0; n < num; n += 32) { svf.SetTarget(cutoff[n], 48000.0f, 2.0f); svf.ProcessBlock(data + n, data + n, 32); } gSink = data[num - 1]; });
+        printf("  trapezoidal SVF ramped over 32 samples: %6.2f ns/sample\n", t * 1.0e9 / num);
+        t = TimePerCall([&]() { svf.ProcessBlockModulated(data, cutoff, data, num, 48000.0f, 2.0f); gSink = data[num - 1]; });
+        printf("  trapezoidal SVF cutoff buffer: %6.2f ns/sample\n", t * 1.0e9 / num);
+        delete[] data;
+        delete[] cutoff;
+    }
+}
+
+NAP_TESTSUITE(DenormalGuard)
+{
+    NAP_UNITTEST(FlushesAndRestores)
+    {
+#if PLUGINUTIL_USE_SSE
+        volatile float tiny = 1.0e-30f, scale = 1.0e-10f;
+        {
+            AudioPluginUtil::DenormalGuard guard;
+            NAP_CHECK(tiny * scale == 0.0f);
+        }
+        NAP_CHECK(tiny * scale != 0.0f);
+#endif
+    }
+
+    NAP_BENCHMARK(DecayingTail)
+    {
+        // A resonant filter ringing out after the input stopped, with its state in the denormal range the whole time
+        const int num = 1024;
+        float* silence = new float[num];
+        float* out = new float[num];
+        memset(silence, 0, sizeof(float) * num);
+        AudioPluginUtil::StateVariableFilter svf;
+        svf.cutoff = 0.01f;
+        svf.bandwidth = 0.01f;
+        auto tail = [&]() { svf.lpf = 1.0e-38f; svf.bpf = 1.0e-38f; svf.ProcessBlockLPF(silence, out, num); gSink = out[num - 1]; };
+        double t = TimePerCall(tail);
+        printf("  without guard: %8.2f us/block of %d\n", t * 1.0e6, num);
+        {
+            AudioPluginUtil::DenormalGuard guard;
+            t = TimePerCall(tail);
+        }
+        printf("  with guard:    %8.2f us/block of %d\n", t * 1.0e6, num);
+        delete[] silence;
+        delete[] out;
+    }
+}
+
+NAP_TESTSUITE(Random)
+{
+    NAP_UNITTEST(Distribution)
+    {
+        AudioPluginUtil::Random r1, r2;
+        r1.Seed(1234);
+        r2.Seed(1234);
+        double sum = 0.0;
+        const int num = 100000;
+        for (int n = 0; n < num; n++)
+        {
+            float x = r1.GetFloat(-1.0f, 1.0f);
+            NAP_CHECK(x >= -1.0f && x <= 1.0f);
+            NAP_CHECK(x == r2.GetFloat(-1.0f, 1.0f));
+            sum += x;
+        }
+        NAP_CHECK(fabs(sum / num) < 0.01);
+    }
+
+    NAP_UNITTEST(Noise)
+    {
+        // White noise is uniform and uncorrelated, pink and brown noise are increasingly lowpassed
+        const int num = 100001;
+        float* buffer = new float[num];
+        AudioPluginUtil::NoiseSource noise;
+        noise.Init(1234);
+        double correlation[3];
+        for (int color = 0; color < 3; color++)
+        {
+            noise.Process(buffer, num, (AudioPluginUtil::NoiseSource::Color)color);
+            double sum = 0.0, power = 0.0, lag1 = 0.0;
+            for (int n = 0; n < num; n++)
+            {
+                NAP_CHECK(fabsf(buffer[n]) < 2.0f);
+                sum += buffer[n];
+                power += buffer[n] * buffer[n];
+                if (n > 0)
+                    lag1 += buffer[n] * buffer[n - 1];
+            }
+            NAP_CHECK(fabs(sum / num) < 0.05);
+            NAP_CHECK(power / num > 0.01 && power / num < 1.0);
+            if (color == 0)
+                NAP_CHECK(fabs(power / num - 1.0 / 3.0) < 0.01);
+            correlation[color] = lag1 / power;
+        }
+        NAP_CHECK(fabs(correlation[0]) < 0.01);
+        NAP_CHECK(correlation[1] > 0.3 && correlation[1] < 0.9);
+        NAP_CHECK(correlation[2] > 0.95);
+        delete[] buffer;
+    }
+
+    NAP_BENCHMARK(GetFloat)
+    {
+        const int num = 4096;
+        AudioPluginUtil::Random r;
+        r.Seed(1);
+        double t = TimePerCall([&]() { float sum = 0.0f; for (int n = 0; n < num; n++) sum += r.GetFloat(-1.0f, 1.0f); gSink = sum; });
+        printf("  %6.2f ns/sample\n", t * 1.0e9 / num);
+
+        float* buffer = new float[num];
+        AudioPluginUtil::VectorRandom vr;
+        vr.Seed(1);
+        t = TimePerCall([&]() { vr.FillFloats(buffer, num); gSink = buffer[num - 1]; });
+        printf("  vector random: %6.2f ns/sample\n", t * 1.0e9 / num);
+        AudioPluginUtil::NoiseSource noise;
+        noise.Init(1);
+        t = TimePerCall([&]() { noise.Process(buffer, num, AudioPluginUtil::NoiseSource::Color_Pink); gSink = buffer[num - 1]; });
+        printf("  pink noise: %6.2f ns/sample\n", t * 1.0e9 / num);
+        delete[] buffer;
+    }
+}
+
+NAP_TESTSUITE(SynthVoice)
+{
+    // Renders the demo sequence with the given voice settings and returns the peak level, or -1 on a bad sample
+    static float RenderDemo(const common::VoiceConfig& config, float* buffer, int numframes)
+    {
+        const int samplerate = 44100, blocksize = 256;
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::InitEventQueueWithSequence(&queue, samplerate);
+        common::InitStateData(*state, &queue, samplerate);
+        state->cutoffFreq = 2000.0f;
+        state->cutoffK = 2.0f;
+        state->unisonDetune = 20.0f;
+        bool ok = common::SetVoiceConfig(*state, config);
+        float peak = 0.0f;
+        for (int n = 0; n < numframes; n += blocksize)
+            common::Process(state, buffer + n, 1, (numframes - n < blocksize) ? (numframes - n) : blocksize, samplerate);
+        for (int n = 0; n < numframes; n++)
+        {
+            if (!std::isfinite(buffer[n]))
+                ok = false;
+            peak = fmaxf(peak, fabsf(buffer[n]));
+        }
+        delete state;
+        return ok ? peak : -1.0f;
+    }
+
+    NAP_UNITTEST(AllKernels)
+    {
+        const int numframes = 44100;
+        float* buffer = new float[numframes];
+        for (int osc = 0; osc < (int)common::Oscillator::Count; osc++)
+        {
+            for (int filter = 0; filter < (int)common::VoiceFilter::Count; filter++)
+            {
+                for (int oversampling = 1; oversampling <= common::kMaxOversampling; oversampling *= 2)
+                {
+                    for (int unison = 1; unison <= common::kMaxUnison; unison++)
+                    {
+                        common::VoiceConfig config;
+                        config.oscillator = (common::Oscillator)osc;
+                        config.filter = (common::VoiceFilter)filter;
+                        config.oversampling = oversampling;
+                        config.unison = unison;
+                        float peak = RenderDemo(config, buffer, numframes);
+                        NAP_CHECK(peak > 0.05f && peak < 4.0f);
+                    }
+                }
+            }
+        }
+
+        common::StateData* state = new common::StateData();
+        common::VoiceConfig config;
+        config.oversampling = 3;
+        NAP_CHECK(!common::SetVoiceConfig(*state, config));
+        config.oversampling = 1;
+        config.unison = common::kMaxUnison + 1;
+        NAP_CHECK(!common::SetVoiceConfig(*state, config));
+        delete state;
+        delete[] buffer;
+    }
+
+    // Holds one note (A4, full velocity) through the default oscillator and the given filter and routing
+    static bool RenderNote(const common::ModMatrix& m, common::VoiceFilter filter, float* buffer, int numframes)
+    {
+        const int samplerate = 44100, blocksize = 256;
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::Event e;
+        e.type = common::EventType::NoteOn;
+        e.midiNote = 69;
+        queue.push(e);
+        common::InitStateData(*state, &queue, samplerate);
+        state->cutoffFreq = 2000.0f;
+        state->cutoffK = 1.0f;
+        state->lfo1Freq = 30.0f;
+        state->lfo2Freq = 7.0f;
+        common::VoiceConfig config;
+        config.filter = filter;
+        bool ok = common::SetVoiceConfig(*state, config) && common::SetModMatrix(*state, m);
+        for (int n = 0; n < numframes; n += blocksize)
+            common::Process(state, buffer + n, 1, (numframes - n < blocksize) ? (numframes - n) : blocksize, samplerate);
+        delete state;
+        return ok;
+    }
+
+    // The same note with the voice controls worked out here from the audio-rate routes of m, and the voice kernel run
+    // one sample at a time so every control value is the first of its stretch
+    static void RenderNoteReference(const common::ModMatrix& m, common::VoiceFilter filter, float* buffer, int numframes)
+    {
+        const int samplerate = 44100;
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::InitStateData(*state, &queue, samplerate);
+        state->cutoffFreq = 2000.0f;
+        state->cutoffK = 1.0f;
+        state->lfo1Freq = 30.0f;
+        state->lfo2Freq = 7.0f;
+        common::VoiceConfig config;
+        config.filter = filter;
+        common::SetVoiceConfig(*state, config);
+        state->ampEnvState = common::AdsrState::Opening;
+        state->ampEnvTicksSinceStart = 0;
+        const int attack = (int)(state->ampEnvAttackTime * samplerate), decay = (int)(state->ampEnvDecayTime * samplerate), release = (int)(state->ampEnvReleaseTime * samplerate);
+        const float lfo1change = state->lfo1Freq * 2 * common::kPi / samplerate, lfo2change = state->lfo2Freq * 2 * common::kPi / samplerate;
+        common::VoiceControl control;
+        memset(control.noise, 0, sizeof(control.noise));
+        for (int n = 0; n < numframes; n++)
+        {
+            if (state->lfo1Phase >= 2 * common::kPi)
+                state->lfo1Phase -= 2 * common::kPi;
+            if (state->lfo2Phase >= 2 * common::kPi)
+                state->lfo2Phase -= 2 * common::kPi;
+            float lfo1 = sinf(state->lfo1Phase), lfo2 = sinf(state->lfo2Phase);
+            state->lfo1Phase += lfo1change;
+            state->lfo2Phase += lfo2change;
+            float env = common::NextAmpEnvValue(state, attack, decay, release);
+            float mod[common::kNumModDests] = {};
+            for (int r = 0; r < m.numRoutes; r++)
+            {
+                const common::ModRoute& route = m.routes[r];
+                if (route.source == common::ModSource::LFO1)
+                    mod[(int)route.dest] += route.depth * lfo1;
+                else if (route.source == common::ModSource::LFO2)
+                    mod[(int)route.dest] += route.depth * lfo2;
+                else if (route.source == common::ModSource::AmpEnv)
+                    mod[(int)route.dest] += route.depth * env;
+            }
+            control.freq[0] = common::MidiToFreq(69) * exp2f(mod[(int)common::ModDest::Pitch]);
+            control.cutoff[0] = state->cutoffFreq * exp2f(mod[(int)common::ModDest::Cutoff]);
+            control.k[0] = fminf(fmaxf(state->cutoffK + mod[(int)common::ModDest::Resonance], 0.0f), 3.99f);
+            control.gain[0] = env * fmaxf(1.0f + mod[(int)common::ModDest::Amp], 0.0f);
+            state->voiceKernel(state, control, 1, buffer + n, 1, samplerate);
+        }
+        delete state;
+    }
+
+    static common::ModMatrix MakeMatrix(const common::ModRoute* routes, int numroutes)
+    {
+        common::ModMatrix m;
+        for (int n = 0; n < numroutes; n++)
+            m.routes[n] = routes[n];
+        m.numRoutes = numroutes;
+        return m;
+    }
+
+    NAP_UNITTEST(BlockRateModulation)
+    {
+        const common::ModRoute routes[] = {
+            { common::ModSource::CC, 74, common::ModDest::Cutoff, 2.0f },
+            { common::ModSource::CC, 1, common::ModDest::Pitch, 1.0f },
+            { common::ModSource::Velocity, 0, common::ModDest::Amp, -0.5f },
+            { common::ModSource::Aftertouch, 0, common::ModDest::Resonance, 1.0f },
+            { common::ModSource::Aftertouch, 0, common::ModDest::Cutoff, 0.5f },
+            { common::ModSource::LFO1, 0, common::ModDest::Pitch, 0.3f }
+        };
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::InitStateData(*state, &queue, 44100);
+        NAP_CHECK(common::SetModMatrix(*state, MakeMatrix(routes, 6)));
+
+        // Block-rate offsets follow the events; the LFO route never shows up in them
+        common::Event e;
+        e.type = common::EventType::NoteOn;
+        e.midiNote = 60;
+        e.value = 100;
+        queue.push(e);
+        e.type = common::EventType::ControlChange;
+        e.midiNote = 74;
+        e.value = 64;
+        queue.push(e);
+        e.type = common::EventType::Aftertouch;
+        e.timeInTicks = 10;
+        e.value = 32;
+        queue.push(e);
+        float buffer[256];
+        common::Process(state, buffer, 1, 256, 44100);
+        const float eps = 1.0e-6f;
+        NAP_CHECK(fabsf(state->blockMod[(int)common::ModDest::Cutoff] - (2.0f * 64.0f + 0.5f * 32.0f) / 127.0f) < eps);
+        NAP_CHECK(state->blockMod[(int)common::ModDest::Pitch] == 0.0f);
+        NAP_CHECK(fabsf(state->blockMod[(int)common::ModDest::Amp] + 0.5f * 100.0f / 127.0f) < eps);
+        NAP_CHECK(fabsf(state->blockMod[(int)common::ModDest::Resonance] - 32.0f / 127.0f) < eps);
+
+        state->cc[1] = 0.25f;
+        common::UpdateBlockMod(state);
+        NAP_CHECK(fabsf(state->blockMod[(int)common::ModDest::Pitch] - 0.25f) < eps);
+        NAP_CHECK(state->audioModDepth[(int)common::ModDest::Pitch] == 0.3f);
+        delete state;
+    }
+
+    NAP_UNITTEST(AudioRateKernels)
+    {
+        // The last case is the resonance route again through the SVF, which has to follow k every sample as well
+        const common::ModRoute tests[][3] = {
+            { { common::ModSource::AmpEnv, 0, common::ModDest::Amp, 1.0f } },
+            { { common::ModSource::LFO1, 0, common::ModDest::Resonance, 2.0f } },
+            { { common::ModSource::LFO2, 0, common::ModDest::Cutoff, 1.0f }, { common::ModSource::AmpEnv, 0, common::ModDest::Pitch, 0.5f }, { common::ModSource::LFO1, 0, common::ModDest::Amp, -0.5f } },
+            { { common::ModSource::LFO1, 0, common::ModDest::Resonance, 2.0f } }
+        };
+        const int numroutes[] = { 1, 1, 3, 1 };
+        const common::VoiceFilter filters[] = { common::VoiceFilter::Ladder, common::VoiceFilter::Ladder, common::VoiceFilter::Ladder, common::VoiceFilter::SVF };
+        const int numframes = 8192;
+        float* plain = new float[numframes];
+        float* output = new float[numframes];
+        float* reference = new float[numframes];
+        for (int t = 0; t < 4; t++)
+        {
+            common::ModMatrix m = MakeMatrix(tests[t], numroutes[t]);
+            NAP_CHECK(RenderNote(common::ModMatrix(), filters[t], plain, numframes));
+            NAP_CHECK(RenderNote(m, filters[t], output, numframes));
+            RenderNoteReference(m, filters[t], reference, numframes);
+            float maxerr = 0.0f, maxdiff = 0.0f;
+            for (int n = 0; n < numframes; n++)
+            {
+                maxerr = fmaxf(maxerr, fabsf(output[n] - reference[n]));
+                maxdiff = fmaxf(maxdiff, fabsf(output[n] - plain[n]));
+            }
+            NAP_CHECK(maxerr < 1.0e-4f);
+            NAP_CHECK(maxdiff > 0.01f);
+        }
+        delete[] plain;
+        delete[] output;
+        delete[] reference;
+    }
+
+    NAP_UNITTEST(MatrixValidation)
+    {
+        common::ProcessKernel kernel;
+        float depth[common::kNumModDests];
+
+        // Two audio-rate sources on one destination, unless one of them has no depth
+        common::ModRoute routes[] = {
+            { common::ModSource::LFO1, 0, common::ModDest::Cutoff, 1.0f },
+            { common::ModSource::AmpEnv, 0, common::ModDest::Cutoff, 0.5f }
+        };
+        NAP_CHECK(!common::CompileModMatrix(MakeMatrix(routes, 2), &kernel, depth));
+        routes[1].depth = 0.0f;
+        NAP_CHECK(common::CompileModMatrix(MakeMatrix(routes, 2), &kernel, depth));
+        NAP_CHECK(kernel == common::kKernelTable[1 << 2] && depth[(int)common::ModDest::Cutoff] == 1.0f);
+
+        // Block-rate sources can share a destination with an audio-rate one
+        routes[1].source = common::ModSource::CC;
+        routes[1].depth = 0.5f;
+        NAP_CHECK(common::CompileModMatrix(MakeMatrix(routes, 2), &kernel, depth));
+
+        routes[1].dest = common::ModDest::Count;
+        NAP_CHECK(!common::CompileModMatrix(MakeMatrix(routes, 2), &kernel, depth));
+        routes[1].dest = (common::ModDest)-1;
+        NAP_CHECK(!common::CompileModMatrix(MakeMatrix(routes, 2), &kernel, depth));
+        common::ModMatrix m = MakeMatrix(routes, 1);
+        m.numRoutes = common::kMaxModRoutes + 1;
+        NAP_CHECK(!common::CompileModMatrix(m, &kernel, depth));
+
+        // A rejected matrix leaves the installed one alone
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::InitStateData(*state, &queue, 44100);
+        common::ProcessKernel installed = state->kernel;
+        NAP_CHECK(!common::SetModMatrix(*state, MakeMatrix(routes, 2)));
+        NAP_CHECK(state->kernel == installed && state->modMatrix.numRoutes == 2 && state->modMatrix.routes[1].dest == common::ModDest::Cutoff);
+        delete state;
+    }
+
+    NAP_UNITTEST(LoadModMatrix)
+    {
+        TestEffect howdy(FindEffect("Demo HowdySynth"), 44100, 256);
+        NAP_CHECK(howdy.IsValid());
+        if (!howdy.IsValid())
+            return;
+        float buffer[256 * 2] = {};
+
+        const int sources[] = { (int)common::ModSource::LFO1, (int)common::ModSource::CC };
+        const int ccs[] = { 0, 74 };
+        const int dests[] = { (int)common::ModDest::Pitch, (int)common::ModDest::Cutoff };
+        const float depths[] = { 0.1f, 1.0f };
+        NAP_CHECK(LoadModMatrix(sources, ccs, dests, depths, 2));
+
+        // Refused until the audio thread has picked up the first one
+        NAP_CHECK(!LoadModMatrix(sources, ccs, dests, depths, 1));
+        howdy.Process(buffer, buffer, 256, 2);
+        NAP_CHECK(LoadModMatrix(sources, ccs, dests, depths, 1));
+        howdy.Process(buffer, buffer, 256, 2);
+
+        const int baddests[] = { (int)common::ModDest::Pitch, (int)common::ModDest::Pitch };
+        const int audiosources[] = { (int)common::ModSource::LFO1, (int)common::ModSource::LFO2 };
+        NAP_CHECK(!LoadModMatrix(audiosources, ccs, baddests, depths, 2));
+        const int outofrange[] = { (int)common::ModDest::Count, 0 };
+        NAP_CHECK(!LoadModMatrix(sources, ccs, outofrange, depths, 1));
+        NAP_CHECK(!LoadModMatrix(sources, ccs, dests, depths, common::kMaxModRoutes + 1));
+    }
+
+    NAP_UNITTEST(SilentSkip)
+    {
+        // One note released well before a second one; the voice closes in between and is skipped
+        const int samplerate = 44100, blocksize = 256, secondnote = 160 * blocksize, numframes = secondnote + 4096;
+        const common::ModRoute route = { common::ModSource::LFO1, 0, common::ModDest::Cutoff, 1.0f };
+        common::StateData* state = new common::StateData();
+        common::EventQueue queue(common::kEventQueueLength);
+        common::Event e;
+        e.type = common::EventType::NoteOn;
+        e.midiNote = 57;
+        queue.push(e);
+        e.type = common::EventType::NoteOff;
+        e.timeInTicks = 4410;
+        queue.push(e);
+        e.type = common::EventType::NoteOn;
+        e.midiNote = 64;
+        e.timeInTicks = secondnote;
+        queue.push(e);
+        common::InitStateData(*state, &queue, samplerate);
+        state->cutoffFreq = 1000.0f;
+        state->lfo1Freq = 5.3f;
+        common::SetModMatrix(*state, MakeMatrix(&route, 1));
+
+        float* output = new float[numframes];
+        int numsilent = 0;
+        bool silentcorrect = true, zeros = true;
+        for (int n = 0; n < secondnote; n += blocksize)
+        {
+            common::Process(state, output + n, 1, blocksize, samplerate);
+            // Only blocks that start after the release has run out are skipped
+            bool closed = n > 4410 + (int)(state->ampEnvReleaseTime * samplerate);
+            if (state->silent != closed)
+                silentcorrect = false;
+            if (state->silent)
+            {
+                numsilent++;
+                for (int i = 0; i < blocksize; i++)
+                    zeros = zeros && output[n + i] == 0.0f;
+            }
+        }
+        NAP_CHECK(silentcorrect && numsilent > 50 && zeros);
+        NAP_CHECK(state->tickTime == secondnote);
+
+        // A voice that never skipped would have run its LFO the whole time and starts the new note from the same place
+        common::StateData* reference = new common::StateData();
+        common::EventQueue referencequeue(common::kEventQueueLength);
+        e.timeInTicks = 0;
+        referencequeue.push(e);
+        common::InitStateData(*reference, &referencequeue, samplerate);
+        reference->cutoffFreq = state->cutoffFreq;
+        reference->lfo1Freq = state->lfo1Freq;
+        common::SetModMatrix(*reference, MakeMatrix(&route, 1));
+        for (int u = 0; u < common::kMaxUnison; u++)
+            reference->oscPhase[u] = state->oscPhase[u];
+        const float lfo1change = reference->lfo1Freq * 2 * common::kPi / samplerate, lfo2change = reference->lfo2Freq * 2 * common::kPi / samplerate;
+        for (int n = 0; n < secondnote; n++)
+        {
+            if (reference->lfo1Phase >= 2 * common::kPi)
+                reference->lfo1Phase -= 2 * common::kPi;
+            if (reference->lfo2Phase >= 2 * common::kPi)
+                reference->lfo2Phase -= 2 * common::kPi;
+            reference->lfo1Phase += lfo1change;
+            reference->lfo2Phase += lfo2change;
+        }
+
+        float* expected = new float[numframes - secondnote];
+        for (int n = secondnote; n < numframes; n += blocksize)
+        {
+            common::Process(state, output + n, 1, blocksize, samplerate);
+            common::Process(reference, expected + n - secondnote, 1, blocksize, samplerate);
+        }
+        NAP_CHECK(!state->silent);
+        float maxerr = 0.0f, peak = 0.0f;
+        for (int n = secondnote; n < numframes; n++)
+        {
+            maxerr = fmaxf(maxerr, fabsf(output[n] - expected[n - secondnote]));
+            peak = fmaxf(peak, fabsf(output[n]));
+        }
+        NAP_CHECK(maxerr < 1.0e-3f && peak > 0.05f);
+        delete[] expected;
+        delete[] output;
+        delete reference;
+        delete state;
+
+        // Howdy reports an idle voice through IsSilent
+        TestEffect howdy(FindEffect("Demo HowdySynth"), samplerate, blocksize);
+        NAP_CHECK(howdy.IsValid());
+        if (!howdy.IsValid())
+            return;
+        float buffer[blocksize * 2] = {}, silent = -1.0f;
+        howdy.Process(buffer, buffer, blocksize, 2);
+        howdy.GetBuffer("IsSilent", &silent, 1);
+        NAP_CHECK(silent == 1.0f);
+        NAP_CHECK(NoteOn(60, GetSynthTicks() + 10));
+        howdy.Process(buffer, buffer, blocksize, 2);
+        howdy.GetBuffer("IsSilent", &silent, 1);
+        NAP_CHECK(silent == 0.0f);
+        NAP_CHECK(NoteOff(60, GetSynthTicks()));
+    }
+
+    // Runs the amp envelope from a NoteOn, releasing it after holdticks, and compares every tick with the exponential
+    // segments it is built from: kSmallAmplitude up to 1 over the attack, 1 down to the sustain level over the decay, then
+    // from the level at the NoteOff down to kSmallAmplitude over the release, after which it closes
+    NAP_UNITTEST(AmpEnvelope)
+    {
+        const int attack = 441, decay = 2205, release = 4410;
+        const double small = common::kSmallAmplitude, sustain = 0.25;
+        const int holdticks[] = { attack + decay + 1000, attack / 2, attack + decay / 3 };
+        common::StateData* state = new common::StateData();
+        for (int h = 0; h < 3; h++)
+        {
+            state->ampEnvSustainLevel = (float)sustain;
+            state->ampEnvState = common::AdsrState::Opening;
+            state->ampEnvTicksSinceStart = 0;
+            int numwrong = 0;
+            double expected = small;
+            for (int n = 0; n < holdticks[h]; n++)
+            {
+                if (n < attack)
+                    expected = small * pow(1.0 / small, (double)n / attack);
+                else
+                    expected = pow(sustain, fmin(1.0, (double)(n - attack) / decay));
+                float value = common::NextAmpEnvValue(state, attack, decay, release);
+                if (fabs(value - expected) > 1.0e-4 * expected)
+                    numwrong++;
+                // The attack peaks exactly at its end and the decay lands exactly on the sustain level
+                if ((n == attack && value != 1.0f) || (n >= attack + decay && value != (float)sustain))
+                    numwrong++;
+            }
+            NAP_CHECK(numwrong == 0);
+
+            state->ampEnvState = common::AdsrState::Closing;
+            state->ampEnvTicksSinceStart = 0;
+            const double start = expected;
+            for (int n = 0; n <= release; n++)
+            {
+                float value = common::NextAmpEnvValue(state, attack, decay, release);
+                expected = start * pow(small / start, (double)n / release);
+                if (fabs(value - expected) > 1.0e-4 * expected)
+                    numwrong++;
+            }
+            NAP_CHECK(numwrong == 0);
+            NAP_CHECK(common::NextAmpEnvValue(state, attack, decay, release) == 0.0f);
+            NAP_CHECK(state->ampEnvState == common::AdsrState::Closed);
+            NAP_CHECK(common::NextAmpEnvValue(state, attack, decay, release) == 0.0f);
+        }
+        delete state;
+    }
+
+    NAP_BENCHMARK(AmpEnvelope)
+    {
+        const int attack = 441, decay = 4410, release = 22050, num = 4096;
+        common::StateData* state = new common::StateData();
+        state->ampEnvSustainLevel = 0.5f;
+        const char* names[] = { "attack", "decay", "sustain", "release" };
+        const int starts[] = { 0, attack, attack + decay, 0 };
+        for (int segment = 0; segment < 4; segment++)
+        {
+            double t = TimePerCall([&]()
+            {
+                state->ampEnvState = (segment == 3) ? common::AdsrState::Closing : common::AdsrState::Opening;
+                state->ampEnvTicksSinceStart = (segment == 2) ? attack + decay : starts[segment];
+                state->lastNoteOnAmpEnvValue = 0.5f;
+                float sum = 0.0f;
+                for (int n = 0; n < ((segment == 0) ? attack : num); n++)
+                    sum += common::NextAmpEnvValue(state, attack, decay, release);
+                gSink = sum;
+            });
+            printf("  %-8s %6.2f ns/tick\n", names[segment], t * 1.0e9 / ((segment == 0) ? attack : num));
+        }
+        delete state;
+    }
+
+    NAP_BENCHMARK(Process)
+    {
+        const int numframes = 44100;
+        float* buffer = new float[numframes];
+        const int settings[][3] = { { 0, 1, 1 }, { 1, 1, 1 }, { 0, 4, 1 }, { 0, 1, 4 }, { 1, 4, 4 } };
+        for (int n = 0; n < 5; n++)
+        {
+            common::VoiceConfig config;
+            config.filter = (common::VoiceFilter)settings[n][0];
+            config.oversampling = settings[n][1];
+            config.unison = settings[n][2];
+            double t = TimePerCall([&]() { gSink = RenderDemo(config, buffer, numframes); });
+            printf("  %s, %dx, %d unison: %6.2f ns/sample\n", (config.filter == common::VoiceFilter::Ladder) ? "ladder" : "svf", config.oversampling, config.unison, t * 1.0e9 / numframes);
+        }
+        delete[] buffer;
+    }
+}
+
+NAP_TESTSUITE(UnitySynth)
+{
+    // Parameter indices of Plugin_UnitySynth.cpp
+    enum { P_CUTOFF = 1, P_CUTENV = 2, P_DETUNE1 = 6, P_DETUNE2 = 7, P_RELEASE = 5, P_ARPMODE = 9, P_ARPTEMPO = 10, P_ARPRATE = 11, P_ARPGATE = 12, P_OSCILLATORS = 14 };
+    enum { ARP_OFF, ARP_UP, ARP_DOWN, ARP_RANDOM, ARP_CHORD };
+
+    static UnityAudioEffectDefinition* GetDefinition()
+    {
+        static UnityAudioEffectDefinition definition;
+        if (definition.create == NULL)
+            AudioPluginUtil::DeclareEffect(definition, "Demo UnitySynth", UnitySynth::CreateCallback, UnitySynth::ReleaseCallback, UnitySynth::ProcessCallback,
+                UnitySynth::SetFloatParameterCallback, UnitySynth::GetFloatParameterCallback, UnitySynth::GetFloatBufferCallback, UnitySynth::InternalRegisterEffectDefinition);
+        return &definition;
+    }
+
+    // One undetuned oscillator per voice and no release tail, so a voice sounds from its NoteOn up to and including the
+    // sample of its NoteOff and is exactly silent outside that
+    static void SetupPlainVoices(TestEffect& synth)
+    {
+        synth.SetParameter(P_DETUNE1, 0.0f);
+        synth.SetParameter(P_DETUNE2, 0.0f);
+        synth.SetParameter(P_RELEASE, 0.0f);
+        synth.SetParameter(P_OSCILLATORS, 1.0f);
+    }
+
+    static float Goertzel(const float* x, int stride, int length, float freq, int samplerate)
+    {
+        double w = 2.0 * M_PI * freq / samplerate, c = 2.0 * cos(w), s1 = 0.0, s2 = 0.0;
+        for (int n = 0; n < length; n++)
+        {
+            double s0 = x[n * stride] + c * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        return (float)sqrt(s1 * s1 + s2 * s2 - c * s1 * s2) / length;
+    }
+
+    NAP_UNITTEST(Arpeggiator)
+    {
+        // A major triad, held from sample 1000 at 120 bpm and four steps per beat: a step every 5512.5 samples, each held
+        // for half of that
+        const int samplerate = 44100, blocksize = 512, start = 1000, numframes = start + 12 * 5500;
+        const int keys[] = { 57, 61, 64 };
+        const float freqs[] = { 440.0f, 554.37f, 659.26f };
+        const double steplength = samplerate * 60.0 / (120.0 * 4.0);
+        const int gatelength = (int)(steplength * 0.5 + 0.5);
+        float* output = new float[numframes * 2];
+        float* silence = new float[numframes * 2];
+        memset(silence, 0, sizeof(float) * numframes * 2);
+        for (int mode = ARP_UP; mode <= ARP_CHORD; mode++)
+        {
+            TestEffect synth(GetDefinition(), samplerate, blocksize);
+            NAP_CHECK(synth.IsValid());
+            if (!synth.IsValid())
+                break;
+            SetupPlainVoices(synth);
+            synth.SetParameter(P_ARPMODE, (float)mode);
+            synth.SetParameter(P_ARPTEMPO, 120.0f);
+            synth.SetParameter(P_ARPRATE, 4.0f);
+            synth.SetParameter(P_ARPGATE, 0.5f);
+            for (int k = 0; k < 3; k++)
+                UnitySynth_AddMessage(start, 0x90 | (keys[k] << 8) | (100 << 16));
+            synth.Process(silence, output, numframes, 2);
+            for (int k = 0; k < 3; k++)
+                UnitySynth_AddMessage(0, 0x80 | (keys[k] << 8));
+            synth.Process(silence, silence, blocksize, 2);
+
+            // Sounding spans must sit exactly on the step grid and be as long as the gate
+            int numsteps = 0, numwrong = 0, notes[16], distinct = 0;
+            for (int n = 0; n < numframes; n++)
+            {
+                if (output[n * 2] == 0.0f || (n > 0 && output[n * 2 - 2] != 0.0f))
+                    continue;
+                int end = n;
+                while (end + 1 < numframes && output[end * 2 + 2] != 0.0f)
+                    end++;
+                int expected = (int)ceil(start + numsteps * steplength);
+                if (n != expected || end != n + gatelength)
+                    numwrong++;
+                float level[3];
+                int loudest = 0;
+                for (int k = 0; k < 3; k++)
+                {
+                    level[k] = Goertzel(output + n * 2, 2, end - n, freqs[k], samplerate);
+                    if (level[k] > level[loudest])
+                        loudest = k;
+                }
+                if (mode == ARP_CHORD)
+                {
+                    for (int k = 0; k < 3; k++)
+                        if (level[k] < 0.25f * level[loudest])
+                            numwrong++;
+                }
+                else if (numsteps < 16)
+                {
+                    notes[numsteps] = loudest;
+                    if (numsteps > 0 && notes[numsteps] != notes[numsteps - 1])
+                        distinct++;
+                    if (mode == ARP_UP && loudest != numsteps % 3)
+                        numwrong++;
+                    if (mode == ARP_DOWN && loudest != 2 - numsteps % 3)
+                        numwrong++;
+                }
+                numsteps++;
+            }
+            NAP_CHECK(numsteps == 12);
+            NAP_CHECK(numwrong == 0);
+            if (mode == ARP_RANDOM)
+                NAP_CHECK(distinct >= 3);
+        }
+        delete[] output;
+        delete[] silence;
+    }
+
+    NAP_UNITTEST(Release)
+    {
+        // After a NoteOff the voice falls by 80 dB over the release time, so 20 dB every quarter of it
+        const int samplerate = 44100, blocksize = 512, noteoff = 22050, window = 441;
+        const float releasetime = 1.0f;
+        const int numframes = noteoff + samplerate / 2 + window;
+        TestEffect synth(GetDefinition(), samplerate, blocksize);
+        NAP_CHECK(synth.IsValid());
+        if (!synth.IsValid())
+            return;
+        SetupPlainVoices(synth);
+        synth.SetParameter(P_CUTOFF, 0.99f); // Keep the filter and its envelope out of the level measurements
+        synth.SetParameter(P_CUTENV, 0.0f);
+        synth.SetParameter(P_RELEASE, releasetime);
+        float* output = new float[numframes * 2];
+        float* silence = new float[numframes * 2];
+        memset(silence, 0, sizeof(float) * numframes * 2);
+        UnitySynth_AddMessage(0, 0x90 | (57 << 8) | (127 << 16));
+        UnitySynth_AddMessage(noteoff, 0x80 | (57 << 8));
+        synth.Process(silence, output, numframes, 2);
+
+        // RMS level over a 10 ms window centered on each point, 10 ms before the NoteOff being the reference
+        double level[3];
+        const int centers[] = { noteoff - window, noteoff + (int)(0.25f * releasetime * samplerate), noteoff + (int)(0.5f * releasetime * samplerate) };
+        for (int c = 0; c < 3; c++)
+        {
+            double sum = 0.0;
+            for (int n = centers[c] - window / 2; n < centers[c] + window / 2; n++)
+                sum += output[n * 2] * output[n * 2];
+            level[c] = 10.0 * log10(sum / window + 1.0e-30);
+        }
+        NAP_CHECK(fabs(level[1] - level[0] + 20.0) < 1.5);
+        NAP_CHECK(fabs(level[2] - level[1] + 20.0) < 0.25);
+        delete[] output;
+        delete[] silence;
+    }
+
+    NAP_UNITTEST(DirectNoteOffWithArp)
+    {
+        // A key played with the arpeggiator off still gets its NoteOff after the arpeggiator is switched on
+        const int samplerate = 44100, blocksize = 256;
+        TestEffect synth(GetDefinition(), samplerate, blocksize);
+        NAP_CHECK(synth.IsValid());
+        if (!synth.IsValid())
+            return;
+        SetupPlainVoices(synth);
+        float buffer[blocksize * 2], input[blocksize * 2] = {};
+        UnitySynth_AddMessage(100, 0x90 | (57 << 8) | (100 << 16));
+        synth.Process(input, buffer, blocksize, 2);
+        synth.SetParameter(P_ARPMODE, (float)ARP_UP);
+        UnitySynth_AddMessage(blocksize + 100, 0x80 | (57 << 8));
+        synth.Process(input, buffer, blocksize, 2);
+        bool silentafter = true;
+        for (int n = 101; n < blocksize; n++)
+            silentafter = silentafter && buffer[n * 2] == 0.0f && buffer[n * 2 + 1] == 0.0f;
+        NAP_CHECK(buffer[200] != 0.0f && silentafter);
+        synth.Process(input, buffer, blocksize, 2);
+        float silent = 0.0f;
+        synth.GetBuffer("IsSilent", &silent, 1);
+        NAP_CHECK(silent == 1.0f);
+    }
+}
+
+NAP_TESTSUITE(MidiFile)
+{
+    NAP_UNITTEST(Playback)
+    {
+        // Format 1 at 96 ticks per quarter: a tempo track going from 120 to 240 bpm at tick 192, and a note track with
+        // running status, a NoteOn with zero velocity, sysex and program changes to skip, and a two note chord
+        static const unsigned char song[] = {
+            'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96,
+            'M', 'T', 'r', 'k', 0, 0, 0, 19,
+            0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+            0x81, 0x40, 0xFF, 0x51, 0x03, 0x03, 0xD0, 0x90,
+            0x00, 0xFF, 0x2F, 0x00,
+            'M', 'T', 'r', 'k', 0, 0, 0, 41,
+            0x00, 0x90, 60, 100,
+            0x60, 60, 0,
+            0x00, 0xF0, 0x02, 0x01, 0xF7,
+            0x60, 0x90, 62, 100,
+            0x00, 0xC0, 5,
+            0x60, 0x80, 62, 0,
+            0x00, 0x90, 64, 90,
+            0x00, 65, 90,
+            0x60, 0x80, 64, 0,
+            0x00, 65, 0,
+            0x00, 0xFF, 0x2F, 0x00
+        };
+        const char* path = "tests_midifile.mid";
+        FILE* f = fopen(path, "wb");
+        NAP_CHECK(f != NULL);
+        if (f == NULL)
+            return;
+        fwrite(song, 1, sizeof(song), f);
+        fclose(f);
+
+        common::MidiPlayer player;
+        bool opened = common::OpenMidiFile(player, path, 48000);
+        remove(path);
+        NAP_CHECK(opened);
+        if (!opened)
+            return;
+        NAP_CHECK(player.format == 1 && player.tracks.size() == 2);
+
+        // The NoteOff of 64 is dropped because 65 replaced it
+        const struct { common::EventType type; int time, note; } expected[] = {
+            { common::EventType::NoteOn, 0, 60 },
+            { common::EventType::NoteOff, 24000, 60 },
+            { common::EventType::NoteOn, 48000, 62 },
+            { common::EventType::NoteOff, 60000, 62 },
+            { common::EventType::NoteOn, 60000, 64 },
+            { common::EventType::NoteOn, 60000, 65 },
+            { common::EventType::NoteOff, 72000, 65 }
+        };
+        const int numexpected = sizeof(expected) / sizeof(expected[0]);
+
+        // A queue smaller than the song is topped up as it drains, without losing or reordering anything
+        common::EventQueue queue(3);
+        int numreceived = 0;
+        while (common::FeedEventQueue(player, &queue) > 0 || queue.front() != nullptr)
+        {
+            const common::Event* e = queue.front();
+            NAP_CHECK(numreceived < numexpected);
+            if (numreceived < numexpected)
+            {
+                NAP_CHECK(e->type == expected[numreceived].type);
+                NAP_CHECK(e->timeInTicks == expected[numreceived].time);
+                NAP_CHECK(e->midiNote == expected[numreceived].note);
+            }
+            numreceived++;
+            queue.pop();
+        }
+        NAP_CHECK(numreceived == numexpected);
+        NAP_CHECK(common::IsMidiFileFinished(player) && player.numEventsFed == numexpected);
+        common::CloseMidiFile(player);
+
+        NAP_CHECK(!common::OpenMidiFile(player, "tests_nonexistent.mid", 48000));
+    }
+}
+
+NAP_TESTSUITE(RingBuffer)
+{
+    NAP_UNITTEST(FIFO)
+    {
+        static AudioPluginUtil::RingBuffer<16, int> ring;
+        ring.Clear();
+        int val, next = 0;
+        for (int round = 0; round < 10; round++)
+        {
+            for (int n = 0; n < 10; n++)
+                ring.Feed(round * 10 + n);
+            NAP_CHECK(ring.GetNumBuffered() == 10);
+            while (ring.Read(val))
+                NAP_CHECK(val == next++);
+            NAP_CHECK(ring.GetNumBuffered() == 0);
+        }
+    }
+
+    NAP_BENCHMARK(FeedAndRead)
+    {
+        // Writes and then reads back a host block at a time, so the cost is per sample passing through the ring
+        const int blocksize = 256, capacity = 4096;
+        float block[blocksize];
+        for (int n = 0; n < blocksize; n++)
+            block[n] = (float)n;
+
+        static AudioPluginUtil::RingBuffer<capacity, float> ring;
+        ring.Clear();
+        double t = TimePerCall([&]()
+        {
+            for (int n = 0; n < blocksize; n++)
+                ring.Feed(block[n]);
+            float val, sum = 0.0f;
+            while (ring.Read(val))
+                sum += val;
+            gSink = sum;
+        });
+        printf("  RingBuffer: %6.2f ns/sample\n", t * 1.0e9 / blocksize);
+
+        float* storage = new float[capacity];
+        AudioPluginUtil::StreamRing stream;
+        stream.Init(storage, capacity);
+        t = TimePerCall([&]()
+        {
+            stream.Write(block, blocksize);
+            const float* data;
+            float sum = 0.0f;
+            for (int num; (num = stream.GetReadable(data)) > 0; stream.Consume(num))
+                for (int n = 0; n < num; n++)
+                    sum += data[n];
+            gSink = sum;
+        });
+        printf("  StreamRing: %6.2f ns/sample\n", t * 1.0e9 / blocksize);
+        NAP_CHECK(stream.GetNumDropped() == 0);
+        delete[] storage;
+    }
+}
+
+static bool MatchesFilter(const TestCase& t, const char* filter)
+{
+    return filter == NULL || strstr(t.suite, filter) != NULL || strstr(t.name, filter) != NULL;
+}
+
+int main(int argc, char** argv)
+{
+    bool benchmarks = false;
+    const char* filter = NULL;
+    for (int n = 1; n < argc; n++)
+    {
+        if (strcmp(argv[n], "-b") == 0)
+            benchmarks = true;
+        else
+            filter = argv[n];
+    }
+
+    int numrun = 0;
+    for (const TestCase& t : GetTests())
+    {
+        if (!MatchesFilter(t, filter))
+            continue;
+        int failures = gNumFailures;
+        printf("[test] %s.%s\n", t.suite, t.name);
+        t.func(t.name);
+        if (gNumFailures != failures)
+            printf("[FAILED] %s.%s\n", t.suite, t.name);
+        numrun++;
+    }
+
+    if (benchmarks)
+    {
+        for (const TestCase& t : GetBenchmarks())
+        {
+            if (!MatchesFilter(t, filter))
+                continue;
+            printf("[bench] %s.%s\n", t.suite, t.name);
+            t.func(t.name);
+        }
+    }
+
+    printf("%d tests run, %d checks failed\n", numrun, gNumFailures);
+    return (gNumFailures == 0) ? 0 : 1;
+}
@@ -6,7 +6,7 @@
 //DECLARE_EFFECT("Demo ModalFilter", ModalFilter)
 //DECLARE_EFFECT("Demo Multiband", Multiband)
 //DECLARE_EFFECT("Demo NoiseBox", NoiseBox)
-//DECLARE_EFFECT("Demo PitchDetector", PitchDetector)
+DECLARE_EFFECT("Demo PitchDetector", PitchDetector)
 //DECLARE_EFFECT("Demo RingModulator", RingModulator)
 //DECLARE_EFFECT("Demo StereoWidener", StereoWidener)
 // DECLARE_EFFECT("Demo TeeBee3o3", TeeBee)
@@ -15,10 +15,10 @@ DECLARE_EFFECT("Demo HowdySynth", Howdy)
 //DECLARE_EFFECT("Demo TubeResonator", TubeResonator)
 //DECLARE_EFFECT("Demo Vocoder", Vocoder)
 //DECLARE_EFFECT("Demo WahWah", WahWah)
-//DECLARE_EFFECT("Demo ConvolutionReverb", ConvolutionReverb)
+DECLARE_EFFECT("Demo ConvolutionReverb", ConvolutionReverb)
 //DECLARE_EFFECT("Demo CorrelationMeter", CorrelationMeter)
 //DECLARE_EFFECT("Demo Granulator", Granulator)
-//DECLARE_EFFECT("Demo LoudnessMeter", LoudnessMeter)
+DECLARE_EFFECT("Demo LoudnessMeter", LoudnessMeter)
 //DECLARE_EFFECT("Demo Oscilloscope", Oscilloscope)
 //DECLARE_EFFECT("Demo Routing", Routing)
 //DECLARE_EFFECT("Demo Spatializer", Spatializer)
@@ -0,0 +1,642 @@
+#include "AudioPluginUtil.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace ConvolutionReverb
+{
+    enum Param
+    {
+        P_WET,
+        P_DRY,
+        P_NUM
+    };
+
+    const int MAXCHANNELS = 2;
+    const int HEADSIZE = 64;      // Length of the direct-form head, also the block size of the first partition stage
+    const int STAGEGROWTH = 16;   // Block size ratio between consecutive partition stages
+    const int MAXSTAGES = 4;      // The last stage covers whatever is left of the impulse response
+    const int IDLEPOLLS = 64;     // Polls without any job before the worker falls back to the long sleep
+
+    // A uniformly partitioned section of the impulse response.
+    // Stage 0 starts right after the direct-form head and is processed on the audio thread as soon as a block is complete.
+    // Later stages start at twice their block size, which leaves the worker thread a whole block period to deliver each
+    // output block before the audio thread needs it. Output rings are indexed by sample time and only written by the
+    // thread that runs the stage, in regions the audio thread is not reading yet.
+    // Job j of a background stage has its input in slot j & 1. slotjob and slotdone hold one more than the job last put
+    // into and last finished from each slot; the slot belongs to the worker while they differ.
+    struct Stage
+    {
+        int blocksize;
+        int offset;
+        int ringmask;
+        bool background;
+        AudioPluginUtil::UniformConvolver conv[MAXCHANNELS];
+        float* input[MAXCHANNELS];
+        float* jobinput[2][MAXCHANNELS];
+        float* output[MAXCHANNELS];
+        float* temp;
+        UInt64 lastlate;
+        std::atomic<UInt64> slotjob[2];
+        std::atomic<UInt64> slotdone[2];
+    };
+
+    class Engine
+    {
+    public:
+        Engine(const float* ir, int irchannels, int irlength);
+        ~Engine();
+
+    public:
+        void Process(const float* inbuffer, float* outbuffer, int length, int numchannels, float wet, float dry);
+        inline int GetLateBlocks() const { return lateblocks.load(std::memory_order_relaxed); }
+        inline void Stop() { stopped.store(true, std::memory_order_release); } // The worker ignores this engine from now on
+
+    protected:
+        void ProcessChunk(float x[MAXCHANNELS][HEADSIZE], float y[MAXCHANNELS][HEADSIZE], int numchannels, int length);
+        void RunJob(Stage& stage, UInt64 job);
+        bool RunBackgroundJob(int s);
+        static void AddToWorker(Engine* engine);
+        static void RemoveFromWorker(Engine* engine);
+        static void WorkerThread();
+
+    protected:
+        int numstages;
+        Stage stages[MAXSTAGES];
+        float head[MAXCHANNELS][HEADSIZE];        // First HEADSIZE taps in reverse order
+        float history[MAXCHANNELS][2 * HEADSIZE]; // Every input sample is written twice so the last HEADSIZE are contiguous
+        UInt64 time;
+        std::atomic<int> lateblocks;
+        std::atomic<bool> stopped;
+        Engine* nextworkerengine;
+
+        // One worker thread serves the background stages of all engines, so its cost doesn't grow with the number of
+        // instances. workermutex guards the engine list and is held while a job runs, which lets RemoveFromWorker wait
+        // for a job on the engine being deleted. workerlifemutex serializes starting and joining the thread.
+        static AudioPluginUtil::Mutex workermutex;
+        static AudioPluginUtil::Mutex workerlifemutex;
+        static Engine* workerengines;
+        static std::atomic<bool> workerquit;
+        static std::thread worker;
+    };
+
+    AudioPluginUtil::Mutex Engine::workermutex;
+    AudioPluginUtil::Mutex Engine::workerlifemutex;
+    Engine* Engine::workerengines = NULL;
+    std::atomic<bool> Engine::workerquit(false);
+    std::thread Engine::worker;
+
+    Engine::Engine(const float* ir, int irchannels, int irlength)
+        : numstages(0)
+        , time(0)
+        , lateblocks(0)
+        , stopped(false)
+        , nextworkerengine(NULL)
+    {
+        memset(history, 0, sizeof(history));
+        for (int c = 0; c < MAXCHANNELS; c++)
+            for (int n = 0; n < HEADSIZE; n++)
+                head[c][HEADSIZE - 1 - n] = (n < irlength) ? ir[n * irchannels + c % irchannels] : 0.0f;
+
+        float* segment = new float[irlength];
+        int blocksize = HEADSIZE, offset = HEADSIZE;
+        while (offset < irlength && numstages < MAXSTAGES)
+        {
+            Stage& stage = stages[numstages];
+            int end = (numstages == MAXSTAGES - 1) ? irlength : 2 * blocksize * STAGEGROWTH;
+            if (end > irlength)
+                end = irlength;
+
+            int ringsize = 1;
+            while (ringsize < offset + blocksize)
+                ringsize *= 2;
+
+            stage.blocksize = blocksize;
+            stage.offset = offset;
+            stage.ringmask = ringsize - 1;
+            stage.background = numstages > 0;
+            stage.temp = new float[blocksize];
+            stage.lastlate = (UInt64)-1;
+            for (int i = 0; i < 2; i++)
+            {
+                stage.slotjob[i] = 0;
+                stage.slotdone[i] = 0;
+            }
+            for (int c = 0; c < MAXCHANNELS; c++)
+            {
+                for (int n = offset; n < end; n++)
+                    segment[n - offset] = ir[n * irchannels + c % irchannels];
+                stage.conv[c].Init(segment, end - offset, blocksize);
+                stage.input[c] = new float[blocksize];
+                stage.jobinput[0][c] = new float[blocksize];
+                stage.jobinput[1][c] = new float[blocksize];
+                stage.output[c] = new float[ringsize];
+                memset(stage.output[c], 0, sizeof(float) * ringsize);
+            }
+
+            numstages++;
+            offset = end;
+            blocksize *= STAGEGROWTH;
+        }
+        delete[] segment;
+
+        if (numstages > 1)
+            AddToWorker(this);
+    }
+
+    Engine::~Engine()
+    {
+        if (numstages > 1)
+            RemoveFromWorker(this);
+        for (int s = 0; s < numstages; s++)
+        {
+            Stage& stage = stages[s];
+            delete[] stage.temp;
+            for (int c = 0; c < MAXCHANNELS; c++)
+            {
+                delete[] stage.input[c];
+                delete[] stage.jobinput[0][c];
+                delete[] stage.jobinput[1][c];
+                delete[] stage.output[c];
+            }
+        }
+    }
+
+    void Engine::RunJob(Stage& stage, UInt64 job)
+    {
+        float* const* input = (stage.background) ? stage.jobinput[job & 1] : stage.input;
+        UInt64 writepos = job * stage.blocksize + stage.offset;
+        for (int c = 0; c < MAXCHANNELS; c++)
+        {
+            stage.conv[c].ProcessBlock(input[c], stage.temp);
+            float* output = stage.output[c];
+            for (int n = 0; n < stage.blocksize; n++)
+                output[(writepos + n) & stage.ringmask] = stage.temp[n];
+        }
+    }
+
+    // Runs the oldest job waiting in either input slot of a background stage, if there is one
+    bool Engine::RunBackgroundJob(int s)
+    {
+        Stage& stage = stages[s];
+        int slot = -1;
+        UInt64 job = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            UInt64 j = stage.slotjob[i].load(std::memory_order_acquire);
+            if (j != stage.slotdone[i].load(std::memory_order_relaxed) && (slot < 0 || j < job))
+            {
+                slot = i;
+                job = j;
+            }
+        }
+        if (slot < 0)
+            return false;
+        RunJob(stage, job - 1);
+        stage.slotdone[slot].store(job, std::memory_order_release);
+        return true;
+    }
+
+    void Engine::AddToWorker(Engine* engine)
+    {
+        AudioPluginUtil::MutexScopeLock lifelock(workerlifemutex);
+        {
+            AudioPluginUtil::MutexScopeLock lock(workermutex);
+            engine->nextworkerengine = workerengines;
+            workerengines = engine;
+        }
+        if (!worker.joinable())
+        {
+            workerquit.store(false);
+            worker = std::thread(&Engine::WorkerThread);
+        }
+    }
+
+    void Engine::RemoveFromWorker(Engine* engine)
+    {
+        AudioPluginUtil::MutexScopeLock lifelock(workerlifemutex);
+        bool empty;
+        {
+            AudioPluginUtil::MutexScopeLock lock(workermutex);
+            Engine** link = &workerengines;
+            while (*link != engine)
+                link = &(*link)->nextworkerengine;
+            *link = engine->nextworkerengine;
+            empty = workerengines == NULL;
+        }
+        if (empty)
+        {
+            workerquit.store(true);
+            worker.join();
+        }
+    }
+
+    void Engine::WorkerThread()
+    {
+        AudioPluginUtil::DenormalGuard denormalguard; // The late stages' tails decay on this thread
+        int idlepolls = 0;
+        while (!workerquit.load(std::memory_order_acquire))
+        {
+            // Always serve the smallest stage with pending work first since it has the closest deadline
+            bool busy = false;
+            {
+                AudioPluginUtil::MutexScopeLock lock(workermutex);
+                for (int s = 1; s < MAXSTAGES && !busy; s++)
+                    for (Engine* e = workerengines; e != NULL && !busy; e = e->nextworkerengine)
+                        busy = s < e->numstages && !e->stopped.load(std::memory_order_acquire) && e->RunBackgroundJob(s);
+            }
+            if (busy)
+            {
+                idlepolls = 0;
+                continue;
+            }
+
+            // Polled rather than signalled so the audio thread never enters the kernel. While any instance is playing,
+            // jobs arrive at least every 1024 samples and the short sleep is far below that deadline. Once nothing has
+            // come in for IDLEPOLLS polls the worker sleeps longer, still well within a 1024 sample block.
+            if (++idlepolls < IDLEPOLLS)
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            else
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    void Engine::ProcessChunk(float x[MAXCHANNELS][HEADSIZE], float y[MAXCHANNELS][HEADSIZE], int numchannels, int length)
+    {
+        for (int c = 0; c < numchannels; c++)
+        {
+            float* h = history[c];
+            for (int n = 0; n < length; n++)
+            {
+                int p = (int)((time + n) & (HEADSIZE - 1));
+                h[p] = h[p + HEADSIZE] = x[c][n];
+                const float* window = h + p + 1;
+                float sum = 0.0f;
+                for (int k = 0; k < HEADSIZE; k++)
+                    sum += head[c][k] * window[k];
+                y[c][n] = sum;
+            }
+        }
+
+        // Chunks never cross a HEADSIZE boundary and all stage offsets and block sizes are multiples of HEADSIZE,
+        // so every chunk falls inside a single block of each stage
+        for (int s = 0; s < numstages; s++)
+        {
+            Stage& stage = stages[s];
+            if (time < (UInt64)stage.offset)
+                continue;
+            UInt64 block = (time - stage.offset) / stage.blocksize;
+            if (stage.background && stage.slotdone[block & 1].load(std::memory_order_acquire) != block + 1)
+            {
+                if (stage.lastlate != block)
+                {
+                    stage.lastlate = block;
+                    lateblocks.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            }
+            for (int c = 0; c < numchannels; c++)
+            {
+                const float* output = stage.output[c];
+                for (int n = 0; n < length; n++)
+                    y[c][n] += output[(time + n) & stage.ringmask];
+            }
+        }
+
+        for (int s = 0; s < numstages; s++)
+        {
+            Stage& stage = stages[s];
+            int pos = (int)(time & (stage.blocksize - 1));
+            for (int c = 0; c < MAXCHANNELS; c++)
+            {
+                if (c < numchannels)
+                    memcpy(stage.input[c] + pos, x[c], sizeof(float) * length);
+                else
+                    memset(stage.input[c] + pos, 0, sizeof(float) * length);
+            }
+        }
+
+        time += length;
+
+        for (int s = 0; s < numstages; s++)
+        {
+            Stage& stage = stages[s];
+            if ((time & (stage.blocksize - 1)) != 0)
+                continue;
+            UInt64 job = time / stage.blocksize - 1;
+            if (!stage.background)
+            {
+                RunJob(stage, job);
+                continue;
+            }
+            // The worker still owning this slot means it is more than a block behind. The job is dropped rather than
+            // overwriting input the worker may be reading, and its output block counts as late once it comes due.
+            int slot = (int)(job & 1);
+            if (stage.slotjob[slot].load(std::memory_order_relaxed) != stage.slotdone[slot].load(std::memory_order_acquire))
+                continue;
+            for (int c = 0; c < MAXCHANNELS; c++)
+                memcpy(stage.jobinput[slot][c], stage.input[c], sizeof(float) * stage.blocksize);
+            stage.slotjob[slot].store(job + 1, std::memory_order_release);
+        }
+    }
+
+    void Engine::Process(const float* inbuffer, float* outbuffer, int length, int numchannels, float wet, float dry)
+    {
+        float x[MAXCHANNELS][HEADSIZE];
+        float y[MAXCHANNELS][HEADSIZE];
+        int convchannels = (numchannels < MAXCHANNELS) ? numchannels : MAXCHANNELS;
+        int done = 0;
+        while (done < length)
+        {
+            int chunk = HEADSIZE - (int)(time & (HEADSIZE - 1));
+            if (chunk > length - done)
+                chunk = length - done;
+
+            const float* src = inbuffer + done * numchannels;
+            for (int c = 0; c < convchannels; c++)
+                for (int n = 0; n < chunk; n++)
+                    x[c][n] = src[n * numchannels + c];
+
+            ProcessChunk(x, y, convchannels, chunk);
+
+            float* dst = outbuffer + done * numchannels;
+            for (int n = 0; n < chunk; n++)
+                for (int c = 0; c < numchannels; c++)
+                    dst[n * numchannels + c] = src[n * numchannels + c] * dry + ((c < convchannels) ? y[c][n] * wet : 0.0f);
+
+            done += chunk;
+        }
+    }
+
+    struct EffectData
+    {
+        float p[P_NUM];
+        float samplerate;
+        Engine* active;                 // Owned by the audio thread
+        std::atomic<Engine*> pending;   // Built by the loading thread, picked up at the start of the next block
+        AudioPluginUtil::DeferredFreeQueue<2> retired; // Swapped out and stopped by the audio thread, deleted under irmutex
+        std::atomic<int> lateblocks;    // Late blocks of the active engine, published by the audio thread after each block
+        EffectData* next;
+    };
+
+    // The loaded impulse response (interleaved) and the list of live instances, both guarded by irmutex
+    static AudioPluginUtil::Mutex irmutex;
+    static float* irdata = NULL;
+    static int irchannels = 0;
+    static int irlength = 0;
+    static float irsamplerate = 0.0f;
+    static EffectData* instances = NULL;
+
+    static int ReadLE(const unsigned char* p, int numbytes)
+    {
+        int value = 0;
+        for (int n = 0; n < numbytes; n++)
+            value |= p[n] << (8 * n);
+        return value;
+    }
+
+    // Reads a PCM (16, 24 or 32 bit) or 32 bit float WAV file into a newly allocated interleaved float buffer
+    static bool LoadWav(const char* path, float*& data, int& numchannels, int& numsamples, float& samplerate)
+    {
+        FILE* f = fopen(path, "rb");
+        if (f == NULL)
+            return false;
+        fseek(f, 0, SEEK_END);
+        long filesize = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (filesize < 12)
+        {
+            fclose(f);
+            return false;
+        }
+        unsigned char* file = new unsigned char[filesize];
+        bool ok = fread(file, 1, filesize, f) == (size_t)filesize;
+        fclose(f);
+        if (!ok || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0)
+        {
+            delete[] file;
+            return false;
+        }
+
+        int format = 0, bits = 0;
+        numchannels = 0;
+        numsamples = 0;
+        samplerate = 0.0f;
+        data = NULL;
+        long pos = 12;
+        while (pos + 8 <= filesize)
+        {
+            const unsigned char* chunk = file + pos;
+            long chunksize = (UInt32)ReadLE(chunk + 4, 4);
+            const unsigned char* body = chunk + 8;
+            if (chunksize > filesize - pos - 8)
+                chunksize = filesize - pos - 8;
+            if (memcmp(chunk, "fmt ", 4) == 0 && chunksize >= 16)
+            {
+                format = ReadLE(body, 2);
+                numchannels = ReadLE(body + 2, 2);
+                samplerate = (float)ReadLE(body + 4, 4);
+                bits = ReadLE(body + 14, 2);
+                if (format == 0xFFFE && chunksize >= 26)
+                    format = ReadLE(body + 24, 2); // WAVE_FORMAT_EXTENSIBLE stores the actual format in the sub-format GUID
+            }
+            else if (memcmp(chunk, "data", 4) == 0 && numchannels > 0)
+            {
+                int bytes = bits / 8;
+                bool supported = (format == 1 && (bits == 16 || bits == 24 || bits == 32)) || (format == 3 && bits == 32);
+                numsamples = supported ? (int)(chunksize / (bytes * numchannels)) : 0;
+                if (numsamples <= 0 || samplerate <= 0.0f)
+                    break;
+                data = new float[numsamples * numchannels];
+                for (int n = 0; n < numsamples * numchannels; n++)
+                {
+                    const unsigned char* s = body + n * bytes;
+                    if (format == 3)
+                        memcpy(&data[n], s, sizeof(float));
+                    else if (bits == 16)
+                        data[n] = (short)ReadLE(s, 2) * (1.0f / 32768.0f);
+                    else if (bits == 24)
+                        data[n] = ((ReadLE(s, 3) << 8) >> 8) * (1.0f / 8388608.0f);
+                    else
+                        data[n] = ReadLE(s, 4) * (1.0f / 2147483648.0f);
+                }
+                break;
+            }
+            pos += 8 + chunksize + (chunksize & 1);
+        }
+
+        delete[] file;
+        return data != NULL;
+    }
+
+    // Builds an engine for the loaded impulse response resampled to the given rate. Caller must hold irmutex.
+    static Engine* CreateEngine(float samplerate)
+    {
+        if (irdata == NULL)
+            return NULL;
+        if (irsamplerate == samplerate)
+            return new Engine(irdata, irchannels, irlength);
+
+        double step = (double)irsamplerate / (double)samplerate;
+        int length = (int)(irlength / step);
+        if (length < 1)
+            length = 1;
+        float* resampled = new float[length * irchannels];
+        for (int n = 0; n < length; n++)
+        {
+            double t = n * step;
+            int i = (int)t;
+            float f = (float)(t - i);
+            int j = (i + 1 < irlength) ? i + 1 : irlength - 1;
+            for (int c = 0; c < irchannels; c++)
+                resampled[n * irchannels + c] = irdata[i * irchannels + c] + (irdata[j * irchannels + c] - irdata[i * irchannels + c]) * f;
+        }
+        Engine* engine = new Engine(resampled, irchannels, length);
+        delete[] resampled;
+        return engine;
+    }
+
+    // Deletes the engines an instance's audio thread has swapped out. Game thread callbacks poll this so retired engines
+    // are freed without waiting for the next load; if a load holds irmutex it collects them itself.
+    static void CollectRetired(EffectData* data)
+    {
+        AudioPluginUtil::TryScopeLock<AudioPluginUtil::Mutex> lock(irmutex);
+        if (lock.IsLocked())
+            data->retired.Collect();
+    }
+
+    // Hands a new engine to an instance. Caller must hold irmutex.
+    static void SubmitEngine(EffectData* data, Engine* engine)
+    {
+        data->retired.Collect();
+        // An engine still pending here was never seen by the audio thread
+        delete data->pending.exchange(engine);
+    }
+
+    extern "C" UNITY_AUDIODSP_EXPORT_API bool ConvolutionReverb_LoadImpulseResponse(const char* path)
+    {
+        float* data;
+        int numchannels, numsamples;
+        float samplerate;
+        if (!LoadWav(path, data, numchannels, numsamples, samplerate))
+            return false;
+
+        AudioPluginUtil::MutexScopeLock lock(irmutex);
+        delete[] irdata;
+        irdata = data;
+        irchannels = numchannels;
+        irlength = numsamples;
+        irsamplerate = samplerate;
+        for (EffectData* d = instances; d != NULL; d = d->next)
+            SubmitEngine(d, CreateEngine(d->samplerate));
+        return true;
+    }
+
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+    {
+        int numparams = P_NUM;
+        definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+        AudioPluginUtil::RegisterParameter(definition, "Wet", "%", 0.0f, 100.0f, 30.0f, 1.0f, 1.0f, P_WET, "Level of the convolved signal");
+        AudioPluginUtil::RegisterParameter(definition, "Dry", "%", 0.0f, 100.0f, 100.0f, 1.0f, 1.0f, P_DRY, "Level of the input signal");
+        return numparams;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = new EffectData();
+        data->samplerate = (float)state->samplerate;
+        data->active = NULL;
+        data->pending = NULL;
+        data->lateblocks = 0;
+        AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+        state->effectdata = data;
+
+        AudioPluginUtil::MutexScopeLock lock(irmutex);
+        data->active = CreateEngine(data->samplerate);
+        data->next = instances;
+        instances = data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        {
+            AudioPluginUtil::MutexScopeLock lock(irmutex);
+            EffectData** link = &instances;
+            while (*link != data)
+                link = &(*link)->next;
+            *link = data->next;
+        }
+        delete data->active;
+        delete data->pending.load();
+        data->retired.Collect();
+        delete data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        data->p[index] = value;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        CollectRetired(data);
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (value != NULL)
+            *value = data->p[index];
+        if (valuestr != NULL)
+            valuestr[0] = 0;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        CollectRetired(data);
+        if (strcmp(name, "LateBlocks") == 0 && numsamples > 0)
+            buffer[0] = (float)data->lateblocks.load(std::memory_order_relaxed);
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+    {
+        AudioPluginUtil::DenormalGuard denormalguard;
+        AudioPluginUtil::RealtimeScope realtimescope;
+        EffectData* data = state->GetEffectData<EffectData>();
+
+        // Swap in a freshly loaded engine as long as there is room to retire the previous one
+        if (data->pending.load(std::memory_order_acquire) != NULL && !data->retired.IsFull())
+        {
+            Engine* engine = data->pending.exchange(NULL);
+            if (engine != NULL)
+            {
+                if (data->active != NULL)
+                    data->active->Stop();
+                data->retired.Retire(data->active);
+                data->active = engine;
+            }
+        }
+
+        float wet = data->p[P_WET] * 0.01f;
+        float dry = data->p[P_DRY] * 0.01f;
+        if (data->active == NULL)
+        {
+            for (unsigned int n = 0; n < length * outchannels; n++)
+                outbuffer[n] = inbuffer[n] * dry;
+            return UNITY_AUDIODSP_OK;
+        }
+
+        data->active->Process(inbuffer, outbuffer, length, outchannels, wet, dry);
+        data->lateblocks.store(data->active->GetLateBlocks(), std::memory_order_relaxed);
+        return UNITY_AUDIODSP_OK;
+    }
+}
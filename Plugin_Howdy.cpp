@@ -1,11 +1,18 @@
 #include "AudioPluginUtil.h"
 #include "synth_common.h"
 
+#include <atomic>
+
 namespace
 {
     common::EventQueue gEventQueue(common::kEventQueueLength);
     // TODO: THIS IS PROBABLY HORRIBLY UNSAFE
     int* gSynthTicks = nullptr;
+
+    // Mod matrix staged by LoadModMatrix and picked up by the audio thread at
+    // the start of the next block.
+    common::ModMatrix gPendingModMatrix;
+    std::atomic<bool> gModMatrixPending(false);
 }
 
 extern "C" bool NoteOn(int midiNum, int ticksUntilEvent) {
@@ -24,6 +31,61 @@ extern "C" bool NoteOff(int midiNum, int ticksUntilEvent) {
     return gEventQueue.try_push(e);
 }
 
+extern "C" bool NoteOnWithVelocity(int midiNum, int velocity, int ticksUntilEvent) {
+    common::Event e;
+    e.type = common::EventType::NoteOn;
+    e.midiNote = midiNum;
+    e.value = velocity;
+    e.timeInTicks = ticksUntilEvent;
+    return gEventQueue.try_push(e);
+}
+
+extern "C" bool ControlChange(int controller, int value, int ticksUntilEvent) {
+    common::Event e;
+    e.type = common::EventType::ControlChange;
+    e.midiNote = controller;
+    e.value = value;
+    e.timeInTicks = ticksUntilEvent;
+    return gEventQueue.try_push(e);
+}
+
+extern "C" bool Aftertouch(int value, int ticksUntilEvent) {
+    common::Event e;
+    e.type = common::EventType::Aftertouch;
+    e.value = value;
+    e.timeInTicks = ticksUntilEvent;
+    return gEventQueue.try_push(e);
+}
+
+// Loads a modulation routing. Arrays are parallel with numRoutes entries;
+// sources and dests are common::ModSource/common::ModDest values. Returns
+// false if the routing is invalid or the previous one hasn't been picked up by
+// the audio thread yet.
+extern "C" bool LoadModMatrix(int const* sources, int const* ccs, int const* dests, float const* depths, int numRoutes) {
+    if (gModMatrixPending.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (numRoutes < 0 || numRoutes > common::kMaxModRoutes) {
+        return false;
+    }
+    common::ModMatrix m;
+    for (int i = 0; i < numRoutes; ++i) {
+        m.routes[i].source = (common::ModSource)sources[i];
+        m.routes[i].cc = ccs[i];
+        m.routes[i].dest = (common::ModDest)dests[i];
+        m.routes[i].depth = depths[i];
+    }
+    m.numRoutes = numRoutes;
+    common::ProcessKernel kernel;
+    float depth[common::kNumModDests];
+    if (!common::CompileModMatrix(m, &kernel, depth)) {
+        return false;
+    }
+    gPendingModMatrix = m;
+    gModMatrixPending.store(true, std::memory_order_release);
+    return true;
+}
+
 extern "C" int GetSynthTicks() {
     return *gSynthTicks;
 }
@@ -34,12 +96,21 @@ namespace Howdy {
     {
         P_FREQ,
         P_INPUTMIX,
+        P_NOISELEVEL,
+        P_NOISEFILTER,
+        P_NOISECOLOR,
+        P_OSCILLATOR,
+        P_FILTER,
+        P_OVERSAMPLING,
+        P_UNISON,
+        P_UNISONDETUNE,
         P_NUM
     };
 
     struct Data {
         common::StateData state;
         float p[P_NUM];
+        AudioPluginUtil::Arena* arena;
     };
     union PaddedData {
         // NOTE: clang for some reason needs these braces here or else it
@@ -57,13 +128,26 @@ namespace Howdy {
         definition.paramdefs = new UnityAudioParameterDefinition[numparams];
         AudioPluginUtil::RegisterParameter(definition, "Frequency", "", 0.0f, 1000.0f, 440.0f, 1.0f, 1.0f, P_FREQ, "frequency");
         AudioPluginUtil::RegisterParameter(definition, "InputMix", "%", 0.0f, 100.0f, 100.0f, 1.0f, 1.0f, P_INPUTMIX, "Amount of input signal mixed to the output of the synthesizer.");
+        AudioPluginUtil::RegisterParameter(definition, "Noise Level", "%", 0.0f, 100.0f, 0.0f, 1.0f, 1.0f, P_NOISELEVEL, "Level of the noise mixed with the oscillators.");
+        AudioPluginUtil::RegisterParameter(definition, "Noise Filter", "%", 0.0f, 100.0f, 100.0f, 1.0f, 1.0f, P_NOISEFILTER, "Share of the noise that goes through the filter. The rest is added after it.");
+        AudioPluginUtil::RegisterParameter(definition, "Noise Color", "", 0.0f, 2.0f, 0.0f, 1.0f, 1.0f, P_NOISECOLOR, "0 = white, 1 = pink, 2 = brown");
+        AudioPluginUtil::RegisterParameter(definition, "Oscillator", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_OSCILLATOR, "0 = saw, 1 = square");
+        AudioPluginUtil::RegisterParameter(definition, "Filter", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_FILTER, "0 = ladder, 1 = state variable");
+        AudioPluginUtil::RegisterParameter(definition, "Oversampling", "", 0.0f, 2.0f, 0.0f, 1.0f, 1.0f, P_OVERSAMPLING, "0 = off, 1 = 2x, 2 = 4x");
+        AudioPluginUtil::RegisterParameter(definition, "Unison", "", 1.0f, (float)common::kMaxUnison, 1.0f, 1.0f, 1.0f, P_UNISON, "Number of oscillators per voice");
+        AudioPluginUtil::RegisterParameter(definition, "Unison Detune", "cents", 0.0f, 100.0f, 15.0f, 1.0f, 1.0f, P_UNISONDETUNE, "Detuning between the outermost unison oscillators");
         
         return numparams;
     }
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
     {
-        PaddedData* paddedData = new PaddedData;
+        // All instance state lives in one arena, so nothing is allocated after this.
+        AudioPluginUtil::Arena* arena = AudioPluginUtil::Arena::Create(AudioPluginUtil::Arena::Footprint(sizeof(PaddedData)));
+        if (arena == nullptr)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        PaddedData* paddedData = arena->New<PaddedData>();
+        paddedData->data.arena = arena;
         common::InitStateData(paddedData->data.state, &gEventQueue, state->samplerate);
         gSynthTicks = &(paddedData->data.state.tickTime);
         state->effectdata = paddedData;     
@@ -75,7 +159,7 @@ namespace Howdy {
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
     {
         PaddedData* paddedData = state->GetEffectData<PaddedData>();
-        delete paddedData;
+        AudioPluginUtil::Arena::Destroy(paddedData->data.arena);
         return UNITY_AUDIODSP_OK;
     }
 
@@ -104,18 +188,38 @@ namespace Howdy {
 
     int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
     {
+        Data* data = &state->GetEffectData<PaddedData>()->data;
+        if (strcmp(name, "IsSilent") == 0 && numsamples > 0)
+            buffer[0] = data->state.silent ? 1.0f : 0.0f;
         return UNITY_AUDIODSP_OK;
     }
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inBuffer, float* outBuffer, unsigned int bufferLength, int inChannels, int outChannels)
     {
+        AudioPluginUtil::DenormalGuard denormalGuard;
+        AudioPluginUtil::RealtimeScope realtimeScope;
         const bool shouldPlay = (state->flags & UnityAudioEffectStateFlags_IsPlaying) && !(state->flags & (UnityAudioEffectStateFlags_IsMuted | UnityAudioEffectStateFlags_IsPaused));
+        Data* data = &state->GetEffectData<PaddedData>()->data;
         if (!shouldPlay) {
             memset(outBuffer, 0.0f, bufferLength*outChannels*sizeof(float));
+            data->state.silent = true;
             return UNITY_AUDIODSP_OK;
         }
 
-        Data* data = &state->GetEffectData<PaddedData>()->data;
+        if (gModMatrixPending.load(std::memory_order_acquire)) {
+            common::SetModMatrix(data->state, gPendingModMatrix);
+            gModMatrixPending.store(false, std::memory_order_release);
+        }
+        data->state.noiseLevel = data->p[P_NOISELEVEL] * 0.01f;
+        data->state.noiseFilterAmount = data->p[P_NOISEFILTER] * 0.01f;
+        data->state.noiseColor = (AudioPluginUtil::NoiseSource::Color)(int)data->p[P_NOISECOLOR];
+        data->state.unisonDetune = data->p[P_UNISONDETUNE];
+        common::VoiceConfig voiceConfig;
+        voiceConfig.oscillator = (common::Oscillator)(int)data->p[P_OSCILLATOR];
+        voiceConfig.filter = (common::VoiceFilter)(int)data->p[P_FILTER];
+        voiceConfig.oversampling = 1 << (int)data->p[P_OVERSAMPLING];
+        voiceConfig.unison = (int)data->p[P_UNISON];
+        common::SetVoiceConfig(data->state, voiceConfig);
         common::Process(&data->state, outBuffer, outChannels, bufferLength, state->samplerate);
 
         return UNITY_AUDIODSP_OK;
@@ -0,0 +1,318 @@
+#include "AudioPluginUtil.h"
+
+namespace LoudnessMeter
+{
+    enum Param
+    {
+        P_RESET,
+        P_NUM
+    };
+
+    const int MAXCHANNELS = 8;
+    const int MOMENTARYBLOCKS = 4;      // 400 ms in 100 ms sub-blocks
+    const int SHORTTERMBLOCKS = 30;     // 3 s in 100 ms sub-blocks
+    const int HISTOGRAMBINS = 800;      // Gating blocks from -70 to +10 LUFS in 0.1 LU steps
+    const float HISTOGRAMMIN = -70.0f;  // Absolute gate
+    const float HISTOGRAMSTEP = 0.1f;
+    const float SILENCE = -120.0f;      // Reported instead of minus infinity
+    const int OVERSAMPLING = 4;         // True peak is measured on a 4x interpolated signal as described in BS.1770 annex 2
+    const int PHASETAPS = 12;
+    const int CHUNKSAMPLES = 2048;      // Size of the scratch buffer the channels are K-weighted into a block at a time
+
+    enum Result
+    {
+        R_MOMENTARY,
+        R_SHORTTERM,
+        R_INTEGRATED,
+        R_TRUEPEAK,
+        R_NUM
+    };
+
+    struct EffectData
+    {
+        float p[P_NUM];
+        std::atomic<bool> resetrequested;
+        AudioPluginUtil::BiquadFilter shelf[MAXCHANNELS];
+        AudioPluginUtil::BiquadFilter highpass[MAXCHANNELS];
+        float weighted[CHUNKSAMPLES];       // K-weighted input, interleaved like the input buffer
+        int subblocklength;
+        int subblockpos;
+        double subblocksum;
+        double subblocks[SHORTTERMBLOCKS];  // Mean weighted power of the latest sub-blocks
+        int subblockindex;
+        int numsubblocks;
+
+        // Gating blocks above the absolute gate, binned by loudness. Integrated loudness only needs the bin totals.
+        double histogramenergy[HISTOGRAMBINS];
+        UInt32 histogramcount[HISTOGRAMBINS];
+        double gatedenergy;
+        UInt32 gatedcount;
+
+        float interpolator[OVERSAMPLING][PHASETAPS];
+        float peakhistory[MAXCHANNELS][2 * PHASETAPS]; // Every sample is written twice so the latest PHASETAPS are contiguous
+        int peakpos;
+        float truepeak;
+
+        AudioPluginUtil::SnapshotBuffer results;
+    };
+
+    static inline float PowerToLoudness(double power)
+    {
+        return (power > 0.0) ? (float)(-0.691 + 10.0 * log10(power)) : SILENCE;
+    }
+
+    static float ChannelWeight(int channel, int numchannels)
+    {
+        // Surround channels are weighted by +1.5 dB and the LFE channel is left out
+        if (numchannels == 4)
+            return (channel >= 2) ? 1.41f : 1.0f;
+        if (numchannels >= 6)
+        {
+            if (channel == 3)
+                return 0.0f;
+            return (channel >= 4) ? 1.41f : 1.0f;
+        }
+        return 1.0f;
+    }
+
+    static void Reset(EffectData* data, float samplerate)
+    {
+        for (int c = 0; c < MAXCHANNELS; c++)
+        {
+            memset(&data->shelf[c], 0, sizeof(data->shelf[c]));
+            memset(&data->highpass[c], 0, sizeof(data->highpass[c]));
+            data->shelf[c].SetupKWeightingShelf(samplerate);
+            data->highpass[c].SetupKWeightingHighpass(samplerate);
+        }
+        data->subblocklength = (int)(samplerate * 0.1f);
+        data->subblockpos = 0;
+        data->subblocksum = 0.0;
+        memset(data->subblocks, 0, sizeof(data->subblocks));
+        data->subblockindex = 0;
+        data->numsubblocks = 0;
+        memset(data->histogramenergy, 0, sizeof(data->histogramenergy));
+        memset(data->histogramcount, 0, sizeof(data->histogramcount));
+        data->gatedenergy = 0.0;
+        data->gatedcount = 0;
+        memset(data->peakhistory, 0, sizeof(data->peakhistory));
+        data->peakpos = 0;
+        data->truepeak = 0.0f;
+    }
+
+    static void InitInterpolator(EffectData* data)
+    {
+        // Hann-windowed sinc cutting off at the original Nyquist frequency, split into one filter per output phase
+        const int numtaps = OVERSAMPLING * PHASETAPS;
+        for (int n = 0; n < numtaps; n++)
+        {
+            double x = (n - 0.5 * (numtaps - 1)) / OVERSAMPLING;
+            double sinc = (fabs(x) < 1.0e-9) ? 1.0 : sin(AudioPluginUtil::kPI_double * x) / (AudioPluginUtil::kPI_double * x);
+            double window = 0.5 - 0.5 * cos(2.0 * AudioPluginUtil::kPI_double * (n + 0.5) / numtaps);
+            // Reversed within each phase so the taps line up with the oldest-first history window
+            data->interpolator[n % OVERSAMPLING][PHASETAPS - 1 - n / OVERSAMPLING] = (float)(sinc * window);
+        }
+    }
+
+    static float IntegratedLoudness(const EffectData* data)
+    {
+        if (data->gatedcount == 0)
+            return SILENCE;
+
+        // Relative gate 10 LU below the loudness of everything above the absolute gate
+        float threshold = PowerToLoudness(data->gatedenergy / data->gatedcount) - 10.0f;
+        int first = (int)ceilf((threshold - HISTOGRAMMIN) / HISTOGRAMSTEP);
+        if (first < 0)
+            first = 0;
+        double energy = 0.0;
+        UInt32 count = 0;
+        for (int n = first; n < HISTOGRAMBINS; n++)
+        {
+            energy += data->histogramenergy[n];
+            count += data->histogramcount[n];
+        }
+        return (count > 0) ? PowerToLoudness(energy / count) : SILENCE;
+    }
+
+    static void EndSubBlock(EffectData* data)
+    {
+        data->subblocks[data->subblockindex] = data->subblocksum / data->subblocklength;
+        if (++data->subblockindex == SHORTTERMBLOCKS)
+            data->subblockindex = 0;
+        if (data->numsubblocks < SHORTTERMBLOCKS)
+            data->numsubblocks++;
+        data->subblockpos = 0;
+        data->subblocksum = 0.0;
+
+        double momentary = 0.0, shortterm = 0.0;
+        for (int n = 0; n < data->numsubblocks; n++)
+        {
+            int i = (data->subblockindex - 1 - n + SHORTTERMBLOCKS) % SHORTTERMBLOCKS;
+            if (n < MOMENTARYBLOCKS)
+                momentary += data->subblocks[i];
+            shortterm += data->subblocks[i];
+        }
+        momentary /= MOMENTARYBLOCKS;
+        shortterm /= (data->numsubblocks < MOMENTARYBLOCKS) ? MOMENTARYBLOCKS : data->numsubblocks;
+
+        // Every sub-block completes a 400 ms gating block overlapping the previous one by 75%
+        if (data->numsubblocks >= MOMENTARYBLOCKS)
+        {
+            float loudness = PowerToLoudness(momentary);
+            if (loudness >= HISTOGRAMMIN)
+            {
+                int bin = (int)((loudness - HISTOGRAMMIN) / HISTOGRAMSTEP);
+                if (bin >= HISTOGRAMBINS)
+                    bin = HISTOGRAMBINS - 1;
+                data->histogramenergy[bin] += momentary;
+                data->histogramcount[bin]++;
+                data->gatedenergy += momentary;
+                data->gatedcount++;
+            }
+        }
+
+        float* result = data->results.BeginWrite();
+        result[R_MOMENTARY] = PowerToLoudness(momentary);
+        result[R_SHORTTERM] = PowerToLoudness(shortterm);
+        result[R_INTEGRATED] = IntegratedLoudness(data);
+        result[R_TRUEPEAK] = (data->truepeak > 0.0f) ? 20.0f * log10f(data->truepeak) : SILENCE;
+        data->results.EndWrite();
+    }
+
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+    {
+        int numparams = P_NUM;
+        definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+        AudioPluginUtil::RegisterParameter(definition, "Reset", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_RESET, "Setting this to 1 restarts the integrated loudness and true peak measurement");
+        return numparams;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = new EffectData();
+        data->results.Init(R_NUM);
+        InitInterpolator(data);
+        Reset(data, (float)state->samplerate);
+        AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+        state->effectdata = data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        delete data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (index == P_RESET && value > 0.5f && data->p[P_RESET] <= 0.5f)
+            data->resetrequested.store(true);
+        data->p[index] = value;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (value != NULL)
+            *value = data->p[index];
+        if (valuestr != NULL)
+            valuestr[0] = 0;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    // "Loudness" returns momentary, short-term and integrated loudness in LUFS, the true peak in dBTP and an update counter
+    // that advances every 100 ms. Safe to call from any thread.
+    int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (strcmp(name, "Loudness") == 0)
+        {
+            float result[R_NUM] = { SILENCE, SILENCE, SILENCE, SILENCE };
+            UInt32 frame = data->results.Read([&](const float* src) { memcpy(result, src, sizeof(result)); });
+            for (int n = 0; n < R_NUM && n < numsamples; n++)
+                buffer[n] = result[n];
+            if (numsamples > R_NUM)
+                buffer[R_NUM] = (float)frame;
+        }
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+    {
+        AudioPluginUtil::DenormalGuard denormalguard;
+        AudioPluginUtil::RealtimeScope realtimescope;
+        EffectData* data = state->GetEffectData<EffectData>();
+
+        memcpy(outbuffer, inbuffer, sizeof(float) * length * inchannels);
+
+        if (data->resetrequested.exchange(false))
+            Reset(data, (float)state->samplerate);
+
+        const int numchannels = (inchannels < MAXCHANNELS) ? inchannels : MAXCHANNELS;
+        float weights[MAXCHANNELS];
+        for (int c = 0; c < numchannels; c++)
+            weights[c] = ChannelWeight(c, inchannels);
+
+        float truepeak = data->truepeak;
+        const int chunkframes = CHUNKSAMPLES / inchannels;
+        for (unsigned int start = 0; start < length; start += chunkframes)
+        {
+            const int numframes = (length - start < (unsigned int)chunkframes) ? (int)(length - start) : chunkframes;
+            const float* chunk = inbuffer + start * inchannels;
+            for (int c = 0; c < numchannels; c++)
+            {
+                data->shelf[c].ProcessBlock(chunk + c, data->weighted + c, numframes, inchannels);
+                data->highpass[c].ProcessBlock(data->weighted + c, numframes, inchannels);
+            }
+
+            for (int n = 0; n < numframes; n++)
+            {
+                const float* src = chunk + n * inchannels;
+                const float* weighted = data->weighted + n * inchannels;
+                int p = data->peakpos;
+                double power = 0.0;
+                for (int c = 0; c < numchannels; c++)
+                {
+                    float x = src[c];
+                    float y = weighted[c];
+                    power += weights[c] * y * y;
+
+                    float* history = data->peakhistory[c];
+                    history[p] = history[p + PHASETAPS] = x;
+                    const float* window = history + p + 1;
+                    for (int phase = 0; phase < OVERSAMPLING; phase++)
+                    {
+                        const float* taps = data->interpolator[phase];
+                        float sum = 0.0f;
+                        for (int k = 0; k < PHASETAPS; k++)
+                            sum += taps[k] * window[k];
+                        sum = fabsf(sum);
+                        if (sum > truepeak)
+                            truepeak = sum;
+                    }
+                    // The interpolated signal can't fall below the sample peak
+                    if (fabsf(x) > truepeak)
+                        truepeak = fabsf(x);
+                }
+                data->peakpos = (p + 1 == PHASETAPS) ? 0 : (p + 1);
+
+                data->subblocksum += power;
+                if (++data->subblockpos == data->subblocklength)
+                {
+                    data->truepeak = truepeak;
+                    EndSubBlock(data);
+                }
+            }
+        }
+        data->truepeak = truepeak;
+
+        return UNITY_AUDIODSP_OK;
+    }
+}
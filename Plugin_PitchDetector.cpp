@@ -0,0 +1,228 @@
+#include "AudioPluginUtil.h"
+
+namespace PitchDetector
+{
+    enum Param
+    {
+        P_THRESHOLD,
+        P_MINFREQ,
+        P_MAXFREQ,
+        P_HOPSIZE,
+        P_NUM
+    };
+
+    const int WINDOWSIZE = 2048;                  // Integration window of the YIN difference function
+    const int MAXLAG = 1024;                      // Longest period we can detect, in samples
+    const int FRAMESIZE = WINDOWSIZE + MAXLAG;    // Samples needed to evaluate every lag over the full window
+    const int FFTSIZE = 4096;                     // Power of two >= FRAMESIZE so the correlation doesn't wrap for any lag we use
+    const int NUMBINS = FFTSIZE / 2 + 1;
+
+    struct EffectData
+    {
+        float p[P_NUM];
+        float ring[FRAMESIZE];
+        int writepos;
+        int hopcount;
+        float frame[FFTSIZE];
+        float window[FFTSIZE];
+        AudioPluginUtil::UnityComplexNumber framespec[NUMBINS];
+        AudioPluginUtil::UnityComplexNumber windowspec[NUMBINS];
+        double energy[FRAMESIZE + 1];   // Prefix sums of the squared frame
+        float cmnd[MAXLAG + 2];         // Cumulative mean normalized difference
+        AudioPluginUtil::SnapshotBuffer results; // Frequency (0 if none), confidence
+    };
+
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+    {
+        int numparams = P_NUM;
+        definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+        AudioPluginUtil::RegisterParameter(definition, "Threshold", "", 0.01f, 0.5f, 0.15f, 1.0f, 1.0f, P_THRESHOLD, "Dips of the normalized difference function below this value are accepted as the period");
+        AudioPluginUtil::RegisterParameter(definition, "Min Freq", "Hz", 20.0f, 1000.0f, 60.0f, 1.0f, 3.0f, P_MINFREQ, "Lowest frequency to detect");
+        AudioPluginUtil::RegisterParameter(definition, "Max Freq", "Hz", 100.0f, 4000.0f, 1500.0f, 1.0f, 3.0f, P_MAXFREQ, "Highest frequency to detect");
+        AudioPluginUtil::RegisterParameter(definition, "Hop Size", "", 64.0f, 4096.0f, 512.0f, 1.0f, 1.0f, P_HOPSIZE, "Number of samples between analyses");
+        return numparams;
+    }
+
+    static void Analyze(EffectData* data, float samplerate)
+    {
+        // Oldest sample first, zero-padded to the transform size
+        int tail = FRAMESIZE - data->writepos;
+        memcpy(data->frame, data->ring + data->writepos, sizeof(float) * tail);
+        memcpy(data->frame + tail, data->ring, sizeof(float) * data->writepos);
+        memset(data->frame + FRAMESIZE, 0, sizeof(float) * (FFTSIZE - FRAMESIZE));
+
+        data->energy[0] = 0.0;
+        for (int n = 0; n < FRAMESIZE; n++)
+            data->energy[n + 1] = data->energy[n] + (double)data->frame[n] * (double)data->frame[n];
+
+        // The Min Freq and Max Freq ranges overlap, so the bounds are accepted in either order. The lag range can still
+        // be empty at high sample rates, where even Max Freq has a period longer than MAXLAG; nothing is detected then.
+        float lowfreq = fminf(data->p[P_MINFREQ], data->p[P_MAXFREQ]);
+        float highfreq = fmaxf(data->p[P_MINFREQ], data->p[P_MAXFREQ]);
+        int minlag = (int)(samplerate / highfreq);
+        int maxlag = (int)(samplerate / lowfreq) + 1;
+        if (minlag < 2)
+            minlag = 2;
+        if (maxlag > MAXLAG)
+            maxlag = MAXLAG;
+
+        const double windowenergy = data->energy[WINDOWSIZE];
+        float f0 = 0.0f, confidence = 0.0f;
+        if (windowenergy > 1.0e-8 * WINDOWSIZE && minlag <= maxlag)
+        {
+            // corr[lag] = sum over the window of x[j] * x[j + lag], computed as the inverse transform of conj(W) * F
+            memcpy(data->window, data->frame, sizeof(float) * WINDOWSIZE);
+            memset(data->window + WINDOWSIZE, 0, sizeof(float) * (FFTSIZE - WINDOWSIZE));
+            AudioPluginUtil::FFT::ForwardReal(data->frame, data->framespec, FFTSIZE);
+            AudioPluginUtil::FFT::ForwardReal(data->window, data->windowspec, FFTSIZE);
+            for (int n = 0; n < NUMBINS; n++)
+            {
+                const AudioPluginUtil::UnityComplexNumber w = data->windowspec[n], f = data->framespec[n];
+                data->windowspec[n].Set(w.re * f.re + w.im * f.im, w.re * f.im - w.im * f.re);
+            }
+            float* corr = data->window;
+            AudioPluginUtil::FFT::BackwardReal(data->windowspec, corr, FFTSIZE);
+
+            // d(lag) = sum (x[j] - x[j + lag])^2 = energy of the window + energy of the shifted window - 2 corr[lag]
+            double running = 0.0;
+            data->cmnd[0] = 1.0f;
+            for (int lag = 1; lag <= maxlag + 1 && lag <= MAXLAG; lag++)
+            {
+                double d = windowenergy + (data->energy[lag + WINDOWSIZE] - data->energy[lag]) - 2.0 * corr[lag];
+                if (d < 0.0)
+                    d = 0.0;
+                running += d;
+                data->cmnd[lag] = (running > 0.0) ? (float)(d * lag / running) : 1.0f;
+            }
+            int last = (maxlag + 1 <= MAXLAG) ? maxlag + 1 : MAXLAG;
+
+            // First dip below the threshold, followed down to its minimum; otherwise the global minimum
+            int best = -1;
+            for (int lag = minlag; lag <= maxlag; lag++)
+            {
+                if (data->cmnd[lag] < data->p[P_THRESHOLD])
+                {
+                    while (lag + 1 <= maxlag && data->cmnd[lag + 1] < data->cmnd[lag])
+                        lag++;
+                    best = lag;
+                    break;
+                }
+            }
+            if (best < 0)
+            {
+                best = minlag;
+                for (int lag = minlag + 1; lag <= maxlag; lag++)
+                    if (data->cmnd[lag] < data->cmnd[best])
+                        best = lag;
+            }
+
+            float period = (float)best;
+            if (best > 1 && best < last)
+            {
+                float a = data->cmnd[best - 1], b = data->cmnd[best], c = data->cmnd[best + 1];
+                float denom = a - 2.0f * b + c;
+                if (denom > 0.0f)
+                    period += 0.5f * (a - c) / denom;
+            }
+
+            f0 = samplerate / period;
+            confidence = AudioPluginUtil::FastClip(1.0f - data->cmnd[best], 0.0f, 1.0f);
+        }
+
+        float* result = data->results.BeginWrite();
+        result[0] = f0;
+        result[1] = confidence;
+        data->results.EndWrite();
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = new EffectData();
+        data->results.Init(2);
+        AudioPluginUtil::FFT::PrepareReal(FFTSIZE);
+        AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+        state->effectdata = data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        delete data;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        data->p[index] = value;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (index >= P_NUM)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        if (value != NULL)
+            *value = data->p[index];
+        if (valuestr != NULL)
+            valuestr[0] = 0;
+        return UNITY_AUDIODSP_OK;
+    }
+
+    // "Pitch" returns the detected frequency in Hz (0 when the input is silent or the lag range is empty), the confidence
+    // in [0, 1] and the number of analyses done so far, so callers can tell whether a new result is available.
+    int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+    {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (strcmp(name, "Pitch") == 0)
+        {
+            float result[2] = { 0.0f, 0.0f };
+            UInt32 frame = data->results.Read([&](const float* src) { result[0] = src[0]; result[1] = src[1]; });
+            if (numsamples > 0)
+                buffer[0] = result[0];
+            if (numsamples > 1)
+                buffer[1] = result[1];
+            if (numsamples > 2)
+                buffer[2] = (float)frame;
+        }
+        return UNITY_AUDIODSP_OK;
+    }
+
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+    {
+        AudioPluginUtil::DenormalGuard denormalguard;
+        AudioPluginUtil::RealtimeScope realtimescope;
+        EffectData* data = state->GetEffectData<EffectData>();
+
+        memcpy(outbuffer, inbuffer, sizeof(float) * length * inchannels);
+
+        const float scale = 1.0f / (float)inchannels;
+        int w = data->writepos;
+        for (unsigned int n = 0; n < length; n++)
+        {
+            float sum = 0.0f;
+            for (int c = 0; c < inchannels; c++)
+                sum += inbuffer[n * inchannels + c];
+            data->ring[w] = sum * scale;
+            if (++w == FRAMESIZE)
+                w = 0;
+        }
+        data->writepos = w;
+
+        // At most one analysis per callback keeps the cost per block bounded when the hop is shorter than the block;
+        // the skipped hops would only have looked at older parts of the same audio
+        int hopsize = (int)data->p[P_HOPSIZE];
+        data->hopcount += length;
+        if (data->hopcount >= hopsize)
+        {
+            data->hopcount %= hopsize;
+            Analyze(data, (float)state->samplerate);
+        }
+
+        return UNITY_AUDIODSP_OK;
+    }
+}
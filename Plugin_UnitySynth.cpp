@@ -121,23 +121,20 @@ namespace MIDI
 
 namespace UnitySynth
 {
-    // const int OVERSAMPLING = 8;
-    const int OVERSAMPLING = 1;
+    // Oversampling factor and oscillators per voice are picked by parameters; every combination has its own render loop
+    const int NUMOVERSAMPLINGFACTORS = 4; // 1, 2, 4 and 8 times
     // const int MAXVOICES = 32;
     const int MAXVOICES = 3;
     // const int MAXCHANNELS = 16;
     const int MAXCHANNELS = 1;
-    // const int MAXOSCILLATORS = 8;
-    const int MAXOSCILLATORS = 2;
+    const int MAXOSCILLATORS = 8;
     const int RAMPSAMPLES = 64;
     // const int RAMPSAMPLES = 1;
 
-    static const float OSCSCALE = (const float)(0.5f / (float)(MAXOSCILLATORS * 0x100000000));
     static const float RAMPSCALE = (const float)(1.0f / (float)RAMPSAMPLES);
 
     static const float ONE_OVER_127 = (const float)(1.0f / 127.0f);
     static const float ONE_OVER_12 = (const float)(1.0f / 12.0f);
-    static const float ONE_OVER_MAXOSCILLATORS = (const float)(1.0f / (float)MAXOSCILLATORS);
 
     enum Param
     {
@@ -150,9 +147,24 @@ namespace UnitySynth
         P_DETUNE1,
         P_DETUNE2,
         P_TYPE,
+        P_ARPMODE,
+        P_ARPTEMPO,
+        P_ARPRATE,
+        P_ARPGATE,
+        P_OVERSAMPLING,
+        P_OSCILLATORS,
         P_NUM
     };
 
+    enum ArpMode
+    {
+        ARP_OFF,
+        ARP_UP,
+        ARP_DOWN,
+        ARP_RANDOM,
+        ARP_CHORD
+    };
+
     struct VoiceChannel
     {
         UInt32 phase[MAXOSCILLATORS];
@@ -168,11 +180,13 @@ namespace UnitySynth
             memset(this, 0, sizeof(*this));
         }
 
+        template<int OVERSAMPLING, int NUMOSCILLATORS>
         inline float Process(float cut, float bw)
         {
+            const float oscscale = (const float)(0.5f / (float)(NUMOSCILLATORS * OVERSAMPLING * 0x100000000));
             float osc = 0.0f;
             UInt32 f = freq;
-            for (int i = 0; i < MAXOSCILLATORS; i++)
+            for (int i = 0; i < NUMOSCILLATORS; i++)
             {
                 UInt32 p = phase[i];
                 for (int k = 0; k < OVERSAMPLING; k++)
@@ -184,7 +198,7 @@ namespace UnitySynth
                 f += detune;
             }
 
-            osc = (osc - MAXOSCILLATORS * 0.5f) * OSCSCALE;
+            osc = (osc - NUMOSCILLATORS * 0.5f) * oscscale;
 
             lpf += cut * bpf;
             bpf += cut * (osc - lpf - bpf * bw);
@@ -248,19 +262,21 @@ namespace UnitySynth
             return aenv < 0.001f;
         }
 
-        inline void FrameSetup()
+        inline void FrameSetup(int oversampling, int numoscillators)
         {
-            float st = sampletime * (const float)(0x100000000 / OVERSAMPLING);
+            float st = sampletime * (float)0x100000000 / (float)oversampling;
+            float oneovernumoscillators = 1.0f / (float)numoscillators;
             float dt1 = p[P_DETUNE1] + 0.5f * p[P_DETUNE2];
             float dt2 = p[P_DETUNE1] - 0.5f * p[P_DETUNE2];
             channels[0].freq = (UInt32)(FreqFromNote(note - dt1) * st);
             channels[1].freq = (UInt32)(FreqFromNote(note - dt2) * st);
-            channels[0].detune = (UInt32)((FreqFromNote(note + dt1) * st - channels[0].freq) * ONE_OVER_MAXOSCILLATORS);
-            channels[1].detune = (UInt32)((FreqFromNote(note + dt2) * st - channels[1].freq) * ONE_OVER_MAXOSCILLATORS);
+            channels[0].detune = (UInt32)((FreqFromNote(note + dt1) * st - channels[0].freq) * oneovernumoscillators);
+            channels[1].detune = (UInt32)((FreqFromNote(note + dt2) * st - channels[1].freq) * oneovernumoscillators);
             channels[0].mask = ((UInt32)AudioPluginUtil::FastFloor(p[P_TYPE] * 127) + 128) << 24;
             channels[1].mask = ((UInt32)AudioPluginUtil::FastFloor(p[P_TYPE] * 127) + 128) << 24;
         }
 
+        template<int OVERSAMPLING, int NUMOSCILLATORS>
         inline void Process(float& l, float& r)
         {
             float cut = AudioPluginUtil::FastClip(p[P_CUTOFF] + p[P_CUTENV] * fenv, 0.0001f, 0.99f); cut = cut * cut * 0.707f;
@@ -268,13 +284,41 @@ namespace UnitySynth
             float ramped_amp = aenv * amp;
             if (rampcount < RAMPSAMPLES)
                 ramped_amp *= (++rampcount) * RAMPSCALE;
-            l += channels[0].Process(cut, bw) * ramped_amp;
-            r += channels[1].Process(cut, bw) * ramped_amp;
-            aenv = aenv * aenvdecay + 1.0e-11f;
-            fenv = fenv * fenvdecay + 1.0e-11f;
+            l += channels[0].Process<OVERSAMPLING, NUMOSCILLATORS>(cut, bw) * ramped_amp;
+            r += channels[1].Process<OVERSAMPLING, NUMOSCILLATORS>(cut, bw) * ramped_amp;
+            aenv *= aenvdecay;
+            fenv *= fenvdecay;
         }
     };
 
+    // Renders one voice into a block until it's done playing
+    typedef void (*RenderVoiceFunc)(Voice* v, float* dst, int length, int outchannels);
+
+    template<int OVERSAMPLING, int NUMOSCILLATORS>
+    static void RenderVoice(Voice* v, float* dst, int length, int outchannels)
+    {
+        for (int n = 0; n < length; n++)
+        {
+            v->Process<OVERSAMPLING, NUMOSCILLATORS>(dst[0], dst[1]);
+            dst += outchannels;
+            if (v->IsDonePlaying())
+                break; // Retired by SynthesizerChannel::Process, no need to render the rest of the block
+        }
+    }
+
+#define UNITYSYNTH_RENDERVOICE_ROW(os) \
+    { &RenderVoice<os, 1>, &RenderVoice<os, 2>, &RenderVoice<os, 3>, &RenderVoice<os, 4>, &RenderVoice<os, 5>, &RenderVoice<os, 6>, &RenderVoice<os, 7>, &RenderVoice<os, 8> }
+
+    static const RenderVoiceFunc rendervoice[NUMOVERSAMPLINGFACTORS][MAXOSCILLATORS] =
+    {
+        UNITYSYNTH_RENDERVOICE_ROW(1),
+        UNITYSYNTH_RENDERVOICE_ROW(2),
+        UNITYSYNTH_RENDERVOICE_ROW(4),
+        UNITYSYNTH_RENDERVOICE_ROW(8)
+    };
+
+#undef UNITYSYNTH_RENDERVOICE_ROW
+
     struct SynthesizerChannel
     {
         Voice* voicepool[MAXVOICES];
@@ -282,17 +326,11 @@ namespace UnitySynth
         float ctrl[128];
         int numvoices;
 
-        void Init()
+        void Init(AudioPluginUtil::Arena* arena)
         {
             memset(this, 0, sizeof(*this));
             for (int n = 0; n < MAXVOICES; n++)
-                voicepool[n] = new Voice();
-        }
-
-        ~SynthesizerChannel()
-        {
-            for (int n = 0; n < MAXVOICES; n++)
-                delete voicepool[n];
+                voicepool[n] = arena->New<Voice>();
         }
 
         Voice* AllocateVoice(int key)
@@ -344,16 +382,14 @@ namespace UnitySynth
 
         void Process(float* outbuffer, int length, int outchannels, float* p)
         {
+            int oversamplingindex = (int)AudioPluginUtil::FastClip(p[P_OVERSAMPLING], 0.0f, NUMOVERSAMPLINGFACTORS - 1);
+            int numoscillators = (int)AudioPluginUtil::FastClip(p[P_OSCILLATORS], 1.0f, MAXOSCILLATORS);
+            RenderVoiceFunc render = rendervoice[oversamplingindex][numoscillators - 1];
             for (int k = 0; k < numvoices; k++)
             {
                 Voice* v = voicepool[k];
-                v->FrameSetup();
-                float* dst = outbuffer;
-                for (int n = 0; n < length; n++)
-                {
-                    v->Process(dst[0], dst[1]);
-                    dst += outchannels;
-                }
+                v->FrameSetup(1 << oversamplingindex, numoscillators);
+                render(v, outbuffer, length, outchannels);
             }
 
             int i = 0;
@@ -380,11 +416,29 @@ namespace UnitySynth
     {
         float p[P_NUM];
         int arpkeys[128];
+        int arpplaying[128];   // Notes currently sounding because the arpeggiator triggered them
+        int directkeys[128];   // Channel + 1 of keys that started a voice themselves, 0 if none
+        int numarpkeys;
+        int arpchannel;
+        int arpvelocity;
+        int arplastnote;
+        bool arprunning;
+        double arpnextstep;    // Sample time of the next arpeggiator step
+        UInt64 arpnoteoff;     // Sample time at which the sounding step is released
+        AudioPluginUtil::Random arprandom;
         int numpending;
         MIDI::MidiEvent pending[MAXPENDING];
         SynthesizerChannel synthchannel[MAXCHANNELS];
+        bool silent; // Set when the last block had no voices and no pending events, so the output was only cleared
+        AudioPluginUtil::Arena* arena; // Holds this structure and all voices
     };
 
+    // Everything an instance allocates, carved from a single arena in CreateCallback
+    static size_t GetArenaSize()
+    {
+        return AudioPluginUtil::Arena::Footprint(sizeof(EffectData)) + MAXCHANNELS * MAXVOICES * AudioPluginUtil::Arena::Footprint(sizeof(Voice));
+    }
+
     int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
     {
         int numparams = P_NUM;
@@ -398,16 +452,27 @@ namespace UnitySynth
         AudioPluginUtil::RegisterParameter(definition, "Voice Detuning", "%", 0.0f, 1.0f, 0.03f, 100.0f, 1.0f, P_DETUNE1, "Voice detuning amount");
         AudioPluginUtil::RegisterParameter(definition, "Stereo Detuning", "%", 0.0f, 1.0f, 0.01f, 100.0f, 1.0f, P_DETUNE2, "Stereo detuning amount");
         AudioPluginUtil::RegisterParameter(definition, "Type", "%", 0.0f, 1.0f, 1.0f, 100.0f, 1.0f, P_TYPE, "Pulse wave to sawtooth mix");
+        AudioPluginUtil::RegisterParameter(definition, "Arp mode", "", 0.0f, ARP_CHORD, ARP_OFF, 1.0f, 1.0f, P_ARPMODE, "Arpeggiator mode (0 = off, 1 = up, 2 = down, 3 = random, 4 = chord)");
+        AudioPluginUtil::RegisterParameter(definition, "Arp tempo", "BPM", 20.0f, 300.0f, 120.0f, 1.0f, 1.0f, P_ARPTEMPO, "Arpeggiator tempo");
+        AudioPluginUtil::RegisterParameter(definition, "Arp rate", "", 1.0f, 16.0f, 4.0f, 1.0f, 1.0f, P_ARPRATE, "Arpeggiator steps per beat");
+        AudioPluginUtil::RegisterParameter(definition, "Arp gate", "%", 0.01f, 1.0f, 0.5f, 100.0f, 1.0f, P_ARPGATE, "Fraction of each arpeggiator step that the note is held");
+        AudioPluginUtil::RegisterParameter(definition, "Oversampling", "", 0.0f, NUMOVERSAMPLINGFACTORS - 1, 0.0f, 1.0f, 1.0f, P_OVERSAMPLING, "Oscillator oversampling (0 = off, 1 = 2x, 2 = 4x, 3 = 8x)");
+        AudioPluginUtil::RegisterParameter(definition, "Oscillators", "", 1.0f, MAXOSCILLATORS, 2.0f, 1.0f, 1.0f, P_OSCILLATORS, "Detuned oscillators per voice and channel");
         return numparams;
     }
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
     {
         // static MIDI::MidiInput midiinput;
-        EffectData* effectdata = new EffectData;
-        memset(effectdata, 0, sizeof(EffectData));
+        AudioPluginUtil::Arena* arena = AudioPluginUtil::Arena::Create(GetArenaSize());
+        if (arena == NULL)
+            return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+        EffectData* effectdata = arena->New<EffectData>();
+        effectdata->arena = arena;
         for (int n = 0; n < MAXCHANNELS; n++)
-            effectdata->synthchannel[n].Init();
+            effectdata->synthchannel[n].Init(arena);
+        effectdata->arpnoteoff = (UInt64)-1;
+        effectdata->arprandom.Seed(12345);
         state->effectdata = effectdata;
         AudioPluginUtil::InitParametersFromDefinitions(InternalRegisterEffectDefinition, effectdata->p);
         return UNITY_AUDIODSP_OK;
@@ -416,7 +481,7 @@ namespace UnitySynth
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
     {
         EffectData* data = state->GetEffectData<EffectData>();
-        delete data;
+        AudioPluginUtil::Arena::Destroy(data->arena);
         return UNITY_AUDIODSP_OK;
     }
 
@@ -443,10 +508,124 @@ namespace UnitySynth
 
     int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
     {
+        EffectData* data = state->GetEffectData<EffectData>();
+        if (strcmp(name, "IsSilent") == 0 && numsamples > 0)
+            buffer[0] = data->silent ? 1.0f : 0.0f;
         return UNITY_AUDIODSP_OK;
     }
 
-    static void HandleEvent(EffectData* data, UInt32 msg, float sampletime)
+    static inline bool ArpEnabled(const EffectData* data)
+    {
+        return (int)data->p[P_ARPMODE] != ARP_OFF;
+    }
+
+    static void ArpReleaseNotes(EffectData* data, float sampletime)
+    {
+        SynthesizerChannel* synthchannel = &data->synthchannel[data->arpchannel];
+        for (int n = 0; n < 128; n++)
+        {
+            if (data->arpplaying[n])
+            {
+                data->arpplaying[n] = 0;
+                synthchannel->NoteOff(n, 0, data->p, sampletime);
+            }
+        }
+        data->arpnoteoff = (UInt64)-1;
+    }
+
+    static int ArpPickNote(EffectData* data, int mode)
+    {
+        if (mode == ARP_RANDOM)
+        {
+            int k = data->arprandom.Get() % data->numarpkeys;
+            for (int n = 0; n < 128; n++)
+                if (data->arpkeys[n] && k-- == 0)
+                    return n;
+        }
+        int first = -1, next = -1;
+        if (mode == ARP_DOWN)
+        {
+            for (int n = 127; n >= 0; n--)
+            {
+                if (!data->arpkeys[n])
+                    continue;
+                if (first < 0)
+                    first = n;
+                if (next < 0 && n < data->arplastnote)
+                    next = n;
+            }
+        }
+        else
+        {
+            for (int n = 0; n < 128; n++)
+            {
+                if (!data->arpkeys[n])
+                    continue;
+                if (first < 0)
+                    first = n;
+                if (next < 0 && n > data->arplastnote)
+                    next = n;
+            }
+        }
+        return (next >= 0) ? next : first;
+    }
+
+    // Plays all arpeggiator steps and releases due at or before the given tick
+    static void ArpUpdate(EffectData* data, UInt64 tick, float sampletime, int samplerate)
+    {
+        if (tick >= data->arpnoteoff)
+            ArpReleaseNotes(data, sampletime);
+
+        if (!data->arprunning || tick < (UInt64)ceil(data->arpnextstep))
+            return;
+
+        int mode = (int)data->p[P_ARPMODE];
+        if (mode == ARP_OFF || data->numarpkeys == 0)
+        {
+            data->arprunning = false;
+            return;
+        }
+
+        double steplength = samplerate * 60.0 / (data->p[P_ARPTEMPO] * data->p[P_ARPRATE]);
+        ArpReleaseNotes(data, sampletime);
+        SynthesizerChannel* synthchannel = &data->synthchannel[data->arpchannel];
+        if (mode == ARP_CHORD)
+        {
+            for (int n = 0; n < 128; n++)
+            {
+                if (data->arpkeys[n])
+                {
+                    data->arpplaying[n] = 1;
+                    synthchannel->NoteOn(n, data->arpvelocity, data->p, sampletime);
+                }
+            }
+        }
+        else
+        {
+            int note = ArpPickNote(data, mode);
+            data->arplastnote = note;
+            data->arpplaying[note] = 1;
+            synthchannel->NoteOn(note, data->arpvelocity, data->p, sampletime);
+        }
+        data->arpnoteoff = tick + (UInt64)(steplength * data->p[P_ARPGATE] + 0.5);
+        data->arpnextstep += steplength;
+        if (data->arpnextstep < (double)tick) // Host skipped ahead, so restart the grid
+            data->arpnextstep = (double)tick + steplength;
+    }
+
+    static inline UInt64 ArpNextEvent(const EffectData* data)
+    {
+        UInt64 next = data->arpnoteoff;
+        if (data->arprunning)
+        {
+            UInt64 step = (UInt64)ceil(data->arpnextstep);
+            if (step < next)
+                next = step;
+        }
+        return next;
+    }
+
+    static void HandleEvent(EffectData* data, UInt32 msg, float sampletime, UInt64 tick)
     {
         int channel = msg & 15;
         int command = msg & 0xF0;
@@ -458,12 +637,39 @@ namespace UnitySynth
             case 0x90:
                 if (data2 > 0)
                 {
+                    if (!data->arpkeys[data1])
+                        data->numarpkeys++;
                     data->arpkeys[data1] = 1;
+                    if (ArpEnabled(data))
+                    {
+                        // Held keys only feed the arpeggiator, which starts on the first key
+                        data->arpchannel = channel;
+                        data->arpvelocity = data2;
+                        if (!data->arprunning)
+                        {
+                            data->arprunning = true;
+                            data->arpnextstep = (double)tick;
+                            data->arplastnote = -1;
+                        }
+                        break;
+                    }
+                    data->directkeys[data1] = channel + 1;
                     synthchannel->NoteOn(data1, data2, data->p, sampletime);
                     break;
                 }
             case 0x80:
+                if (data->arpkeys[data1])
+                    data->numarpkeys--;
                 data->arpkeys[data1] = 0;
+                if (data->directkeys[data1])
+                {
+                    // Released even if the arpeggiator was switched on while the key was down
+                    data->synthchannel[data->directkeys[data1] - 1].NoteOff(data1, data2, data->p, sampletime);
+                    data->directkeys[data1] = 0;
+                    break;
+                }
+                if (ArpEnabled(data) && !data->arpplaying[data1])
+                    break;
                 synthchannel->NoteOff(data1, data2, data->p, sampletime);
                 break;
             case 0xB0:
@@ -476,7 +682,12 @@ namespace UnitySynth
                     MIDI::scheduledata.Clear();
                     data->numpending = 0;
                     memset(data->arpkeys, 0, sizeof(data->arpkeys));
-                    for (int c = 0; c < 16; c++)
+                    memset(data->arpplaying, 0, sizeof(data->arpplaying));
+                    memset(data->directkeys, 0, sizeof(data->directkeys));
+                    data->numarpkeys = 0;
+                    data->arprunning = false;
+                    data->arpnoteoff = (UInt64)-1;
+                    for (int c = 0; c < MAXCHANNELS; c++)
                     {
                         SynthesizerChannel* synthchannel = &data->synthchannel[c];
                         memset(synthchannel->keys, 0, sizeof(synthchannel->keys));
@@ -489,6 +700,8 @@ namespace UnitySynth
 
     UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
     {
+        AudioPluginUtil::DenormalGuard denormalguard;
+        AudioPluginUtil::RealtimeScope realtimescope;
         EffectData* data = state->GetEffectData<EffectData>();
 
         memset(outbuffer, 0, sizeof(float) * length * outchannels);
@@ -503,41 +716,47 @@ namespace UnitySynth
                 data->pending[data->numpending++] = ev;
                 continue;
             }
-            HandleEvent(data, ev.msg, sampletime);
+            HandleEvent(data, ev.msg, sampletime, state->currdsptick);
         }
 
         while (MIDI::livedata.Read(ev.msg))
-            HandleEvent(data, ev.msg, sampletime);
+            HandleEvent(data, ev.msg, sampletime, state->currdsptick);
+
+        // Nothing playing and nothing scheduled: the cleared buffer is the output
+        data->silent = (data->numpending == 0) && !data->arprunning && data->arpnoteoff == (UInt64)-1;
+        for (int n = 0; n < MAXCHANNELS; n++)
+            if (data->synthchannel[n].numvoices > 0)
+                data->silent = false;
+        if (data->silent)
+            return UNITY_AUDIODSP_OK;
 
         UInt64 currtick = state->currdsptick;
         int samplesleft = length;
         while (samplesleft > 0)
         {
-            UInt64 frameend = currtick + samplesleft;
-            UInt64 nextevent = frameend;
+            // Apply everything due at the current tick, then render up to the next event
+            int i = 0, j = 0;
+            while (i < data->numpending)
+            {
+                MIDI::MidiEvent& ev = data->pending[i++];
+                if (ev.sample <= currtick)
+                    HandleEvent(data, ev.msg, sampletime, currtick);
+                else
+                    data->pending[j++] = ev;
+            }
+            data->numpending = j;
+            ArpUpdate(data, currtick, sampletime, state->samplerate);
+
+            UInt64 nextevent = currtick + samplesleft;
             for (int n = 0; n < data->numpending; n++)
                 if (data->pending[n].sample < nextevent)
                     nextevent = data->pending[n].sample;
-            if (nextevent < currtick)
-                nextevent = currtick;
-            if (nextevent < frameend)
-            {
-                int i = 0, j = 0;
-                while (i < data->numpending)
-                {
-                    MIDI::MidiEvent& ev = data->pending[i++];
-                    if (ev.sample <= nextevent)
-                        HandleEvent(data, ev.msg, sampletime);
-                    else
-                        data->pending[j++] = ev;
-                }
-                data->numpending = j;
-            }
+            UInt64 arpevent = ArpNextEvent(data);
+            if (arpevent < nextevent)
+                nextevent = arpevent;
+            if (nextevent <= currtick) // A zero length gate releases on the next sample
+                nextevent = currtick + 1;
             int block = (int)(nextevent - currtick);
-            if (block == 0)
-                continue;
-            if (block > samplesleft)
-                block = samplesleft;
             for (int n = 0; n < MAXCHANNELS; n++)
             {
                 SynthesizerChannel* synthchannel = &data->synthchannel[n];
@@ -545,6 +764,7 @@ namespace UnitySynth
             }
             outbuffer += block * outchannels;
             samplesleft -= block;
+            currtick += block;
         }
 
         return UNITY_AUDIODSP_OK;
@@ -0,0 +1,351 @@
+// Real-time safety checker. Records every call to the allocator, to mutex locks, to condition variable waits and signals,
+// to futex system calls made through syscall(), to sleeps and to file I/O made by a thread while it is inside an
+// AudioPluginUtil::RealtimeScope, i.e. while it runs a process callback, together with the stack trace of the call. Nothing is reported from the callback itself; RTCheckReport prints the
+// log afterwards, and it's printed at exit if nobody asked for it.
+//
+// Link it into a host (build.sh -t does that for render.out), or preload it into one that doesn't know about it:
+//   g++ -std=c++17 -O2 -shared -fPIC RTCheck.cpp -ldl -o rtcheck.so
+//   LD_PRELOAD=./rtcheck.so ./standalone.out
+//
+// Interposition needs glibc; elsewhere this only provides the entry points, and the count stays at zero. Futex calls
+// glibc makes internally don't go through syscall() and are only seen via the pthread function that made them.
+
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <atomic>
+
+extern "C"
+{
+    void RTCheckEnter();
+    void RTCheckLeave();
+    int RTCheckGetNumViolations();
+    void RTCheckReport();
+}
+
+#if defined(__linux__) && defined(__GLIBC__)
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+extern "C"
+{
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t num, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* ptr);
+}
+
+namespace RTCheck
+{
+    enum { MAXVIOLATIONS = 64, MAXFRAMES = 24 };
+
+    struct Violation
+    {
+        const char* what;
+        int numframes;
+        void* frames[MAXFRAMES];
+    };
+
+    // Initial-exec TLS, because the default model may allocate on first access from a preloaded library, which would
+    // recurse straight back into the malloc below
+    static thread_local int depth __attribute__((tls_model("initial-exec"))) = 0;
+    static thread_local bool recording __attribute__((tls_model("initial-exec"))) = false;
+
+    static Violation violations[MAXVIOLATIONS];
+    static std::atomic<int> numviolations(0);
+    static std::atomic<bool> reported(false);
+
+    static inline bool IsRealtime()
+    {
+        return depth > 0 && !recording;
+    }
+
+    static void Record(const char* what)
+    {
+        recording = true;
+        int index = numviolations.fetch_add(1, std::memory_order_relaxed);
+        if (index < MAXVIOLATIONS)
+        {
+            Violation& v = violations[index];
+            v.what = what;
+            v.numframes = backtrace(v.frames, MAXFRAMES);
+        }
+        recording = false;
+    }
+
+    template<typename F> static F Next(F& cached, const char* name)
+    {
+        // The lookup allocates; it's the checker's own business even when the first call comes from a callback
+        if (cached == NULL)
+        {
+            bool wasrecording = recording;
+            recording = true;
+            cached = (F)dlsym(RTLD_NEXT, name);
+            recording = wasrecording;
+        }
+        return cached;
+    }
+
+    // The first backtrace() loads the unwinder, which allocates; do it before any callback runs
+    __attribute__((constructor)) static void Init()
+    {
+        void* frames[2];
+        backtrace(frames, 2);
+    }
+
+    __attribute__((destructor)) static void Shutdown()
+    {
+        if (!reported.load() && numviolations.load() > 0)
+            RTCheckReport();
+    }
+}
+
+#define RTCHECK(what) \
+    if (RTCheck::IsRealtime()) \
+        RTCheck::Record(what)
+
+extern "C"
+{
+    void RTCheckEnter()
+    {
+        RTCheck::depth++;
+    }
+
+    void RTCheckLeave()
+    {
+        RTCheck::depth--;
+    }
+
+    int RTCheckGetNumViolations()
+    {
+        return RTCheck::numviolations.load();
+    }
+
+    void RTCheckReport()
+    {
+        RTCheck::reported.store(true);
+        int num = RTCheck::numviolations.load();
+        if (num == 0)
+            return;
+        fprintf(stderr, "RTCheck: %d real-time safety violation%s\n", num, (num == 1) ? "" : "s");
+        if (num > RTCheck::MAXVIOLATIONS)
+        {
+            fprintf(stderr, "RTCheck: only the first %d are shown\n", (int)RTCheck::MAXVIOLATIONS);
+            num = RTCheck::MAXVIOLATIONS;
+        }
+        fflush(stderr);
+        for (int n = 0; n < num; n++)
+        {
+            const RTCheck::Violation& v = RTCheck::violations[n];
+            dprintf(STDERR_FILENO, "\n#%d %s called from a process callback\n", n, v.what);
+            // Skip the frames of Record and of the hook itself
+            int skip = (v.numframes > 2) ? 2 : 0;
+            backtrace_symbols_fd(v.frames + skip, v.numframes - skip, STDERR_FILENO);
+        }
+    }
+
+    // Allocator. These go straight to glibc rather than through dlsym, which itself allocates.
+
+    void* malloc(size_t size)
+    {
+        RTCHECK("malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t num, size_t size)
+    {
+        RTCHECK("calloc");
+        return __libc_calloc(num, size);
+    }
+
+    void* realloc(void* ptr, size_t size)
+    {
+        RTCHECK("realloc");
+        return __libc_realloc(ptr, size);
+    }
+
+    void free(void* ptr)
+    {
+        if (ptr != NULL)
+            RTCHECK("free");
+        __libc_free(ptr);
+    }
+
+    void* memalign(size_t alignment, size_t size)
+    {
+        RTCHECK("memalign");
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        RTCHECK("aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** ptr, size_t alignment, size_t size)
+    {
+        RTCHECK("posix_memalign");
+        void* p = __libc_memalign(alignment, size);
+        if (p == NULL)
+            return ENOMEM;
+        *ptr = p;
+        return 0;
+    }
+
+    // Locks, waits and sleeps. Uncontended locks are cheap, but they are only uncontended until they aren't.
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex)
+    {
+        static int (*next)(pthread_mutex_t*);
+        RTCHECK("pthread_mutex_lock");
+        return RTCheck::Next(next, "pthread_mutex_lock")(mutex);
+    }
+
+    int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+    {
+        static int (*next)(pthread_cond_t*, pthread_mutex_t*);
+        RTCHECK("pthread_cond_wait");
+        return RTCheck::Next(next, "pthread_cond_wait")(cond, mutex);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+    {
+        static int (*next)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*);
+        RTCHECK("pthread_cond_timedwait");
+        return RTCheck::Next(next, "pthread_cond_timedwait")(cond, mutex, abstime);
+    }
+
+    // A signal is cheap when nobody waits, but wakes the waiter through the kernel when somebody does
+    int pthread_cond_signal(pthread_cond_t* cond)
+    {
+        static int (*next)(pthread_cond_t*);
+        RTCHECK("pthread_cond_signal");
+        return RTCheck::Next(next, "pthread_cond_signal")(cond);
+    }
+
+    int pthread_cond_broadcast(pthread_cond_t* cond)
+    {
+        static int (*next)(pthread_cond_t*);
+        RTCHECK("pthread_cond_broadcast");
+        return RTCheck::Next(next, "pthread_cond_broadcast")(cond);
+    }
+
+    // libstdc++ waits on and notifies std::atomic and semaphores through syscall(SYS_futex, ...)
+    long syscall(long number, ...)
+    {
+        static long (*next)(long, ...);
+        va_list args;
+        va_start(args, number);
+        long a[6];
+        for (int n = 0; n < 6; n++)
+            a[n] = va_arg(args, long);
+        va_end(args);
+        if (number == SYS_futex)
+            RTCHECK("futex");
+        return RTCheck::Next(next, "syscall")(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+    }
+
+    int pthread_join(pthread_t thread, void** retval)
+    {
+        static int (*next)(pthread_t, void**);
+        RTCHECK("pthread_join");
+        return RTCheck::Next(next, "pthread_join")(thread, retval);
+    }
+
+    int nanosleep(const struct timespec* req, struct timespec* rem)
+    {
+        static int (*next)(const struct timespec*, struct timespec*);
+        RTCHECK("nanosleep");
+        return RTCheck::Next(next, "nanosleep")(req, rem);
+    }
+
+    int usleep(useconds_t usec)
+    {
+        static int (*next)(useconds_t);
+        RTCHECK("usleep");
+        return RTCheck::Next(next, "usleep")(usec);
+    }
+
+    // File I/O
+
+    int open(const char* path, int flags, ...)
+    {
+        static int (*next)(const char*, int, ...);
+        mode_t mode = 0;
+        if (flags & (O_CREAT | O_TMPFILE))
+        {
+            va_list args;
+            va_start(args, flags);
+            mode = va_arg(args, mode_t);
+            va_end(args);
+        }
+        RTCHECK("open");
+        return RTCheck::Next(next, "open")(path, flags, mode);
+    }
+
+    ssize_t read(int fd, void* buf, size_t count)
+    {
+        static ssize_t (*next)(int, void*, size_t);
+        RTCHECK("read");
+        return RTCheck::Next(next, "read")(fd, buf, count);
+    }
+
+    ssize_t write(int fd, const void* buf, size_t count)
+    {
+        static ssize_t (*next)(int, const void*, size_t);
+        RTCHECK("write");
+        return RTCheck::Next(next, "write")(fd, buf, count);
+    }
+
+    FILE* fopen(const char* path, const char* mode)
+    {
+        static FILE* (*next)(const char*, const char*);
+        RTCHECK("fopen");
+        return RTCheck::Next(next, "fopen")(path, mode);
+    }
+
+    size_t fread(void* ptr, size_t size, size_t num, FILE* stream)
+    {
+        static size_t (*next)(void*, size_t, size_t, FILE*);
+        RTCHECK("fread");
+        return RTCheck::Next(next, "fread")(ptr, size, num, stream);
+    }
+
+    size_t fwrite(const void* ptr, size_t size, size_t num, FILE* stream)
+    {
+        static size_t (*next)(const void*, size_t, size_t, FILE*);
+        RTCHECK("fwrite");
+        return RTCheck::Next(next, "fwrite")(ptr, size, num, stream);
+    }
+
+    int fclose(FILE* stream)
+    {
+        static int (*next)(FILE*);
+        RTCHECK("fclose");
+        return RTCheck::Next(next, "fclose")(stream);
+    }
+}
+
+#else
+
+extern "C"
+{
+    void RTCheckEnter() {}
+    void RTCheckLeave() {}
+    int RTCheckGetNumViolations() { return 0; }
+    void RTCheckReport() {}
+}
+
+#endif
@@ -1,7 +1,9 @@
 BUILD_FLAGS=""
 BUILD_UNITY_PLUGIN=false
 INSTALL_UNITY_PLUGIN=false
-while getopts 'dpir' OPTION; do
+BUILD_TESTS=false
+PLUGIN_SOURCES="AudioPluginUtil.cpp Plugin_ConvolutionReverb.cpp Plugin_Howdy.cpp Plugin_LoudnessMeter.cpp Plugin_PitchDetector.cpp Plugin_UnitySynth.cpp"
+while getopts 'dpirt' OPTION; do
     case "$OPTION" in
         d) 
             BUILD_FLAGS="${BUILD_FLAGS}-g -O0"
@@ -15,6 +17,9 @@ while getopts 'dpir' OPTION; do
         i)
             INSTALL_UNITY_PLUGIN=true
             ;;
+        t)
+            BUILD_TESTS=true
+            ;;
         ?)
             echo "Unrecognized option ${OPTION}"
             exit 1
@@ -24,8 +29,15 @@ done
 
 (set -x ; clang++ -std=c++17 $BUILD_FLAGS standalone.cpp -l portaudio -o standalone.out)
 if [ "$BUILD_UNITY_PLUGIN" = true ]; then
-    #(set -x ; clang++ -std=c++17 -shared -rdynamic -fPIC -framework CoreMIDI -framework CoreFoundation AudioPluginUtil.cpp Plugin_Howdy.cpp Plugin_UnitySynth.cpp -o libAudioPluginHowdy.dylib)
-    (set -x ; clang++ -std=c++17 $BUILD_FLAGS -shared -rdynamic -fPIC AudioPluginUtil.cpp Plugin_Howdy.cpp Plugin_UnitySynth.cpp -o libAudioPluginHowdy.dylib)
+    #(set -x ; clang++ -std=c++17 -shared -rdynamic -fPIC -framework CoreMIDI -framework CoreFoundation $PLUGIN_SOURCES -o libAudioPluginHowdy.dylib)
+    (set -x ; clang++ -std=c++17 $BUILD_FLAGS -shared -rdynamic -fPIC $PLUGIN_SOURCES -o libAudioPluginHowdy.dylib)
+fi
+if [ "$BUILD_TESTS" = true ]; then
+    # Unit tests and benchmarks live in their own executable; run ./tests.out -b for benchmarks
+    (set -x ; clang++ -std=c++17 $BUILD_FLAGS $PLUGIN_SOURCES AudioPluginUtilTests.cpp -o tests.out && ./tests.out)
+    # The offline renderer runs the synth and every effect with the real-time safety checker linked in, and fails if
+    # any process callback allocates, locks, sleeps or touches files
+    (set -x ; clang++ -std=c++17 $BUILD_FLAGS $PLUGIN_SOURCES render.cpp RTCheck.cpp -ldl -pthread -o render.out && ./render.out -s 2 && ./render.out -a -s 2)
 fi
 if [ "$BUILD_UNITY_PLUGIN" = true ]; then
     (set -x ; cp libAudioPluginHowdy.dylib ~/games/audial/Assets/Plugins/x64/libAudioPluginDemo.dylib)
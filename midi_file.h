@@ -0,0 +1,382 @@
+#pragma once
+
+#include <limits.h>
+#include <math.h>
+
+#include <vector>
+
+#if !PLATFORM_WIN
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "synth_common.h"
+
+// Standard MIDI File player for the standalone synth. The file is memory-mapped and each track is decoded one message
+// at a time, only when the merge needs its next event, so a song costs the same to start whether it has a hundred
+// events or millions. Tempo changes are applied as the merged stream reaches them, which turns MIDI ticks into sample
+// times without building a tempo map up front.
+//
+// The player runs on the producer side of the engine's event queue: call FeedEventQueue from the thread that owns it
+// (the standalone's main thread, or the renderer between blocks) often enough that the queue never runs dry.
+namespace common {
+    // The synth handles events that arrive late by dropping them, so give the feeder some slack.
+    static inline int const kMidiEventQueueLength = 1024;
+
+    struct MappedFile {
+        const UInt8* data = nullptr;
+        size_t size = 0;
+#if PLATFORM_WIN
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = NULL;
+#endif
+    };
+
+    inline void UnmapFile(MappedFile& f) {
+#if PLATFORM_WIN
+        if (f.data != nullptr) {
+            UnmapViewOfFile(f.data);
+        }
+        if (f.mapping != NULL) {
+            CloseHandle(f.mapping);
+        }
+        if (f.file != INVALID_HANDLE_VALUE) {
+            CloseHandle(f.file);
+        }
+        f.mapping = NULL;
+        f.file = INVALID_HANDLE_VALUE;
+#else
+        if (f.data != nullptr) {
+            munmap((void*)f.data, f.size);
+        }
+#endif
+        f.data = nullptr;
+        f.size = 0;
+    }
+
+    inline bool MapFile(MappedFile& f, const char* path) {
+#if PLATFORM_WIN
+        f.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER size;
+        if (f.file == INVALID_HANDLE_VALUE || !GetFileSizeEx(f.file, &size) || size.QuadPart == 0) {
+            UnmapFile(f);
+            return false;
+        }
+        f.mapping = CreateFileMappingA(f.file, NULL, PAGE_READONLY, 0, 0, NULL);
+        f.data = (f.mapping != NULL) ? (const UInt8*)MapViewOfFile(f.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (f.data == nullptr) {
+            UnmapFile(f);
+            return false;
+        }
+        f.size = (size_t)size.QuadPart;
+#else
+        int const fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        f.data = (const UInt8*)p;
+        f.size = (size_t)st.st_size;
+#endif
+        return true;
+    }
+
+    enum class MidiMessage {
+        Channel, Tempo, EndOfTrack
+    };
+
+    // Read position in one track chunk, holding the next message that matters to the player. Everything else (sysex,
+    // other meta events, program changes, pitch bend) is skipped over, keeping its delta time.
+    struct MidiTrackCursor {
+        const UInt8* pos = nullptr;
+        const UInt8* end = nullptr;
+        UInt32 tick = 0;
+        UInt8 runningStatus = 0;
+        MidiMessage message = MidiMessage::EndOfTrack;
+        UInt8 status = 0;
+        UInt8 data1 = 0;
+        UInt8 data2 = 0;
+        UInt32 tempo = 0;  // Microseconds per quarter note
+    };
+
+    struct MidiPlayer {
+        MappedFile file;
+        int format = 0;
+        int division = 0;
+        std::vector<MidiTrackCursor> tracks;
+        int sampleRate = 0;
+
+        // Sample time is tempoSample + (tick - tempoTick) * samplesPerTick from the last tempo change on.
+        UInt32 tempoTick = 0;
+        double tempoSample = 0.0;
+        double samplesPerTick = 0.0;
+        bool smpte = false;
+
+        // An event that didn't fit in the queue last time.
+        bool havePending = false;
+        Event pending;
+
+        // The synth is monophonic and a NoteOff closes whatever is playing, so NoteOffs of notes that have since been
+        // replaced are dropped; otherwise the end of one note of a chord would cut off the next.
+        int soundingNote = -1;
+
+        long long numEventsFed = 0;
+    };
+
+    inline bool ReadVarLen(const UInt8*& p, const UInt8* end, UInt32& value) {
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (p >= end) {
+                return false;
+            }
+            UInt8 const b = *p++;
+            value = (value << 7) | (b & 0x7F);
+            if ((b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline UInt32 ReadBigEndian(const UInt8* p, int numBytes) {
+        UInt32 value = 0;
+        for (int i = 0; i < numBytes; ++i) {
+            value = (value << 8) | p[i];
+        }
+        return value;
+    }
+
+    // Decodes messages until one the player needs. A truncated or malformed track just ends early.
+    inline void AdvanceTrack(MidiTrackCursor& t) {
+        while (true) {
+            UInt32 delta, length;
+            if (!ReadVarLen(t.pos, t.end, delta) || t.pos >= t.end) {
+                t.message = MidiMessage::EndOfTrack;
+                return;
+            }
+            t.tick += delta;
+            UInt8 status = *t.pos;
+            if (status == 0xFF) {
+                if (t.end - t.pos < 2) {
+                    t.message = MidiMessage::EndOfTrack;
+                    return;
+                }
+                UInt8 const type = t.pos[1];
+                t.pos += 2;
+                if (!ReadVarLen(t.pos, t.end, length) || length > (UInt32)(t.end - t.pos) || type == 0x2F) {
+                    t.message = MidiMessage::EndOfTrack;
+                    return;
+                }
+                const UInt8* data = t.pos;
+                t.pos += length;
+                if (type == 0x51 && length == 3) {
+                    t.message = MidiMessage::Tempo;
+                    t.tempo = ReadBigEndian(data, 3);
+                    return;
+                }
+                continue;
+            }
+            if (status == 0xF0 || status == 0xF7) {
+                ++t.pos;
+                if (!ReadVarLen(t.pos, t.end, length) || length > (UInt32)(t.end - t.pos)) {
+                    t.message = MidiMessage::EndOfTrack;
+                    return;
+                }
+                t.pos += length;
+                continue;
+            }
+            if (status & 0x80) {
+                t.runningStatus = status;
+                ++t.pos;
+            } else if (t.runningStatus == 0) {
+                t.message = MidiMessage::EndOfTrack;
+                return;
+            } else {
+                status = t.runningStatus;
+            }
+            UInt8 const kind = status & 0xF0;
+            int const numDataBytes = (kind == 0xC0 || kind == 0xD0) ? 1 : 2;
+            if (t.end - t.pos < numDataBytes) {
+                t.message = MidiMessage::EndOfTrack;
+                return;
+            }
+            t.data1 = t.pos[0] & 0x7F;
+            t.data2 = (numDataBytes == 2) ? (t.pos[1] & 0x7F) : 0;
+            t.pos += numDataBytes;
+            if (kind == 0x80 || kind == 0x90 || kind == 0xA0 || kind == 0xB0 || kind == 0xD0) {
+                t.message = MidiMessage::Channel;
+                t.status = status;
+                return;
+            }
+        }
+    }
+
+    inline void SetTempo(MidiPlayer& player, UInt32 microsecondsPerQuarter) {
+        player.samplesPerTick = microsecondsPerQuarter * 1.0e-6 * player.sampleRate / player.division;
+    }
+
+    // Maps the file and reads the header and the track directory; no events are decoded yet.
+    inline bool OpenMidiFile(MidiPlayer& player, const char* path, int sampleRate) {
+        if (!MapFile(player.file, path)) {
+            return false;
+        }
+        const UInt8* p = player.file.data;
+        const UInt8* const end = p + player.file.size;
+        if (player.file.size < 14 || memcmp(p, "MThd", 4) != 0 || ReadBigEndian(p + 4, 4) < 6) {
+            UnmapFile(player.file);
+            return false;
+        }
+        player.format = (int)ReadBigEndian(p + 8, 2);
+        int const numTracks = (int)ReadBigEndian(p + 10, 2);
+        player.division = (int)ReadBigEndian(p + 12, 2);
+        player.sampleRate = sampleRate;
+        p += 8 + ReadBigEndian(p + 4, 4);
+
+        // Chunks other than MTrk are skipped, as the spec asks.
+        player.tracks.clear();
+        while ((int)player.tracks.size() < numTracks && end - p >= 8) {
+            UInt32 const length = ReadBigEndian(p + 4, 4);
+            const UInt8* const data = p + 8;
+            const UInt8* const next = (length > (UInt32)(end - data)) ? end : data + length;
+            if (memcmp(p, "MTrk", 4) == 0) {
+                MidiTrackCursor t;
+                t.pos = data;
+                t.end = next;
+                AdvanceTrack(t);
+                player.tracks.push_back(t);
+            }
+            p = next;
+        }
+
+        if (player.division & 0x8000) {
+            // SMPTE time: frames per second (negative, 29 meaning 29.97) and ticks per frame; tempo events don't apply.
+            int const fps = -(int)(SInt8)(player.division >> 8);
+            double const framesPerSecond = (fps == 29) ? 29.97 : fps;
+            int const ticksPerFrame = player.division & 0xFF;
+            player.smpte = true;
+            player.samplesPerTick = (framesPerSecond > 0.0 && ticksPerFrame > 0) ? sampleRate / (framesPerSecond * ticksPerFrame) : 0.0;
+        } else {
+            player.smpte = false;
+            if (player.division == 0) {
+                UnmapFile(player.file);
+                return false;
+            }
+            SetTempo(player, 500000);  // 120 bpm until told otherwise
+        }
+        player.tempoTick = 0;
+        player.tempoSample = 0.0;
+        player.havePending = false;
+        player.soundingNote = -1;
+        player.numEventsFed = 0;
+        return true;
+    }
+
+    inline void CloseMidiFile(MidiPlayer& player) {
+        player.tracks.clear();
+        UnmapFile(player.file);
+    }
+
+    // Next synth event in time order across all tracks, with its time in samples. Returns false at the end of the song.
+    inline bool NextMidiEvent(MidiPlayer& player, Event& e) {
+        while (true) {
+            // Ties go to the earlier track, so events keep the order the file gives them.
+            MidiTrackCursor* t = nullptr;
+            for (MidiTrackCursor& track : player.tracks) {
+                if (track.message != MidiMessage::EndOfTrack && (t == nullptr || track.tick < t->tick)) {
+                    t = &track;
+                }
+            }
+            if (t == nullptr) {
+                return false;
+            }
+
+            double const sample = player.tempoSample + (double)(t->tick - player.tempoTick) * player.samplesPerTick;
+            if (t->message == MidiMessage::Tempo) {
+                if (!player.smpte && t->tempo > 0) {
+                    player.tempoSample = sample;
+                    player.tempoTick = t->tick;
+                    SetTempo(player, t->tempo);
+                }
+                AdvanceTrack(*t);
+                continue;
+            }
+
+            e = Event();
+            e.timeInTicks = (sample < (double)INT_MAX) ? (int)llround(sample) : INT_MAX;
+            UInt8 const kind = t->status & 0xF0;
+            bool use = true;
+            if (kind == 0x90 && t->data2 > 0) {
+                e.type = EventType::NoteOn;
+                e.midiNote = t->data1;
+                e.value = t->data2;
+                player.soundingNote = t->data1;
+            } else if (kind == 0x80 || kind == 0x90) {
+                e.type = EventType::NoteOff;
+                e.midiNote = t->data1;
+                use = (t->data1 == player.soundingNote);
+                if (use) {
+                    player.soundingNote = -1;
+                }
+            } else if (kind == 0xB0) {
+                e.type = EventType::ControlChange;
+                e.midiNote = t->data1;
+                e.value = t->data2;
+            } else if (kind == 0xA0) {
+                // Polyphonic pressure only matters for the note that's playing.
+                e.type = EventType::Aftertouch;
+                e.value = t->data2;
+                use = (t->data1 == player.soundingNote);
+            } else {
+                e.type = EventType::Aftertouch;
+                e.value = t->data1;
+            }
+            AdvanceTrack(*t);
+            if (use) {
+                return true;
+            }
+        }
+    }
+
+    // Pushes events until the queue is full or the song has ended. Returns the number of events pushed.
+    inline int FeedEventQueue(MidiPlayer& player, EventQueue* queue) {
+        int numPushed = 0;
+        while (true) {
+            if (!player.havePending) {
+                if (!NextMidiEvent(player, player.pending)) {
+                    break;
+                }
+                player.havePending = true;
+            }
+            if (!queue->try_push(player.pending)) {
+                break;
+            }
+            player.havePending = false;
+            ++numPushed;
+        }
+        player.numEventsFed += numPushed;
+        return numPushed;
+    }
+
+    inline bool IsMidiFileFinished(MidiPlayer const& player) {
+        if (player.havePending) {
+            return false;
+        }
+        for (MidiTrackCursor const& track : player.tracks) {
+            if (track.message != MidiMessage::EndOfTrack) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
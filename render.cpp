@@ -0,0 +1,239 @@
+// Offline renderer: runs the standalone synth, or the effects in PluginList.h, through the same process callbacks a
+// host would call, as fast as it can, and optionally writes the result to a 32-bit float WAV file.
+//
+//   render.out [-e effect | -a | -m file.mid] [-s seconds] [-r samplerate] [-b blocksize] [-o file.wav]
+//
+// Without -e it renders the standalone's demo sequence, or with -m a Standard MIDI File, streamed into the synth's
+// event queue block by block as the standalone does; -a renders every effect in turn. Effects get a pink noise burst
+// on their input, and "Demo HowdySynth" and "Demo UnitySynth" are also sent a run of notes through their own entry
+// points. PluginList.h only registers UnitySynth where Unity feeds it MIDI, so elsewhere it's declared here.
+// With RTCheck.cpp linked in or preloaded, the exit code is nonzero if any callback did something a real-time thread
+// mustn't do, and the offending calls are listed with their stack traces.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "synth_common.h"
+#include "midi_file.h"
+
+extern "C" bool NoteOn(int midiNum, int ticksUntilEvent);
+extern "C" bool NoteOff(int midiNum, int ticksUntilEvent);
+extern "C" void UnitySynth_AddMessage(UInt64 sample, int msg);
+
+namespace UnitySynth {
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char* valuestr);
+    UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples);
+    int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition);
+}
+
+#if PLUGINUTIL_USE_RTCHECK
+extern "C" int RTCheckGetNumViolations() __attribute__((weak));
+extern "C" void RTCheckReport() __attribute__((weak));
+#endif
+
+struct Settings {
+    const char* effect = NULL;
+    bool allEffects = false;
+    const char* midiPath = NULL;
+    float seconds = 5.0f;
+    int sampleRate = 44100;
+    int blockSize = 64;
+    const char* outputPath = NULL;
+};
+
+static const int kNumChannels = 2;
+
+static void Usage() {
+    fprintf(stderr, "usage: render.out [-e effect | -a | -m file.mid] [-s seconds] [-r samplerate] [-b blocksize] [-o file.wav]\n");
+}
+
+static bool ParseArgs(int argc, char** argv, Settings& settings) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-a") == 0) {
+            settings.allEffects = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "-e") == 0)
+            settings.effect = value;
+        else if (strcmp(arg, "-s") == 0)
+            settings.seconds = (float)atof(value);
+        else if (strcmp(arg, "-r") == 0)
+            settings.sampleRate = atoi(value);
+        else if (strcmp(arg, "-b") == 0)
+            settings.blockSize = atoi(value);
+        else if (strcmp(arg, "-o") == 0)
+            settings.outputPath = value;
+        else if (strcmp(arg, "-m") == 0)
+            settings.midiPath = value;
+        else
+            return false;
+    }
+    return settings.seconds > 0.0f && settings.sampleRate > 0 && settings.blockSize > 0;
+}
+
+static bool WriteWav(const char* path, const float* samples, int numFrames, int numChannels, int sampleRate) {
+    FILE* f = fopen(path, "wb");
+    if (f == NULL)
+        return false;
+    UInt32 dataSize = (UInt32)numFrames * numChannels * sizeof(float);
+    UInt32 riffSize = 4 + 8 + 16 + 8 + dataSize;
+    UInt32 fmtSize = 16, byteRate = sampleRate * numChannels * sizeof(float), rate = sampleRate;
+    UInt16 format = 3 /* IEEE float */, channels = numChannels, blockAlign = numChannels * sizeof(float), bits = 32;
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riffSize, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmtSize, 4, 1, f);
+    fwrite(&format, 2, 1, f);
+    fwrite(&channels, 2, 1, f);
+    fwrite(&rate, 4, 1, f);
+    fwrite(&byteRate, 4, 1, f);
+    fwrite(&blockAlign, 2, 1, f);
+    fwrite(&bits, 2, 1, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&dataSize, 4, 1, f);
+    size_t written = fwrite(samples, sizeof(float), (size_t)numFrames * numChannels, f);
+    return fclose(f) == 0 && written == (size_t)numFrames * numChannels;
+}
+
+// Same work per block as the PortAudio callback in standalone.cpp
+static bool RenderSynth(const Settings& settings, float* output, int numFrames) {
+    common::StateData state;
+    common::MidiPlayer midi;
+    common::EventQueue eventQueue((settings.midiPath != NULL) ? common::kMidiEventQueueLength : common::kEventQueueLength);
+    if (settings.midiPath != NULL) {
+        if (!common::OpenMidiFile(midi, settings.midiPath, settings.sampleRate)) {
+            fprintf(stderr, "Can't read MIDI file %s\n", settings.midiPath);
+            return false;
+        }
+    } else {
+        common::InitEventQueueWithSequence(&eventQueue, settings.sampleRate);
+    }
+    common::InitStateData(state, &eventQueue, settings.sampleRate);
+    for (int offset = 0; offset < numFrames; offset += settings.blockSize) {
+        int length = std::min(settings.blockSize, numFrames - offset);
+        if (settings.midiPath != NULL) {
+            common::FeedEventQueue(midi, &eventQueue);
+        }
+        AudioPluginUtil::DenormalGuard denormalGuard;
+        AudioPluginUtil::RealtimeScope realtimeScope;
+        common::Process(&state, output + offset * kNumChannels, kNumChannels, length, settings.sampleRate);
+    }
+    if (settings.midiPath != NULL) {
+        printf("MIDI events: %lld%s\n", midi.numEventsFed, common::IsMidiFileFinished(midi) ? " (end of song)" : "");
+        common::CloseMidiFile(midi);
+    }
+    return true;
+}
+
+static bool RenderEffect(const Settings& settings, UnityAudioEffectDefinition* definition, float* output, int numFrames) {
+    UnityAudioEffectState state;
+    memset(&state, 0, sizeof(state));
+    state.structsize = sizeof(state);
+    state.samplerate = settings.sampleRate;
+    state.flags = UnityAudioEffectStateFlags_IsPlaying;
+    state.dspbuffersize = settings.blockSize;
+    state.hostapiversion = UNITY_AUDIO_PLUGIN_API_VERSION;
+    state.internal = &state;
+    if (definition->create(&state) != UNITY_AUDIODSP_OK) {
+        fprintf(stderr, "%s: create failed\n", definition->name);
+        return false;
+    }
+
+    int const samplesPerBeat = (settings.sampleRate * 60) / 200;
+    if (strcmp(definition->name, "Demo HowdySynth") == 0) {
+        for (int i = 0; i < 16; ++i) {
+            NoteOn(69 + i, samplesPerBeat * i);
+            NoteOff(69 + i, samplesPerBeat * i + samplesPerBeat / 2);
+        }
+    } else if (strcmp(definition->name, "Demo UnitySynth") == 0) {
+        for (int i = 0; i < 16; ++i) {
+            UnitySynth_AddMessage(samplesPerBeat * i, 0x90 | ((57 + i) << 8) | (100 << 16));
+            UnitySynth_AddMessage(samplesPerBeat * i + samplesPerBeat / 2, 0x80 | ((57 + i) << 8));
+        }
+    }
+
+    // Half a second of pink noise, then silence so tails and detectors see both
+    std::vector<float> input((size_t)numFrames * kNumChannels, 0.0f);
+    AudioPluginUtil::NoiseSource noise;
+    noise.Init(12345);
+    int burst = std::min(numFrames, settings.sampleRate / 2) * kNumChannels;
+    noise.Process(input.data(), burst, AudioPluginUtil::NoiseSource::Color_Pink);
+
+    for (int offset = 0; offset < numFrames; offset += settings.blockSize) {
+        int length = std::min(settings.blockSize, numFrames - offset);
+        state.currdsptick = offset;
+        definition->process(&state, input.data() + offset * kNumChannels, output + offset * kNumChannels, length, kNumChannels, kNumChannels);
+        state.prevdsptick = state.currdsptick;
+    }
+
+    definition->release(&state);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Settings settings;
+    if (!ParseArgs(argc, argv, settings)) {
+        Usage();
+        return 1;
+    }
+
+    int numFrames = (int)(settings.seconds * settings.sampleRate);
+    std::vector<float> output((size_t)numFrames * kNumChannels, 0.0f);
+
+    if (settings.effect == NULL && !settings.allEffects) {
+        printf("Rendering synth: %.1f s at %d Hz in blocks of %d\n", settings.seconds, settings.sampleRate, settings.blockSize);
+        if (!RenderSynth(settings, output.data(), numFrames))
+            return 1;
+    } else {
+        UnityAudioEffectDefinition** registered;
+        int numRegistered = UnityGetAudioEffectDefinitions(&registered);
+        std::vector<UnityAudioEffectDefinition*> definitions(registered, registered + numRegistered);
+        bool unitySynthRegistered = false;
+        for (UnityAudioEffectDefinition* definition : definitions)
+            unitySynthRegistered = unitySynthRegistered || strcmp(definition->name, "Demo UnitySynth") == 0;
+        static UnityAudioEffectDefinition unitySynth;
+        if (!unitySynthRegistered) {
+            AudioPluginUtil::DeclareEffect(unitySynth, "Demo UnitySynth", UnitySynth::CreateCallback, UnitySynth::ReleaseCallback,
+                UnitySynth::ProcessCallback, UnitySynth::SetFloatParameterCallback, UnitySynth::GetFloatParameterCallback,
+                UnitySynth::GetFloatBufferCallback, UnitySynth::InternalRegisterEffectDefinition);
+            definitions.push_back(&unitySynth);
+        }
+
+        int numRendered = 0;
+        for (UnityAudioEffectDefinition* definition : definitions) {
+            if (!settings.allEffects && strcmp(definition->name, settings.effect) != 0)
+                continue;
+            printf("Rendering %s: %.1f s at %d Hz in blocks of %d\n", definition->name, settings.seconds, settings.sampleRate, settings.blockSize);
+            if (!RenderEffect(settings, definition, output.data(), numFrames))
+                return 1;
+            ++numRendered;
+        }
+        if (numRendered == 0) {
+            fprintf(stderr, "No effect named \"%s\"\n", settings.effect);
+            return 1;
+        }
+    }
+
+    if (settings.outputPath != NULL && !WriteWav(settings.outputPath, output.data(), numFrames, kNumChannels, settings.sampleRate)) {
+        fprintf(stderr, "Could not write %s\n", settings.outputPath);
+        return 1;
+    }
+
+#if PLUGINUTIL_USE_RTCHECK
+    if (RTCheckGetNumViolations && RTCheckGetNumViolations() > 0) {
+        RTCheckReport();
+        return 2;
+    }
+#endif
+    return 0;
+}
@@ -1,13 +1,128 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include "portaudio.h"
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
 #include "synth_common.h"
+#include "midi_file.h"
+
+// Plays the demo sequence on the default output device, or on the one given with -d. For qualifying hardware the
+// host locks its memory, runs the audio thread with SCHED_FIFO priority (optionally pinned to one CPU), and reports
+// the stream latency, the callback load and every xrun PortAudio told it about when it exits.
+//
+//   standalone.out [-l] [-d device] [-r samplerate] [-b framesperbuffer] [-t seconds] [-p priority] [-c cpu] [-o file]
+//                  [-m file.mid]
+//
+// -m plays a Standard MIDI File instead of the demo sequence. The main thread streams its events into the synth's queue
+// while the stream runs, a queue's worth ahead of the audio thread.
+// -l lists the output devices. -p 0 leaves the audio thread's scheduling alone. -o records the output to a 32-bit float
+// WAV file if the name ends in .wav, or to raw interleaved floats otherwise; the callback only copies each block into a
+// ring that a background thread drains to disk, so recording a long soak test doesn't change the callback's timing. Real-time priority and memory
+// locking need the right limits (e.g. rtprio and memlock in /etc/security/limits.conf); failures are reported, not fatal.
+
+#define DEFAULT_SECONDS   (5)
+#define DEFAULT_SAMPLE_RATE   (44100)
+#define DEFAULT_FRAMES_PER_BUFFER  (64)
+#define DEFAULT_PRIORITY  (80)
+#define MAX_XRUNS  (1024)
+#define STACK_PREFAULT_BYTES  (128 * 1024)
+#define RECORD_RING_SECONDS  (8)
+#define RECORD_CHUNK_BYTES  (256 * 1024)
+#define RECORD_ALIGNMENT  (4096)
+#define RECORD_POLL_MS  (10)
+#define MIDI_FEED_MS  (5)
+
+struct Settings {
+    int device = paNoDevice;
+    int sampleRate = DEFAULT_SAMPLE_RATE;
+    int framesPerBuffer = DEFAULT_FRAMES_PER_BUFFER;
+    float seconds = DEFAULT_SECONDS;
+    int priority = DEFAULT_PRIORITY;
+    int cpu = -1;
+    bool listDevices = false;
+    const char* recordPath = NULL;
+    const char* midiPath = NULL;
+};
+
+struct Xrun {
+    double time;  // seconds since the first callback
+    PaStreamCallbackFlags flags;
+};
+
+// The audio thread writes into the ring; the writer thread moves it to a staging chunk and writes that out whole. The
+// WAV header is padded to RECORD_ALIGNMENT bytes, so every chunk lands on an aligned file offset.
+struct Recorder {
+    AudioPluginUtil::StreamRing ring;
+    float* ringStorage = NULL;
+    char* chunk = NULL;
+    int chunkUsed = 0;
+    FILE* file = NULL;
+    bool wav = false;
+    int sampleRate = 0;
+    std::thread writer;
+    std::atomic<bool> stopRequested{false};
+    long long bytesWritten = 0;  // Sample data only, without the header
+    int writeError = 0;
+};
 
-#define NUM_SECONDS   (5)
-#define SAMPLE_RATE   (44100)
-#define FRAMES_PER_BUFFER  (64)
+struct HostData {
+    common::StateData state;
+    Settings settings;
+    Recorder* recorder = NULL;
+
+    // Written by the audio thread, read by main once the stream has stopped.
+    bool audioThreadReady = false;
+    int schedResult = 0;
+    int affinityResult = 0;
+    double firstCallbackTime = 0.0;
+    std::atomic<int> numXruns{0};
+    Xrun xruns[MAX_XRUNS];
+    long long numCallbacks = 0;
+    double maxCallbackSeconds = 0.0;
+    double totalCallbackSeconds = 0.0;
+};
+
+// Touches the stack the audio thread may grow into, so the first deep call chain doesn't page fault.
+static void __attribute__((noinline)) PrefaultStack() {
+    char stack[STACK_PREFAULT_BYTES];
+    volatile char* p = stack;
+    for (int i = 0; i < STACK_PREFAULT_BYTES; i += 4096) {
+        p[i] = 0;
+    }
+}
+
+// Runs once, on the audio thread, from its first callback.
+static void SetupAudioThread(HostData* host) {
+#if !defined(_WIN32)
+    if (host->settings.priority > 0) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = host->settings.priority;
+        host->schedResult = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+#endif
+#if defined(__linux__)
+    if (host->settings.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(host->settings.cpu, &cpus);
+        host->affinityResult = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+    PrefaultStack();
+    host->audioThreadReady = true;
+}
 
 static int Callback(
     const void *inputBuffer, void *outputBuffer,
@@ -15,11 +130,168 @@ static int Callback(
     const PaStreamCallbackTimeInfo* timeInfo,
     PaStreamCallbackFlags statusFlags,
     void *userData) {
-    common::StateData* state = (common::StateData*)userData;
-    common::Process(state, (float*)outputBuffer, /*numChannels=*/2, framesPerBuffer, SAMPLE_RATE);
+    AudioPluginUtil::DenormalGuard denormalGuard;
+    HostData* host = (HostData*)userData;
+    if (!host->audioThreadReady) {
+        SetupAudioThread(host);
+        host->firstCallbackTime = timeInfo->currentTime;
+    }
+
+    AudioPluginUtil::RealtimeScope realtimeScope;
+    auto const start = std::chrono::steady_clock::now();
+
+    PaStreamCallbackFlags const xrunFlags = paOutputUnderflow | paOutputOverflow | paInputUnderflow | paInputOverflow;
+    if (statusFlags & xrunFlags) {
+        int const n = host->numXruns.load(std::memory_order_relaxed);
+        if (n < MAX_XRUNS) {
+            host->xruns[n].time = timeInfo->currentTime - host->firstCallbackTime;
+            host->xruns[n].flags = statusFlags & xrunFlags;
+        }
+        host->numXruns.store(n + 1, std::memory_order_release);
+    }
+
+    common::Process(&host->state, (float*)outputBuffer, /*numChannels=*/2, framesPerBuffer, host->settings.sampleRate);
+    if (host->recorder != NULL) {
+        host->recorder->ring.Write((const float*)outputBuffer, (int)framesPerBuffer * 2);
+    }
+
+    double const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    host->totalCallbackSeconds += elapsed;
+    if (elapsed > host->maxCallbackSeconds) {
+        host->maxCallbackSeconds = elapsed;
+    }
+    ++host->numCallbacks;
     return paContinue;
 }
 
+static void* AllocAligned(size_t size) {
+#if defined(_WIN32)
+    return _aligned_malloc(size, RECORD_ALIGNMENT);
+#else
+    void* p = NULL;
+    return (posix_memalign(&p, RECORD_ALIGNMENT, size) == 0) ? p : NULL;
+#endif
+}
+
+static void FreeAligned(void* p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static void WriteChunk(Recorder* rec, int numBytes) {
+    if (rec->writeError == 0 && fwrite(rec->chunk, 1, numBytes, rec->file) != (size_t)numBytes) {
+        rec->writeError = errno;
+    }
+    rec->bytesWritten += numBytes;
+    rec->chunkUsed = 0;
+}
+
+// Moves everything the audio thread has written so far out of the ring, writing each chunk as it fills up.
+static void DrainRing(Recorder* rec) {
+    const float* data;
+    int num;
+    while ((num = rec->ring.GetReadable(data)) > 0) {
+        int const room = (RECORD_CHUNK_BYTES - rec->chunkUsed) / (int)sizeof(float);
+        int const n = std::min(num, room);
+        memcpy(rec->chunk + rec->chunkUsed, data, n * sizeof(float));
+        rec->ring.Consume(n);
+        rec->chunkUsed += n * sizeof(float);
+        if (rec->chunkUsed == RECORD_CHUNK_BYTES) {
+            WriteChunk(rec, RECORD_CHUNK_BYTES);
+        }
+    }
+}
+
+static void WriterThread(Recorder* rec) {
+    while (!rec->stopRequested.load(std::memory_order_acquire)) {
+        DrainRing(rec);
+        std::this_thread::sleep_for(std::chrono::milliseconds(RECORD_POLL_MS));
+    }
+    DrainRing(rec);
+    if (rec->chunkUsed > 0) {
+        WriteChunk(rec, rec->chunkUsed);
+    }
+}
+
+// RIFF header, fmt chunk, a JUNK chunk up to the alignment and the data chunk header. Written again with the final sizes.
+static void WriteWavHeader(FILE* f, int sampleRate, long long dataBytes) {
+    char header[RECORD_ALIGNMENT];
+    memset(header, 0, sizeof(header));
+    UInt32 const dataSize = (dataBytes > 0xFFFFFFFFLL - RECORD_ALIGNMENT) ? (0xFFFFFFFFu - RECORD_ALIGNMENT) : (UInt32)dataBytes;
+    UInt32 const riffSize = RECORD_ALIGNMENT - 8 + dataSize;
+    UInt32 const fmtSize = 16, rate = sampleRate, byteRate = sampleRate * 2 * sizeof(float);
+    UInt16 const format = 3 /* IEEE float */, channels = 2, blockAlign = 2 * sizeof(float), bits = 32;
+    UInt32 const junkSize = RECORD_ALIGNMENT - 12 - (8 + fmtSize) - 8 - 8;
+    char* p = header;
+    memcpy(p, "RIFF", 4); memcpy(p + 4, &riffSize, 4); memcpy(p + 8, "WAVE", 4); p += 12;
+    memcpy(p, "fmt ", 4); memcpy(p + 4, &fmtSize, 4); p += 8;
+    memcpy(p, &format, 2); memcpy(p + 2, &channels, 2); memcpy(p + 4, &rate, 4);
+    memcpy(p + 8, &byteRate, 4); memcpy(p + 12, &blockAlign, 2); memcpy(p + 14, &bits, 2); p += fmtSize;
+    memcpy(p, "JUNK", 4); memcpy(p + 4, &junkSize, 4); p += 8 + junkSize;
+    memcpy(p, "data", 4); memcpy(p + 4, &dataSize, 4);
+    fwrite(header, 1, sizeof(header), f);
+}
+
+static Recorder* CreateRecorder(const char* path, int sampleRate) {
+    Recorder* rec = new Recorder();
+    size_t const len = strlen(path);
+    rec->wav = len >= 4 && strcmp(path + len - 4, ".wav") == 0;
+    rec->sampleRate = sampleRate;
+
+    int capacity = 1;
+    while (capacity < RECORD_RING_SECONDS * sampleRate * 2)
+        capacity *= 2;
+    rec->ringStorage = (float*)AllocAligned(capacity * sizeof(float));
+    rec->chunk = (char*)AllocAligned(RECORD_CHUNK_BYTES);
+    rec->file = fopen(path, "wb");
+    if (rec->ringStorage == NULL || rec->chunk == NULL || rec->file == NULL) {
+        fprintf(stderr, "Error: Can't record to %s: %s\n", path, strerror(errno));
+        if (rec->file != NULL)
+            fclose(rec->file);
+        FreeAligned(rec->ringStorage);
+        FreeAligned(rec->chunk);
+        delete rec;
+        return NULL;
+    }
+
+    // Touch the ring now rather than page faulting on the audio thread the first time round
+    memset(rec->ringStorage, 0, capacity * sizeof(float));
+    rec->ring.Init(rec->ringStorage, capacity);
+
+    // Chunks are written straight through, without another copy into stdio's buffer
+    setvbuf(rec->file, NULL, _IONBF, 0);
+    if (rec->wav)
+        WriteWavHeader(rec->file, sampleRate, 0);
+    rec->writer = std::thread(WriterThread, rec);
+    return rec;
+}
+
+// Call once the stream has stopped; writes out what's left and finishes the file.
+static void StopRecorder(Recorder* rec) {
+    rec->stopRequested.store(true, std::memory_order_release);
+    rec->writer.join();
+    if (rec->wav && rec->writeError == 0 && fseek(rec->file, 0, SEEK_SET) == 0)
+        WriteWavHeader(rec->file, rec->sampleRate, rec->bytesWritten);
+    if (fclose(rec->file) != 0 && rec->writeError == 0)
+        rec->writeError = errno;
+}
+
+static void DestroyRecorder(Recorder* rec) {
+    FreeAligned(rec->ringStorage);
+    FreeAligned(rec->chunk);
+    delete rec;
+}
+
+static void DeleteMidiPlayer(common::MidiPlayer* midi) {
+    if (midi != NULL) {
+        common::CloseMidiFile(*midi);
+        delete midi;
+    }
+}
+
 /*
  * This routine is called by portaudio when playback is done.
  */
@@ -30,31 +302,167 @@ static void StreamFinished( void* userData )
     printf("Stream completed\n");
 }
 
+static void Usage() {
+    fprintf(stderr, "usage: standalone.out [-l] [-d device] [-r samplerate] [-b framesperbuffer] [-t seconds] [-p priority] [-c cpu] [-o file] [-m file.mid]\n");
+}
+
+static bool ParseArgs(int argc, char** argv, Settings& settings) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-l") == 0) {
+            settings.listDevices = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        const char* value = argv[++i];
+        if (strcmp(arg, "-d") == 0)
+            settings.device = atoi(value);
+        else if (strcmp(arg, "-r") == 0)
+            settings.sampleRate = atoi(value);
+        else if (strcmp(arg, "-b") == 0)
+            settings.framesPerBuffer = atoi(value);
+        else if (strcmp(arg, "-t") == 0)
+            settings.seconds = (float)atof(value);
+        else if (strcmp(arg, "-p") == 0)
+            settings.priority = atoi(value);
+        else if (strcmp(arg, "-c") == 0)
+            settings.cpu = atoi(value);
+        else if (strcmp(arg, "-o") == 0)
+            settings.recordPath = value;
+        else if (strcmp(arg, "-m") == 0)
+            settings.midiPath = value;
+        else
+            return false;
+    }
+    return settings.sampleRate > 0 && settings.framesPerBuffer > 0 && settings.seconds > 0.0f;
+}
+
+static void ListDevices() {
+    PaDeviceIndex const defaultDevice = Pa_GetDefaultOutputDevice();
+    for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); ++i) {
+        const PaDeviceInfo* info = Pa_GetDeviceInfo(i);
+        if (info->maxOutputChannels < 2)
+            continue;
+        printf("%c%3d: %s (%d channels, %.0f Hz, low latency %.1f ms)\n", (i == defaultDevice) ? '*' : ' ', i, info->name,
+            info->maxOutputChannels, info->defaultSampleRate, info->defaultLowOutputLatency * 1000.0);
+    }
+}
+
+static void PrintReport(HostData const* host, const PaStreamInfo* streamInfo, common::MidiPlayer const* midi) {
+    Settings const& settings = host->settings;
+    double const period = (double)settings.framesPerBuffer / settings.sampleRate;
+    printf("\n--- Report ---\n");
+    printf("Buffer: %d frames at %d Hz (%.2f ms)\n", settings.framesPerBuffer, settings.sampleRate, period * 1000.0);
+    if (streamInfo != NULL)
+        printf("Stream output latency: %.2f ms\n", streamInfo->outputLatency * 1000.0);
+#if !defined(_WIN32)
+    if (settings.priority > 0)
+        printf("SCHED_FIFO priority %d: %s\n", settings.priority, host->schedResult == 0 ? "ok" : strerror(host->schedResult));
+#endif
+#if defined(__linux__)
+    if (settings.cpu >= 0)
+        printf("Audio thread on CPU %d: %s\n", settings.cpu, host->affinityResult == 0 ? "ok" : strerror(host->affinityResult));
+#endif
+    if (host->numCallbacks > 0) {
+        double const mean = host->totalCallbackSeconds / host->numCallbacks;
+        printf("Callbacks: %lld, mean %.1f us (%.1f%% of the period), max %.1f us (%.1f%%)\n", host->numCallbacks,
+            mean * 1.0e6, 100.0 * mean / period, host->maxCallbackSeconds * 1.0e6, 100.0 * host->maxCallbackSeconds / period);
+    }
+
+    int const numXruns = host->numXruns.load(std::memory_order_acquire);
+    printf("Xruns: %d\n", numXruns);
+    for (int i = 0; i < numXruns && i < MAX_XRUNS; ++i) {
+        Xrun const& x = host->xruns[i];
+        printf("  %10.4f s:%s%s%s%s\n", x.time,
+            (x.flags & paOutputUnderflow) ? " output underflow" : "",
+            (x.flags & paOutputOverflow) ? " output overflow" : "",
+            (x.flags & paInputUnderflow) ? " input underflow" : "",
+            (x.flags & paInputOverflow) ? " input overflow" : "");
+    }
+    if (numXruns > MAX_XRUNS)
+        printf("  ... and %d more\n", numXruns - MAX_XRUNS);
+
+    if (midi != NULL)
+        printf("MIDI events: %lld%s\n", midi->numEventsFed, common::IsMidiFileFinished(*midi) ? " (end of song)" : "");
+
+    Recorder const* rec = host->recorder;
+    if (rec != NULL) {
+        double const samplesPerSecond = 2.0 * settings.sampleRate;
+        int const capacity = rec->ring.GetCapacity(), highWater = rec->ring.GetHighWater();
+        printf("Recorded %s: %.2f s, %lld bytes%s%s\n", settings.recordPath, rec->bytesWritten / (sizeof(float) * samplesPerSecond),
+            rec->bytesWritten, rec->writeError ? ", write error: " : "", rec->writeError ? strerror(rec->writeError) : "");
+        printf("Record ring: %.2f s, high water %.3f s (%.1f%%), dropped blocks %d\n", capacity / samplesPerSecond,
+            highWater / samplesPerSecond, 100.0 * highWater / capacity, rec->ring.GetNumDropped());
+    }
+}
+
 /*******************************************************************/
-int main(void);
-int main(void)
+int main(int argc, char** argv)
 {
     PaStreamParameters outputParameters;
     PaStream *stream;
     PaError err;
-    int i;
+    HostData* host;
+    common::MidiPlayer* midi = NULL;
 
-    
-    printf("PortAudio Test: output sine wave. SR = %d, BufSize = %d\n", SAMPLE_RATE, FRAMES_PER_BUFFER);
+    Settings settings;
+    if (!ParseArgs(argc, argv, settings)) {
+        Usage();
+        return 1;
+    }
 
-    common::StateData state;
-    common::EventQueue eventQueue(common::kEventQueueLength);
-    common::InitEventQueueWithSequence(&eventQueue, SAMPLE_RATE);
-    common::InitStateData(state, &eventQueue, SAMPLE_RATE);
+#if !defined(_WIN32)
+    // Everything mapped now and later stays resident, so the audio thread never waits for a page to come back.
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "Warning: mlockall failed: %s\n", strerror(errno));
+#endif
+
+    host = new HostData();
+    host->settings = settings;
+    common::EventQueue eventQueue((settings.midiPath != NULL) ? common::kMidiEventQueueLength : common::kEventQueueLength);
+    if (settings.midiPath != NULL) {
+        midi = new common::MidiPlayer();
+        if (!common::OpenMidiFile(*midi, settings.midiPath, settings.sampleRate)) {
+            fprintf(stderr, "Error: Can't read MIDI file %s\n", settings.midiPath);
+            delete midi;
+            delete host;
+            return 1;
+        }
+        printf("MIDI file: format %d, %d tracks\n", midi->format, (int)midi->tracks.size());
+        common::FeedEventQueue(*midi, &eventQueue);
+    } else {
+        common::InitEventQueueWithSequence(&eventQueue, settings.sampleRate);
+    }
+    common::InitStateData(host->state, &eventQueue, settings.sampleRate);
 
     err = Pa_Initialize();
     if( err != paNoError ) goto error;
 
-    outputParameters.device = Pa_GetDefaultOutputDevice(); /* default output device */
-    if (outputParameters.device == paNoDevice) {
-      fprintf(stderr,"Error: No default output device.\n");
+    if (settings.listDevices) {
+        ListDevices();
+        Pa_Terminate();
+        delete host;
+        DeleteMidiPlayer(midi);
+        return 0;
+    }
+
+    if (settings.recordPath != NULL) {
+        host->recorder = CreateRecorder(settings.recordPath, settings.sampleRate);
+        if (host->recorder == NULL) {
+            Pa_Terminate();
+            delete host;
+            DeleteMidiPlayer(midi);
+            return 1;
+        }
+    }
+
+    outputParameters.device = (settings.device != paNoDevice) ? settings.device : Pa_GetDefaultOutputDevice();
+    if (outputParameters.device == paNoDevice || outputParameters.device >= Pa_GetDeviceCount()) {
+      fprintf(stderr,"Error: No such output device.\n");
       goto error;
     }
+    printf("PortAudio: %s, SR = %d, BufSize = %d\n", Pa_GetDeviceInfo( outputParameters.device )->name, settings.sampleRate, settings.framesPerBuffer);
     outputParameters.channelCount = 2;       /* stereo output */
     outputParameters.sampleFormat = paFloat32; /* 32 bit floating point output */
     outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
@@ -64,11 +472,11 @@ int main(void)
               &stream,
               NULL, /* no input */
               &outputParameters,
-              SAMPLE_RATE,
-              FRAMES_PER_BUFFER,
+              settings.sampleRate,
+              settings.framesPerBuffer,
               paClipOff,      /* we won't output out of range samples so don't bother clipping them */
               Callback,
-              &state );
+              host );
     if( err != paNoError ) goto error;
 
     err = Pa_SetStreamFinishedCallback( stream, &StreamFinished );
@@ -77,23 +485,46 @@ int main(void)
     err = Pa_StartStream( stream );
     if( err != paNoError ) goto error;
 
-    printf("Play for %d seconds.\n", NUM_SECONDS );
-    Pa_Sleep( NUM_SECONDS * 1000 );
+    printf("Play for %.1f seconds.\n", settings.seconds );
+    if (midi != NULL) {
+        auto const end = std::chrono::steady_clock::now() + std::chrono::duration<double>(settings.seconds);
+        while (std::chrono::steady_clock::now() < end) {
+            common::FeedEventQueue(*midi, &eventQueue);
+            Pa_Sleep( MIDI_FEED_MS );
+        }
+    } else {
+        Pa_Sleep( (long)(settings.seconds * 1000) );
+    }
 
     err = Pa_StopStream( stream );
     if( err != paNoError ) goto error;
 
+    if (host->recorder != NULL)
+        StopRecorder(host->recorder);
+    PrintReport(host, Pa_GetStreamInfo( stream ), midi);
+
     err = Pa_CloseStream( stream );
     if( err != paNoError ) goto error;
 
     Pa_Terminate();
+    if (host->recorder != NULL)
+        DestroyRecorder(host->recorder);
+    delete host;
+    DeleteMidiPlayer(midi);
     printf("Test finished.\n");
-    
+
     return err;
 error:
     Pa_Terminate();
+    if (host->recorder != NULL) {
+        if (host->recorder->writer.joinable())
+            StopRecorder(host->recorder);
+        DestroyRecorder(host->recorder);
+    }
+    delete host;
+    DeleteMidiPlayer(midi);
     fprintf( stderr, "An error occured while using the portaudio stream\n" );
     fprintf( stderr, "Error number: %d\n", err );
     fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
     return err;
-}
\ No newline at end of file
+}
@@ -1,7 +1,14 @@
+#pragma once
+
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
 
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include "AudioPluginUtil.h"
 #include "SPSCQueue.h"
 
 namespace common {
@@ -13,19 +20,22 @@ namespace common {
     static inline float const kSmallAmplitude = 0.0001f;
 
     // TODO: use a lookup table!!!
-    float MidiToFreq(int midi) {
+    inline float MidiToFreq(int midi) {
         int const a4 = 69;  // 440Hz
         return 440.0f * pow(2.0f, (midi - a4) / 12.0f);
     }
 
     enum class EventType {
-        None, NoteOn, NoteOff
+        None, NoteOn, NoteOff, ControlChange, Aftertouch
     };
 
     struct Event {
         EventType type;
         int timeInTicks = 0;
         int midiNote = 0;
+        // NoteOn: velocity. ControlChange: controller number in midiNote,
+        // controller value here. Aftertouch: pressure. All in [0,127].
+        int value = 127;
     };
 
     enum class AdsrState {
@@ -33,26 +43,99 @@ namespace common {
     };
 
     static inline int const kEventQueueLength = 64;
+
+    // The noise oscillator is generated this many samples at a time.
+    static inline int const kNoiseBlockLength = 64;
     typedef rigtorp::SPSCQueue<Event> EventQueue;
 
+    // Modulation matrix. Block-rate sources (CCs, velocity, aftertouch) only
+    // change when an event arrives, so their routes are summed into a
+    // per-destination offset at event time. Audio-rate sources (LFOs, the amp
+    // envelope) are compiled into the process kernel itself: at most one
+    // audio-rate source per destination, picked by template instantiation when
+    // the matrix is compiled.
+    enum class ModSource {
+        None, CC, Velocity, Aftertouch, LFO1, LFO2, AmpEnv
+    };
+
+    // Pitch and Cutoff are in octaves, Resonance adds to cutoffK, and Amp
+    // scales the output by (1 + amount).
+    enum class ModDest {
+        Pitch, Cutoff, Resonance, Amp, Count
+    };
+    static inline int const kNumModDests = (int)ModDest::Count;
+
+    struct ModRoute {
+        ModSource source = ModSource::None;
+        int cc = 0;  // only used when source == CC
+        ModDest dest = ModDest::Pitch;
+        float depth = 0.0f;
+    };
+
+    static inline int const kMaxModRoutes = 16;
+
+    struct ModMatrix {
+        ModRoute routes[kMaxModRoutes];
+        int numRoutes = 0;
+    };
+
+    // Voice pipeline settings. Every combination is compiled into its own
+    // voice kernel and SetVoiceConfig picks one from a table, so the sample
+    // loops never look at these.
+    enum class Oscillator {
+        Saw, Square, Count
+    };
+
+    enum class VoiceFilter {
+        Ladder, SVF, Count
+    };
+
+    static inline int const kNumOversamplingFactors = 3;  // 1x, 2x and 4x
+    static inline int const kMaxOversampling = 4;
+    static inline int const kMaxUnison = 4;
+
+    struct VoiceConfig {
+        Oscillator oscillator = Oscillator::Saw;
+        VoiceFilter filter = VoiceFilter::Ladder;
+        int oversampling = 1;
+        int unison = 1;  // oscillators per voice, spread over unisonDetune
+    };
+
+    // The modulation kernel works out these per-sample controls for a stretch
+    // of samples without events and hands them to the voice kernel in one go.
+    static inline int const kControlBlockLength = 64;
+
+    struct VoiceControl {
+        float freq[kControlBlockLength];
+        float cutoff[kControlBlockLength];
+        float k[kControlBlockLength];
+        float gain[kControlBlockLength];  // amp envelope times amp modulation
+        float noise[kControlBlockLength];
+        float noisePreFilter = 0.0f;
+        float noisePostFilter = 0.0f;
+    };
+
+    struct StateData;
+    typedef void (*ProcessKernel)(StateData* state, float* outputBuffer, int numChannels, int framesPerBuffer, int sampleRate);
+    typedef void (*VoiceKernel)(StateData* state, VoiceControl const& control, int numFrames, float* outputBuffer, int numChannels, int sampleRate);
+
     struct StateData {
         float f = 440.0f;
-        float left_phase = 0.0f;
-        float right_phase = 0.0f;
+        float oscPhase[kMaxUnison] = {};
+        float unisonDetune = 0.0f;  // cents between the outermost unison oscillators
         float cutoffFreq = 0.0f;
         float cutoffK = 0.0f;  // [0,4] but 4 is unstable
         float lp0 = 0.0f;
         float lp1 = 0.0f;
         float lp2 = 0.0f;
         float lp3 = 0.0f;
+        AudioPluginUtil::TrapezoidalSVF svf;
 
-        float pitchLFOGain = 0.0f;
-        float pitchLFOFreq = 0.0f;
-        float pitchLFOPhase = 0.0f;
+        float lfo1Freq = 0.0f;
+        float lfo1Phase = 0.0f;
 
-        float cutoffLFOGain = 0.0f;
-        float cutoffLFOFreq = 0.0f;
-        float cutoffLFOPhase = 0.0f;
+        float lfo2Freq = 0.0f;
+        float lfo2Phase = 0.0f;
 
         float ampEnvAttackTime = 0.0f;
         float ampEnvDecayTime = 0.0f;
@@ -62,14 +145,43 @@ namespace common {
         AdsrState ampEnvState = AdsrState::Closed;
         float lastNoteOnAmpEnvValue = 0.0f;
 
+        // Block-rate modulation sources, normalized to [0,1].
+        float cc[128] = {};
+        float velocity = 1.0f;
+        float aftertouch = 0.0f;
+
+        ModMatrix modMatrix;
+        // Filled in by SetModMatrix.
+        float blockMod[kNumModDests] = {};
+        float audioModDepth[kNumModDests] = {};
+        ProcessKernel kernel = nullptr;
+
+        // Filled in by SetVoiceConfig.
+        VoiceConfig voiceConfig;
+        VoiceKernel voiceKernel = nullptr;
+
+        // Noise mixed with the oscillators. noiseFilterAmount is the share
+        // of it that goes through the filter, the rest is added after
+        // the filter. Both parts follow the amp envelope.
+        float noiseLevel = 0.0f;
+        float noiseFilterAmount = 1.0f;
+        AudioPluginUtil::NoiseSource::Color noiseColor = AudioPluginUtil::NoiseSource::Color_White;
+        AudioPluginUtil::NoiseSource noise;
+        float noiseBuffer[kNoiseBlockLength];
+        int noisePos = kNoiseBlockLength;
+
         EventQueue* events = nullptr;
 
         int tickTime = 0;
 
+        // True if the last Process call skipped the whole block because the
+        // voice was closed. The output is all zeros in that case.
+        bool silent = false;
+
         char message[20];
     };
 
-    float Polyblep(float t, float dt) {
+    inline float Polyblep(float t, float dt) {
         if (t < dt) {
             t /= dt;
             return t+t - t*t - 1.0f;
@@ -82,7 +194,7 @@ namespace common {
         }
     }
 
-    float GenerateSquare(float const phase, float const phaseChange) {
+    inline float GenerateSquare(float const phase, float const phaseChange) {
         float v = 0.0f;
         if (phase < M_PI) {
             v = 1.0f;
@@ -97,7 +209,7 @@ namespace common {
         return v;
     }
 
-    float GenerateSaw(float const phase, float const phaseChange) {
+    inline float GenerateSaw(float const phase, float const phaseChange) {
         float v = (phase / M_PI) - 1.0f;
         // polyblep
         float dt = phaseChange / (2*M_PI);
@@ -106,8 +218,529 @@ namespace common {
         return v;
     }
 
-    void InitStateData(StateData& state, EventQueue* eventQueue, int sampleRate) {
-        state.left_phase = state.right_phase = 0.0f;
+    template <Oscillator kOsc>
+    inline float GenerateOscillator(float const phase, float const phaseChange) {
+        if constexpr (kOsc == Oscillator::Square) {
+            return GenerateSquare(phase, phaseChange);
+        } else {
+            return GenerateSaw(phase, phaseChange);
+        }
+    }
+
+    inline bool IsAudioRateModSource(ModSource source) {
+        return source == ModSource::LFO1 || source == ModSource::LFO2 || source == ModSource::AmpEnv;
+    }
+
+    // Recomputes the summed block-rate modulation. Called whenever a CC,
+    // velocity or aftertouch value changes.
+    inline void UpdateBlockMod(StateData* state) {
+        for (int d = 0; d < kNumModDests; ++d) {
+            state->blockMod[d] = 0.0f;
+        }
+        ModMatrix const& m = state->modMatrix;
+        for (int i = 0; i < m.numRoutes; ++i) {
+            ModRoute const& r = m.routes[i];
+            float src = 0.0f;
+            switch (r.source) {
+                case ModSource::CC: src = state->cc[r.cc & 127]; break;
+                case ModSource::Velocity: src = state->velocity; break;
+                case ModSource::Aftertouch: src = state->aftertouch; break;
+                default: continue;
+            }
+            state->blockMod[(int)r.dest] += r.depth * src;
+        }
+    }
+
+    template <ModSource kSrc>
+    inline float AudioRateModValue(float lfo1, float lfo2, float ampEnv) {
+        if constexpr (kSrc == ModSource::LFO1) {
+            return lfo1;
+        } else if constexpr (kSrc == ModSource::LFO2) {
+            return lfo2;
+        } else if constexpr (kSrc == ModSource::AmpEnv) {
+            return ampEnv;
+        } else {
+            return 0.0f;
+        }
+    }
+
+    // Evaluates the amp envelope for the current tick and advances it.
+    inline float NextAmpEnvValue(StateData* state, int const attackTimeInTicks, int const decayTimeInTicks, int const releaseTimeInTicks) {
+        float ampEnvValue = 0.0f;
+        switch (state->ampEnvState) {
+            case AdsrState::Closed: break;
+            case AdsrState::Opening: {
+                if (state->ampEnvTicksSinceStart < attackTimeInTicks) {
+                    // attack phase
+                    float t;
+                    if (attackTimeInTicks == 0) {
+                        t = 1.0f;
+                    } else {
+                        t = fmin(1.0f, (float) state->ampEnvTicksSinceStart / (float) attackTimeInTicks);
+                    }
+                    float const startAmp = kSmallAmplitude;
+                    float const factor = 1.0f / startAmp;
+                    ampEnvValue = startAmp*powf(factor, t);
+                } else {
+                    // decay phase
+                    float t;
+                    if (decayTimeInTicks == 0) {
+                        t = 1.0f;
+                    } else {
+                        int ticksSinceDecayStart = state->ampEnvTicksSinceStart - attackTimeInTicks;
+                        t = fmin(1.0f, (float) ticksSinceDecayStart / (float) decayTimeInTicks);
+                    }
+                    float const sustain = fmax(kSmallAmplitude, state->ampEnvSustainLevel);
+                    ampEnvValue = 1.0f*powf(sustain, t);
+                }
+                state->lastNoteOnAmpEnvValue = ampEnvValue;
+                break;
+            }
+            case AdsrState::Closing: {
+                // release phase. release time defined as how long it takes
+                // to get from value just before release down to -80db or
+                // w/e.
+                if (state->ampEnvTicksSinceStart > releaseTimeInTicks) {
+                    state->ampEnvState = AdsrState::Closed;
+                    break;
+                }
+                float t;
+                if (releaseTimeInTicks == 0) {
+                    t = 1.0f;
+                } else {
+                    t = fmin(1.0f, (float) state->ampEnvTicksSinceStart / (float) releaseTimeInTicks);
+                }
+                ampEnvValue = state->lastNoteOnAmpEnvValue*powf(kSmallAmplitude / state->lastNoteOnAmpEnvValue, t);
+                break;
+            }
+        }
+        ++state->ampEnvTicksSinceStart;
+        return ampEnvValue;
+    }
+
+    // Handles all events due at the current tick. Returns true if the note
+    // or any block-rate modulation source changed.
+    inline bool HandleEvents(StateData* state) {
+        bool modChanged = false;
+        Event* e = state->events->front();
+        while (e != nullptr && state->tickTime >= e->timeInTicks) {
+            if (e->timeInTicks == state->tickTime) {
+                switch (e->type) {
+                    case EventType::NoteOn: {
+                        state->f = MidiToFreq(e->midiNote);
+                        state->velocity = e->value * (1.0f / 127.0f);
+                        state->ampEnvTicksSinceStart = 0;
+                        state->ampEnvState = AdsrState::Opening;
+                        modChanged = true;
+                    }
+                        break;
+                    case EventType::NoteOff: {
+                        // TODO: ignoring the note. assuming monophony for now
+                        state->ampEnvTicksSinceStart = 0;
+                        state->ampEnvState = AdsrState::Closing;
+                    }
+                        break;
+                    case EventType::ControlChange: {
+                        state->cc[e->midiNote & 127] = e->value * (1.0f / 127.0f);
+                        modChanged = true;
+                    }
+                        break;
+                    case EventType::Aftertouch: {
+                        state->aftertouch = e->value * (1.0f / 127.0f);
+                        modChanged = true;
+                    }
+                        break;
+                    case EventType::None: {
+                        // will never happen
+                    }
+                        break;
+                }
+            }
+            state->events->pop();
+            e = state->events->front();
+        }
+        return modChanged;
+    }
+
+    // Number of ticks (up to maxTicks) before the next queued event is due.
+    inline int TicksUntilNextEvent(StateData* state, int const maxTicks) {
+        Event* e = state->events->front();
+        if (e == nullptr) {
+            return maxTicks;
+        }
+        int const n = e->timeInTicks - state->tickTime;
+        return n < 0 ? 0 : (n > maxTicks ? maxTicks : n);
+    }
+
+    // Advances a closed voice by numTicks without rendering anything. The
+    // filter is cleared so the next note starts from rest rather than from
+    // whatever was left in it.
+    inline void SkipSilentTicks(StateData* state, int const numTicks, float const lfo1PhaseChange, float const lfo2PhaseChange) {
+        state->lfo1Phase = fmodf(state->lfo1Phase + numTicks*lfo1PhaseChange, 2*kPi);
+        state->lfo2Phase = fmodf(state->lfo2Phase + numTicks*lfo2PhaseChange, 2*kPi);
+        state->lp0 = state->lp1 = state->lp2 = state->lp3 = 0.0f;
+        state->svf.Reset();
+        state->tickTime += numTicks;
+    }
+
+    // The oscillators, filter and output stage of the voice for one stretch
+    // of samples. Oversampled voices run the oscillators and the filter at the
+    // higher rate and average each group of sub-samples back down.
+    template <Oscillator kOsc, VoiceFilter kFilter, int kOversampling, int kUnison>
+    void RenderVoice(StateData* state, VoiceControl const& control, int const numFrames, float* outputBuffer, int const numChannels, int const sampleRate)
+    {
+        float const subSampleRate = (float)(sampleRate * kOversampling);
+        float buffer[kControlBlockLength * kOversampling] = {};
+
+        // Unison oscillators are spread evenly across the detune range and
+        // mixed at equal power.
+        float ratio[kUnison];
+        float phase[kUnison];
+        for (int u = 0; u < kUnison; ++u) {
+            float const spread = kUnison > 1 ? (float)u / (kUnison - 1) - 0.5f : 0.0f;
+            ratio[u] = exp2f(state->unisonDetune * spread * (1.0f / 1200.0f));
+            phase[u] = state->oscPhase[u];
+        }
+        float const unisonGain = 1.0f / sqrtf((float)kUnison);
+
+        float* sub = buffer;
+        for (int i = 0; i < numFrames; ++i) {
+            float const phaseChange = 2*kPi*control.freq[i] / subSampleRate;
+            float const noise = control.noisePreFilter*control.noise[i];
+            for (int o = 0; o < kOversampling; ++o) {
+                float v = 0.0f;
+                for (int u = 0; u < kUnison; ++u) {
+                    if (phase[u] >= 2*kPi) {
+                        phase[u] -= 2*kPi;
+                    }
+                    float const change = phaseChange*ratio[u];
+                    v += GenerateOscillator<kOsc>(phase[u], change);
+                    phase[u] += change;
+                }
+                *sub++ = v*unisonGain + noise;
+            }
+        }
+        for (int u = 0; u < kUnison; ++u) {
+            state->oscPhase[u] = phase[u];
+        }
+
+        if constexpr (kFilter == VoiceFilter::Ladder) {
+            float const dt = 1.0f / subSampleRate;
+            float lp0 = state->lp0, lp1 = state->lp1, lp2 = state->lp2, lp3 = state->lp3;
+            sub = buffer;
+            for (int i = 0; i < numFrames; ++i) {
+                float const rc = 1 / control.cutoff[i];
+                float const a = dt / (rc + dt);
+                float const k = control.k[i];
+                for (int o = 0; o < kOversampling; ++o) {
+                    float const v = *sub - k*lp3;
+                    lp0 = a*v + (1-a)*lp0;
+                    lp1 = a*lp0 + (1-a)*lp1;
+                    lp2 = a*lp1 + (1-a)*lp2;
+                    lp3 = a*lp2 + (1-a)*lp3;
+                    *sub++ = lp3;
+                }
+            }
+            state->lp0 = lp0;
+            state->lp1 = lp1;
+            state->lp2 = lp2;
+            state->lp3 = lp3;
+        } else {
+            // The SVF follows both the cutoff and the resonance every sample,
+            // so audio-rate resonance routes work as they do on the ladder.
+            // k in [0,4) maps to Q from 0.71 to about 17.
+            float cutoff[kControlBlockLength * kOversampling] = {};
+            float q[kControlBlockLength * kOversampling] = {};
+            for (int i = 0; i < numFrames; ++i) {
+                float const qi = 0.7071f / (1.0f - 0.24f*control.k[i]);
+                for (int o = 0; o < kOversampling; ++o) {
+                    cutoff[i*kOversampling + o] = control.cutoff[i];
+                    q[i*kOversampling + o] = qi;
+                }
+            }
+            state->svf.ProcessBlockModulated(buffer, cutoff, q, buffer, numFrames*kOversampling, subSampleRate);
+        }
+
+        sub = buffer;
+        for (int i = 0; i < numFrames; ++i) {
+            float v = 0.0f;
+            if constexpr (kOversampling == 1) {
+                v = *sub++;
+            } else {
+                for (int o = 0; o < kOversampling; ++o) {
+                    v += *sub++;
+                }
+                v *= 1.0f / kOversampling;
+            }
+            v += control.noisePostFilter*control.noise[i];
+            v *= control.gain[i];
+            for (int channelIx = 0; channelIx < numChannels; ++channelIx) {
+                *outputBuffer++ = v;
+            }
+        }
+    }
+
+    // The modulation stage of the voice, specialized on which audio-rate
+    // source (if any) feeds each destination. Unrouted sources compile away
+    // entirely. Between events it fills in a VoiceControl and runs the voice
+    // kernel picked by SetVoiceConfig on it.
+    template <ModSource kPitchSrc, ModSource kCutoffSrc, ModSource kResonanceSrc, ModSource kAmpSrc>
+    void ProcessWithMod(StateData* state, float* outputBuffer, int const numChannels, int const framesPerBuffer, int const sampleRate)
+    {
+        constexpr bool kUsesLFO1 = kPitchSrc == ModSource::LFO1 || kCutoffSrc == ModSource::LFO1 || kResonanceSrc == ModSource::LFO1 || kAmpSrc == ModSource::LFO1;
+        constexpr bool kUsesLFO2 = kPitchSrc == ModSource::LFO2 || kCutoffSrc == ModSource::LFO2 || kResonanceSrc == ModSource::LFO2 || kAmpSrc == ModSource::LFO2;
+
+        int const attackTimeInTicks = state->ampEnvAttackTime * sampleRate;
+        int const decayTimeInTicks = state->ampEnvDecayTime * sampleRate;
+        int const releaseTimeInTicks = state->ampEnvReleaseTime * sampleRate;
+        float const lfo1PhaseChange = state->lfo1Freq * 2*kPi / sampleRate;
+        float const lfo2PhaseChange = state->lfo2Freq * 2*kPi / sampleRate;
+        float const* depth = state->audioModDepth;
+        bool const useNoise = state->noiseLevel > 0.0f;
+
+        VoiceControl control;
+        if (useNoise) {
+            control.noisePreFilter = state->noiseLevel * state->noiseFilterAmount;
+            control.noisePostFilter = state->noiseLevel - control.noisePreFilter;
+        } else {
+            memset(control.noise, 0, sizeof(control.noise));
+        }
+
+        // Values that only change when an event comes in.
+        float baseF = 0.0f, baseCutoff = 0.0f, baseK = 0.0f, baseAmp = 0.0f;
+        auto updateBase = [&]() {
+            baseF = state->f * exp2f(state->blockMod[(int)ModDest::Pitch]);
+            baseCutoff = state->cutoffFreq * exp2f(state->blockMod[(int)ModDest::Cutoff]);
+            baseK = state->cutoffK + state->blockMod[(int)ModDest::Resonance];
+            baseAmp = 1.0f + state->blockMod[(int)ModDest::Amp];
+        };
+        updateBase();
+
+        bool rendered = false;
+        int i = 0;
+        while (i < framesPerBuffer)
+        {
+            // A closed voice is silent until the next event, so jump straight
+            // to it.
+            if (state->ampEnvState == AdsrState::Closed) {
+                int const n = TicksUntilNextEvent(state, framesPerBuffer - i);
+                if (n > 0) {
+                    memset(outputBuffer, 0, n*numChannels*sizeof(float));
+                    outputBuffer += n*numChannels;
+                    SkipSilentTicks(state, n, lfo1PhaseChange, lfo2PhaseChange);
+                    i += n;
+                    continue;
+                }
+            }
+            rendered = true;
+
+            if (HandleEvents(state)) {
+                UpdateBlockMod(state);
+                updateBase();
+            }
+
+            // Everything up to the next event is rendered in one go. An event
+            // pushed late may already be due; it's handled on the next pass.
+            int numFrames = TicksUntilNextEvent(state, std::min(framesPerBuffer - i, kControlBlockLength));
+            if (numFrames == 0) {
+                numFrames = 1;
+            }
+
+            for (int j = 0; j < numFrames; ++j) {
+                // LFOs keep running even when unrouted so they stay in phase.
+                if (state->lfo1Phase >= 2*kPi) {
+                    state->lfo1Phase -= 2*kPi;
+                }
+                if (state->lfo2Phase >= 2*kPi) {
+                    state->lfo2Phase -= 2*kPi;
+                }
+                // Make LFOs sine waves for now.
+                float const lfo1 = kUsesLFO1 ? sinf(state->lfo1Phase) : 0.0f;
+                float const lfo2 = kUsesLFO2 ? sinf(state->lfo2Phase) : 0.0f;
+                state->lfo1Phase += lfo1PhaseChange;
+                state->lfo2Phase += lfo2PhaseChange;
+
+                float const ampEnvValue = NextAmpEnvValue(state, attackTimeInTicks, decayTimeInTicks, releaseTimeInTicks);
+
+                float modulatedF = baseF;
+                if constexpr (kPitchSrc != ModSource::None) {
+                    modulatedF *= exp2f(depth[(int)ModDest::Pitch] * AudioRateModValue<kPitchSrc>(lfo1, lfo2, ampEnvValue));
+                }
+                control.freq[j] = modulatedF;
+
+                float modulatedCutoff = baseCutoff;
+                if constexpr (kCutoffSrc != ModSource::None) {
+                    modulatedCutoff *= exp2f(depth[(int)ModDest::Cutoff] * AudioRateModValue<kCutoffSrc>(lfo1, lfo2, ampEnvValue));
+                }
+                control.cutoff[j] = modulatedCutoff;
+
+                float k = baseK;  // between [0,4], unstable at 4
+                if constexpr (kResonanceSrc != ModSource::None) {
+                    k += depth[(int)ModDest::Resonance] * AudioRateModValue<kResonanceSrc>(lfo1, lfo2, ampEnvValue);
+                }
+                control.k[j] = fmin(fmax(k, 0.0f), 3.99f);
+
+                float amp = baseAmp;
+                if constexpr (kAmpSrc != ModSource::None) {
+                    amp += depth[(int)ModDest::Amp] * AudioRateModValue<kAmpSrc>(lfo1, lfo2, ampEnvValue);
+                }
+                control.gain[j] = ampEnvValue * fmax(amp, 0.0f);
+
+                ++state->tickTime;
+
+                // The rest is skipped once the release has run out.
+                if (state->ampEnvState == AdsrState::Closed) {
+                    numFrames = j + 1;
+                }
+            }
+
+            if (useNoise) {
+                for (int j = 0; j < numFrames; ++j) {
+                    if (state->noisePos == kNoiseBlockLength) {
+                        state->noise.Process(state->noiseBuffer, kNoiseBlockLength, state->noiseColor);
+                        state->noisePos = 0;
+                    }
+                    control.noise[j] = state->noiseBuffer[state->noisePos++];
+                }
+            }
+
+            state->voiceKernel(state, control, numFrames, outputBuffer, numChannels, sampleRate);
+            outputBuffer += numFrames*numChannels;
+            i += numFrames;
+        }
+        state->silent = !rendered;
+    }
+
+    // Kernel table indexed by the audio-rate source of each destination, two
+    // bits per destination: None, LFO1, LFO2, AmpEnv.
+    static inline ModSource const kAudioRateSources[4] = {
+        ModSource::None, ModSource::LFO1, ModSource::LFO2, ModSource::AmpEnv
+    };
+
+    constexpr ModSource AudioRateSourceAt(int index) {
+        return index == 1 ? ModSource::LFO1 : index == 2 ? ModSource::LFO2 : index == 3 ? ModSource::AmpEnv : ModSource::None;
+    }
+
+    template <int... Is>
+    constexpr std::array<ProcessKernel, sizeof...(Is)> MakeKernelTable(std::integer_sequence<int, Is...>) {
+        return {{ &ProcessWithMod<
+            AudioRateSourceAt(Is & 3), AudioRateSourceAt((Is >> 2) & 3),
+            AudioRateSourceAt((Is >> 4) & 3), AudioRateSourceAt((Is >> 6) & 3)>... }};
+    }
+
+    static inline std::array<ProcessKernel, 256> const kKernelTable =
+        MakeKernelTable(std::make_integer_sequence<int, 256>());
+
+    // Voice kernel table indexed by oscillator, filter, oversampling factor and
+    // unison count, slowest-varying first.
+    constexpr Oscillator VoiceOscillatorAt(int index) {
+        return (Oscillator)(index / (kMaxUnison * kNumOversamplingFactors * (int)VoiceFilter::Count));
+    }
+
+    constexpr VoiceFilter VoiceFilterAt(int index) {
+        return (VoiceFilter)((index / (kMaxUnison * kNumOversamplingFactors)) % (int)VoiceFilter::Count);
+    }
+
+    constexpr int VoiceOversamplingAt(int index) {
+        return 1 << ((index / kMaxUnison) % kNumOversamplingFactors);
+    }
+
+    template <int... Is>
+    constexpr std::array<VoiceKernel, sizeof...(Is)> MakeVoiceKernelTable(std::integer_sequence<int, Is...>) {
+        return {{ &RenderVoice<VoiceOscillatorAt(Is), VoiceFilterAt(Is), VoiceOversamplingAt(Is), Is % kMaxUnison + 1>... }};
+    }
+
+    static inline int const kNumVoiceKernels = (int)Oscillator::Count * (int)VoiceFilter::Count * kNumOversamplingFactors * kMaxUnison;
+
+    static inline std::array<VoiceKernel, kNumVoiceKernels> const kVoiceKernelTable =
+        MakeVoiceKernelTable(std::make_integer_sequence<int, kNumVoiceKernels>());
+
+    // Installs the voice kernel for a configuration. Cheap when nothing
+    // changed, so it can be called from Process with the current patch; a new
+    // filter or rate starts the filters from rest. Fails for settings there is
+    // no kernel for. Same threading rules as SetModMatrix.
+    inline bool SetVoiceConfig(StateData& state, VoiceConfig const& config) {
+        int oversamplingIndex = 0;
+        while (oversamplingIndex < kNumOversamplingFactors && (1 << oversamplingIndex) != config.oversampling) {
+            ++oversamplingIndex;
+        }
+        if ((int)config.oscillator < 0 || config.oscillator >= Oscillator::Count ||
+            (int)config.filter < 0 || config.filter >= VoiceFilter::Count ||
+            oversamplingIndex == kNumOversamplingFactors ||
+            config.unison < 1 || config.unison > kMaxUnison) {
+            return false;
+        }
+        int const index = (((int)config.oscillator * (int)VoiceFilter::Count + (int)config.filter) * kNumOversamplingFactors + oversamplingIndex) * kMaxUnison + config.unison - 1;
+        VoiceKernel const kernel = kVoiceKernelTable[index];
+        if (kernel == state.voiceKernel) {
+            return true;
+        }
+        if (config.filter != state.voiceConfig.filter || config.oversampling != state.voiceConfig.oversampling) {
+            state.lp0 = state.lp1 = state.lp2 = state.lp3 = 0.0f;
+            state.svf.Reset();
+        }
+        state.voiceConfig = config;
+        state.voiceKernel = kernel;
+        return true;
+    }
+
+    // Validates a matrix and picks the specialized kernel for it. Fails if a
+    // destination has more than one audio-rate source.
+    inline bool CompileModMatrix(ModMatrix const& m, ProcessKernel* kernel, float* audioModDepth) {
+        if (m.numRoutes < 0 || m.numRoutes > kMaxModRoutes) {
+            return false;
+        }
+        int sourceIndex[kNumModDests] = {};
+        for (int d = 0; d < kNumModDests; ++d) {
+            audioModDepth[d] = 0.0f;
+        }
+        for (int i = 0; i < m.numRoutes; ++i) {
+            ModRoute const& r = m.routes[i];
+            if ((int)r.dest < 0 || (int)r.dest >= kNumModDests) {
+                return false;
+            }
+            if (!IsAudioRateModSource(r.source) || r.depth == 0.0f) {
+                continue;
+            }
+            int const d = (int)r.dest;
+            if (sourceIndex[d] != 0) {
+                return false;
+            }
+            for (int s = 1; s < 4; ++s) {
+                if (kAudioRateSources[s] == r.source) {
+                    sourceIndex[d] = s;
+                }
+            }
+            audioModDepth[d] = r.depth;
+        }
+        int index = 0;
+        for (int d = 0; d < kNumModDests; ++d) {
+            index |= sourceIndex[d] << (2*d);
+        }
+        *kernel = kKernelTable[index];
+        return true;
+    }
+
+    // Installs a new routing. Must be called from the thread that runs
+    // Process (or while it is not running).
+    inline bool SetModMatrix(StateData& state, ModMatrix const& m) {
+        ProcessKernel kernel;
+        float depth[kNumModDests];
+        if (!CompileModMatrix(m, &kernel, depth)) {
+            return false;
+        }
+        state.modMatrix = m;
+        state.kernel = kernel;
+        memcpy(state.audioModDepth, depth, sizeof(depth));
+        UpdateBlockMod(&state);
+        return true;
+    }
+
+    inline void InitStateData(StateData& state, EventQueue* eventQueue, int sampleRate) {
+        for (int u = 0; u < kMaxUnison; ++u) {
+            state.oscPhase[u] = 0.0f;
+        }
+        state.unisonDetune = 0.0f;
         state.f = 440.0f;
         state.lp0 = 0.0f;
         state.lp1 = 0.0f;
@@ -115,21 +748,37 @@ namespace common {
         state.lp3 = 0.0f;
         state.cutoffFreq = 44100.0f;
         state.cutoffK = 0.0f;
-        state.pitchLFOFreq = 1.0f;
-        state.pitchLFOGain = 0.0f;
-        state.pitchLFOPhase = 0.0f;
-        state.cutoffLFOFreq = 10.0f;
-        state.cutoffLFOGain = 0.0f;
-        state.cutoffLFOPhase = 0.0f;
+        state.svf.Init(AudioPluginUtil::TrapezoidalSVF::Mode_Lowpass, state.cutoffFreq, sampleRate, 0.7071f);
+        state.lfo1Freq = 1.0f;
+        state.lfo1Phase = 0.0f;
+        state.lfo2Freq = 10.0f;
+        state.lfo2Phase = 0.0f;
         state.ampEnvAttackTime = 0.01f;
         state.ampEnvDecayTime = 0.1f;
         state.ampEnvSustainLevel = 0.5f;
         state.ampEnvReleaseTime = 0.5f;
+        state.noiseLevel = 0.0f;
+        state.noiseFilterAmount = 1.0f;
+        state.noiseColor = AudioPluginUtil::NoiseSource::Color_White;
+        state.noise.Init(1);
+        state.noisePos = kNoiseBlockLength;
+
+        // Default patch: LFO1 on pitch, LFO2 on cutoff, both at zero depth.
+        ModMatrix m;
+        m.routes[0].source = ModSource::LFO1;
+        m.routes[0].dest = ModDest::Pitch;
+        m.routes[1].source = ModSource::LFO2;
+        m.routes[1].dest = ModDest::Cutoff;
+        m.numRoutes = 2;
+        SetModMatrix(state, m);
+
+        state.voiceKernel = nullptr;
+        SetVoiceConfig(state, VoiceConfig());
 
         state.events = eventQueue;
     }
 
-    void InitEventQueueWithSequence(EventQueue* queue, int sampleRate) {
+    inline void InitEventQueueWithSequence(EventQueue* queue, int sampleRate) {
         int const bpm = 200;
         int const kSamplesPerBeat = (sampleRate * 60) / bpm;
         for (int i = 0; i < 16; ++i) {
@@ -145,147 +794,8 @@ namespace common {
         }
     }
 
-    void Process(StateData* state, float* outputBuffer, int const numChannels, int const framesPerBuffer, int const sampleRate)
+    inline void Process(StateData* state, float* outputBuffer, int const numChannels, int const framesPerBuffer, int const sampleRate)
     {
-        float const dt = 1.0f / sampleRate;
-        float const k = state->cutoffK;  // between [0,4], unstable at 4
-        int const attackTimeInTicks = state->ampEnvAttackTime * sampleRate;
-        int const decayTimeInTicks = state->ampEnvDecayTime * sampleRate;
-        int const releaseTimeInTicks = state->ampEnvReleaseTime * sampleRate;
-        
-        for(int i = 0; i < framesPerBuffer; ++i)
-        {
-            Event* e = state->events->front();
-            while (e != nullptr && state->tickTime >= e->timeInTicks) {
-                if (e->timeInTicks == state->tickTime) {
-                    switch (e->type) {
-                        case EventType::NoteOn: {
-                            state->f = MidiToFreq(e->midiNote);
-                            state->ampEnvTicksSinceStart = 0;
-                            state->ampEnvState = AdsrState::Opening;
-                        }
-                            break;
-                        case EventType::NoteOff: {
-                            // TODO: ignoring the note. assuming monophony for now
-                            state->ampEnvTicksSinceStart = 0;
-                            state->ampEnvState = AdsrState::Closing;                
-                        }
-                            break;
-                        case EventType::None: {
-                            // will never happen
-                        }
-                            break;
-                    }
-                }
-                state->events->pop();
-                e = state->events->front();
-            }
-
-            // Get pitch LFO value
-            if (state->pitchLFOPhase >= 2*kPi) {
-                state->pitchLFOPhase -= 2*kPi;
-            }
-            // Make LFO a sine wave for now.
-            float const pitchLFOValue = state->pitchLFOGain * sinf(state->pitchLFOPhase);
-            state->pitchLFOPhase += (state->pitchLFOFreq * 2*kPi / sampleRate);
-
-            // Now use the LFO value to get a new frequency.
-            float const modulatedF = state->f * powf(2.0f, pitchLFOValue);
-
-            // use left phase for both channels for now.
-            if (state->left_phase >= 2*kPi) {
-                state->left_phase -= 2*kPi;
-            }
-
-            float phaseChange = 2*kPi*modulatedF / sampleRate;
-
-            float v = 0.0f;
-            {
-                // v = GenerateSquare(state->left_phase, phaseChange);
-                v = GenerateSaw(state->left_phase, phaseChange);
-                state->left_phase += phaseChange;
-            }
-
-            // Get cutoff LFO value
-            if (state->cutoffLFOPhase >= 2*kPi) {
-                state->cutoffLFOPhase -= 2*kPi;
-            }
-            // Make LFO a sine wave for now.
-            float const cutoffLFOValue = state->cutoffLFOGain * sinf(state->cutoffLFOPhase);
-            state->cutoffLFOPhase += (state->cutoffLFOFreq * 2*kPi / sampleRate);
-
-            float const modulatedCutoff = state->cutoffFreq * powf(2.0f, cutoffLFOValue);
-
-            // ladder filter
-            // TODO: should we put this in the oversampling?
-            float const rc = 1 / modulatedCutoff;
-            float const a = dt / (rc + dt);
-            v -= k*state->lp3;
-
-            state->lp0 = a*v + (1-a)*state->lp0;
-            state->lp1 = a*(state->lp0) + (1-a)*state->lp1;
-            state->lp2 = a*(state->lp1) + (1-a)*state->lp2;
-            state->lp3 = a*(state->lp2) + (1-a)*state->lp3;
-            v = state->lp3;
-
-            // Amplitude envelope
-            float ampEnvValue = 0.0f;
-            switch (state->ampEnvState) {
-                case AdsrState::Closed: break;
-                case AdsrState::Opening: {
-                    if (state->ampEnvTicksSinceStart < attackTimeInTicks) {
-                        // attack phase
-                        float t;
-                        if (attackTimeInTicks == 0) {
-                            t = 1.0f;
-                        } else {
-                            t = fmin(1.0f, (float) state->ampEnvTicksSinceStart / (float) attackTimeInTicks);
-                        }
-                        float const startAmp = kSmallAmplitude;
-                        float const factor = 1.0f / startAmp;
-                        ampEnvValue = startAmp*powf(factor, t);
-                    } else {
-                        // decay phase
-                        float t;
-                        if (decayTimeInTicks == 0) {
-                            t = 1.0f;
-                        } else {
-                            int ticksSinceDecayStart = state->ampEnvTicksSinceStart - attackTimeInTicks;
-                            t = fmin(1.0f, (float) ticksSinceDecayStart / (float) decayTimeInTicks);
-                        }                        
-                        float const sustain = fmax(kSmallAmplitude, state->ampEnvSustainLevel);
-                        ampEnvValue = 1.0f*powf(sustain, t);
-                    }
-                    state->lastNoteOnAmpEnvValue = ampEnvValue;
-                    break;
-                }
-                case AdsrState::Closing: {
-                    // release phase. release time defined as how long it takes
-                    // to get from value just before release down to -80db or
-                    // w/e.
-                    if (state->ampEnvTicksSinceStart > releaseTimeInTicks) {
-                        state->ampEnvState = AdsrState::Closed;
-                        break;
-                    }
-                    float t;
-                    if (releaseTimeInTicks == 0) {
-                        t = 1.0f;
-                    } else {
-                        t = fmin(1.0f, (float) state->ampEnvTicksSinceStart / (float) releaseTimeInTicks);
-                    }
-                    ampEnvValue = state->lastNoteOnAmpEnvValue*powf(kSmallAmplitude / state->lastNoteOnAmpEnvValue, t);                    
-                    break;
-                }
-            }
-            ++state->ampEnvTicksSinceStart;
-
-            v *= ampEnvValue;
-
-            for (int channelIx = 0; channelIx < numChannels; ++channelIx) {
-                *outputBuffer++ = v;    
-            }
-
-            ++state->tickTime;
-        }
+        state->kernel(state, outputBuffer, numChannels, framesPerBuffer, sampleRate);
     }
-}
\ No newline at end of file
+}